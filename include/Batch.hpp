@@ -0,0 +1,110 @@
+/**
+ * @file Batch.hpp
+ * @author Koushtav Chakrabarty (koushtav@fleptic.eu)
+ * @brief Decoding & encoding of many image files on a pool of worker threads
+ */
+
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include "Decoder.hpp"
+#include "Encoder.hpp"
+#include "TaskScheduler.hpp"
+
+namespace kpeg
+{
+    /**
+     * @brief A file to convert, JPEG files are decoded to PPM & PPM/PGM
+     * files are encoded to JPEG.
+     */
+    struct BatchJob
+    {
+        std::string input;
+        std::string output;
+        bool decode;
+    };
+    
+    /**
+     * @brief The outcome of a job, with its timing.
+     */
+    struct BatchResult
+    {
+        std::string input;
+        std::string output;
+        bool success;
+        std::size_t inputBytes;
+        std::size_t outputBytes;
+        double seconds;
+    };
+    
+    class BatchProcessor
+    {
+        public:
+            
+            /**
+             * @brief Create a pool of `threadCount` workers, 0 uses the
+             * number of hardware threads.
+             */
+            explicit BatchProcessor( const std::size_t threadCount = 0 );
+            
+            /**
+             * @brief Make the jobs for a list of files and directories.
+             *
+             * The JPEG (.jpg/.jpeg) and PPM/PGM (.ppm/.pgm) files of a
+             * directory are picked up, not those of its subdirectories.
+             * The output goes next to the input, with the other extension.
+             * Returns false if a path can't be read or isn't an image.
+             *
+             * A job is skipped if its output is the input or the output of
+             * another job (e.g., a.jpg & a.ppm side by side, which would write
+             * each other's input), or if the output exists, unless `overwrite`
+             * is set.
+             */
+            static bool collectJobs( const std::vector<std::string>& paths, std::vector<BatchJob>& jobs, const bool overwrite = false );
+            
+            /**
+             * @brief Run all the jobs and wait for them to finish. The results
+             * are in the order of the jobs.
+             */
+            std::vector<BatchResult> run( const std::vector<BatchJob>& jobs );
+            
+            std::size_t getThreadCount() const;
+        
+        private:
+            
+            /**
+             * @brief The decoder & encoder of a job, reused from one job to the
+             * next. There's one for each worker, plus one for the thread
+             * waiting in run(), which runs jobs too.
+             */
+            struct WorkerState
+            {
+                JPEGDecoder decoder;
+                JPEGEncoder encoder;
+            };
+            
+            BatchResult runJob( const BatchJob& job );
+            
+            WorkerState* acquireState();
+            
+            void releaseState( WorkerState* state );
+        
+        private:
+            
+            std::mutex m_stateMutex;
+            
+            std::vector<std::unique_ptr<WorkerState>> m_states;
+            
+            std::vector<WorkerState*> m_freeStates;
+            
+            // Last, so the workers are joined before the states are destroyed
+            TaskScheduler m_scheduler;
+    };
+}
+
+#endif // BATCH_HPP
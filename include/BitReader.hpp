@@ -0,0 +1,100 @@
+/**
+ * @file BitReader.hpp
+ * @author Koushtav Chakrabarty (koushtav@fleptic.eu)
+ * @brief Reads variable length codes from the byte stuffed JPEG entropy coded data
+ */
+
+#ifndef BIT_READER_HPP
+#define BIT_READER_HPP
+
+#include <cstddef>
+
+#include "Types.hpp"
+#include "HuffmanTables.hpp"
+
+namespace kpeg
+{
+    /**
+     * @brief BitReader reads Huffman codes and coefficient bits MSB first
+     * from the entropy coded data of a scan, the counterpart of BitWriter.
+     * 
+     * The 0x00 byte stuffed after each 0xFF data byte is skipped. Reading
+     * stops at the first marker, past which only 0-bits are supplied, so
+     * a block that runs past the end of the data can be detected with
+     * isPastEnd() after it's decoded.
+     */
+    class BitReader
+    {
+        public:
+            
+            BitReader();
+            
+            BitReader( const UInt8* data, const std::size_t size );
+            
+            /**
+             * @brief The next `length` (up to 16) bits, without consuming them.
+             */
+            UInt32 peekBits( const int length );
+            
+            void skipBits( const int length );
+            
+            /**
+             * @brief Read `length` (up to 16) bits, MSB first.
+             */
+            UInt32 readBits( const int length );
+            
+            /**
+             * @brief Read a coefficient value of `size` bits, i.e.,
+             * the RECEIVE & EXTEND procedures (ITU-T.81, F.2.2.1).
+             */
+            int readValue( const int size );
+            
+            /**
+             * @brief Read a Huffman coded symbol, -1 if the bits
+             * don't form a valid code of `table`.
+             */
+            int readSymbol( const HuffmanDecodeTable& table );
+            
+            /**
+             * @brief True if only the padding bits of the last byte are
+             * left before the next marker (or the end of the data).
+             */
+            bool isAtMarker();
+            
+            /**
+             * @brief Skip the padding bits and the RSTn marker numbered `number`.
+             * Returns false, reading nothing, if the next marker isn't RSTn.
+             */
+            bool readRestartMarker( const int number );
+            
+            /**
+             * @brief True if more bits were read than the data holds.
+             */
+            bool isPastEnd() const;
+        
+        private:
+            
+            /**
+             * @brief Fill the bit buffer with at least 25 bits.
+             */
+            void fill();
+        
+        private:
+            
+            const UInt8* m_data;
+            
+            std::size_t m_size;
+            
+            std::size_t m_position; // Index of the next byte to be buffered
+            
+            UInt32 m_buffer;        // Buffered bits, left aligned
+            
+            int m_bitCount;         // Number of buffered bits
+            
+            int m_paddingBits;      // Number of buffered 0-bits supplied past the end of the data
+            
+            bool m_markerFound;     // The data ended at a marker, m_position is at its 0xFF byte
+    };
+}
+
+#endif // BIT_READER_HPP
@@ -0,0 +1,56 @@
+/**
+ * @file BitWriter.hpp
+ * @author Koushtav Chakrabarty (koushtav@fleptic.eu)
+ * @brief Packs variable length codes into the byte stuffed JPEG entropy coded data
+ */
+
+#ifndef BIT_WRITER_HPP
+#define BIT_WRITER_HPP
+
+#include <vector>
+
+#include "Types.hpp"
+
+namespace kpeg
+{
+    /**
+     * @brief BitWriter accumulates Huffman codes and coefficient bits MSB first
+     * and writes out whole bytes to an internal byte buffer.
+     * 
+     * Every 0xFF byte written to the buffer is followed by a stuffed 0x00 byte,
+     * so the output can be copied as is into the scan data of a JFIF file.
+     */
+    class BitWriter
+    {
+        public:
+            
+            BitWriter();
+            
+            /**
+             * @brief Write the `length` least significant bits of `bits`, MSB first.
+             */
+            void writeBits( const UInt32 bits, const int length );
+            
+            /**
+             * @brief Pad the last partial byte with 1-bits, as required before a
+             * marker (ITU-T.81, F.1.2.3).
+             */
+            void flush();
+            
+            const std::vector<UInt8>& getBytes() const;
+            
+        private:
+            
+            void emitByte( const UInt8 byte );
+            
+        private:
+            
+            std::vector<UInt8> m_bytes;
+            
+            UInt32 m_buffer;   // Pending bits, right aligned
+            
+            int    m_bitCount; // Number of pending bits in m_buffer
+    };
+}
+
+#endif // BIT_WRITER_HPP
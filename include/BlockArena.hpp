@@ -0,0 +1,61 @@
+/**
+ * @file BlockArena.hpp
+ * @author Koushtav Chakrabarty (koushtav@fleptic.eu)
+ * @brief Cache line aligned storage for 8x8 blocks of DCT coefficients
+ */
+
+#ifndef BLOCK_ARENA_HPP
+#define BLOCK_ARENA_HPP
+
+#include <memory>
+
+#include "Types.hpp"
+
+namespace kpeg
+{
+    /**
+     * @brief BlockArena holds blocks of 64 Int16 coefficients, one after the
+     * other, each starting at a cache line boundary.
+     * 
+     * The storage is kept from one image to the next and only reallocated to
+     * grow, so once it's big enough decoding doesn't allocate any blocks.
+     */
+    class BlockArena
+    {
+        public:
+            
+            BlockArena();
+            
+            BlockArena( const BlockArena& ) = delete;
+            
+            BlockArena& operator=( const BlockArena& ) = delete;
+            
+            /**
+             * @brief Make room for at least `count` blocks. The blocks are
+             * left with what they held, or undefined values when reallocated.
+             */
+            void reserve( const std::size_t count );
+            
+            /**
+             * @brief Set the `count` blocks from block `index` on to 0.
+             */
+            void clear( const std::size_t index, const std::size_t count );
+            
+            Int16* getBlock( const std::size_t index );
+            
+            std::size_t getCapacity() const;
+        
+        private:
+            
+            static const std::size_t ALIGNMENT = 64;
+            
+            std::unique_ptr<UInt8[]> m_storage;
+            
+            // The first block, the first aligned address of m_storage
+            Int16* m_blocks;
+            
+            std::size_t m_capacity;
+    };
+}
+
+#endif // BLOCK_ARENA_HPP
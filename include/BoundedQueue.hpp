@@ -0,0 +1,160 @@
+/**
+ * @file BoundedQueue.hpp
+ * @author Koushtav Chakrabarty (koushtav@fleptic.eu)
+ * @brief A fixed capacity, lock-free queue for any number of producers & consumers
+ */
+
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace kpeg
+{
+    /**
+     * @brief BoundedQueue is a lock-free multi-producer, multi-consumer FIFO
+     * queue of a fixed capacity (D. Vyukov's bounded MPMC queue).
+     *
+     * Each cell has a sequence number telling whether it's ready to be written
+     * or read in the current lap over the ring, so producers & consumers only
+     * contend on their own position counter with a compare-and-swap.
+     */
+    template <typename T>
+    class BoundedQueue
+    {
+        public:
+            
+            /**
+             * @brief Create a queue of at least `capacity` elements, the
+             * capacity is rounded up to a power of 2.
+             */
+            explicit BoundedQueue( const std::size_t capacity ) :
+             m_mask{0} ,
+             m_enqueuePos{0} ,
+             m_dequeuePos{0}
+            {
+                std::size_t size = 2;
+                
+                while ( size < capacity )
+                    size *= 2;
+                
+                m_cells.reset( new Cell[size] );
+                m_mask = size - 1;
+                
+                for ( std::size_t i = 0; i < size; ++i )
+                    m_cells[i].sequence.store( i, std::memory_order_relaxed );
+            }
+            
+            BoundedQueue( const BoundedQueue& ) = delete;
+            
+            BoundedQueue& operator=( const BoundedQueue& ) = delete;
+            
+            /**
+             * @brief Add `value` at the back, false if the queue is full.
+             */
+            bool tryPush( const T& value )
+            {
+                std::size_t pos = m_enqueuePos.load( std::memory_order_relaxed );
+                
+                while ( true )
+                {
+                    Cell& cell = m_cells[pos & m_mask];
+                    std::size_t sequence = cell.sequence.load( std::memory_order_acquire );
+                    std::ptrdiff_t diff = std::ptrdiff_t( sequence ) - std::ptrdiff_t( pos );
+                    
+                    if ( diff == 0 )
+                    {
+                        if ( m_enqueuePos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+                        {
+                            cell.value = value;
+                            cell.sequence.store( pos + 1, std::memory_order_release );
+                            return true;
+                        }
+                    }
+                    // The cell still holds the value of the previous lap
+                    else if ( diff < 0 )
+                        return false;
+                    else
+                        pos = m_enqueuePos.load( std::memory_order_relaxed );
+                }
+            }
+            
+            /**
+             * @brief Take the value at the front, false if the queue is empty.
+             */
+            bool tryPop( T& value )
+            {
+                std::size_t pos = m_dequeuePos.load( std::memory_order_relaxed );
+                
+                while ( true )
+                {
+                    Cell& cell = m_cells[pos & m_mask];
+                    std::size_t sequence = cell.sequence.load( std::memory_order_acquire );
+                    std::ptrdiff_t diff = std::ptrdiff_t( sequence ) - std::ptrdiff_t( pos + 1 );
+                    
+                    if ( diff == 0 )
+                    {
+                        if ( m_dequeuePos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+                        {
+                            value = cell.value;
+                            cell.sequence.store( pos + m_mask + 1, std::memory_order_release );
+                            return true;
+                        }
+                    }
+                    // Nothing written to the cell yet
+                    else if ( diff < 0 )
+                        return false;
+                    else
+                        pos = m_dequeuePos.load( std::memory_order_relaxed );
+                }
+            }
+            
+            /**
+             * @brief Add `value` at the back, waiting for room if the queue is full.
+             */
+            void push( const T& value )
+            {
+                while ( !tryPush( value ) )
+                    std::this_thread::yield();
+            }
+            
+            /**
+             * @brief Take the value at the front, waiting for one if the queue is empty.
+             */
+            void pop( T& value )
+            {
+                while ( !tryPop( value ) )
+                    std::this_thread::yield();
+            }
+        
+        private:
+            
+            struct Cell
+            {
+                std::atomic<std::size_t> sequence;
+                T value;
+            };
+            
+            // The cache line size, to keep the producers' and consumers'
+            // positions from bouncing the same line between the cores
+            static const std::size_t CACHE_LINE_SIZE = 64;
+            
+            std::unique_ptr<Cell[]> m_cells;
+            
+            std::size_t m_mask;
+            
+            char m_padding1[CACHE_LINE_SIZE];
+            
+            std::atomic<std::size_t> m_enqueuePos;
+            
+            char m_padding2[CACHE_LINE_SIZE];
+            
+            std::atomic<std::size_t> m_dequeuePos;
+            
+            char m_padding3[CACHE_LINE_SIZE];
+    };
+}
+
+#endif // BOUNDED_QUEUE_HPP
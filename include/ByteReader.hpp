@@ -0,0 +1,78 @@
+/**
+ * @file ByteReader.hpp
+ * @author Koushtav Chakrabarty (koushtav@fleptic.eu)
+ * @brief A bounds checked cursor over an in-memory byte buffer
+ *
+ * Used by the decoder to parse the marker segments of a JFIF file that
+ * has been read into memory. All the multi-byte fields of a JFIF file
+ * are big endian.
+ */
+
+#ifndef BYTE_READER_HPP
+#define BYTE_READER_HPP
+
+#include <cstddef>
+
+#include "Types.hpp"
+
+namespace kpeg
+{
+    /**
+     * @brief ByteReader reads fields from a buffer it doesn't own.
+     *
+     * A read that would go past the end of the buffer fails, returning
+     * false and leaving both the cursor and the destination unchanged.
+     */
+    class ByteReader
+    {
+        public:
+            
+            ByteReader();
+            
+            ByteReader( const UInt8* data, const std::size_t size );
+            
+            bool readUInt8( UInt8& value );
+            
+            /**
+             * @brief Read a big endian 16-bit word.
+             */
+            bool readUInt16( UInt16& value );
+            
+            /**
+             * @brief Move the cursor `count` bytes ahead.
+             */
+            bool skip( const std::size_t count );
+            
+            /**
+             * @brief A reader over the next `count` bytes, e.g., the body of a
+             * segment. The cursor is moved past them.
+             */
+            bool subReader( const std::size_t count, ByteReader& reader );
+            
+            /**
+             * @brief Move the cursor to the next 0xFF byte, or the end of the buffer.
+             */
+            void seekToNextFF();
+            
+            std::size_t getPosition() const;
+            
+            std::size_t getRemaining() const;
+            
+            bool isAtEnd() const;
+            
+            /**
+             * @brief Pointer to the byte at the cursor.
+             */
+            const UInt8* getCurrent() const;
+        
+        private:
+            
+            const UInt8* m_data;
+            
+            std::size_t m_size;
+            
+            std::size_t m_position;
+    };
+}
+
+#endif // BYTE_READER_HPP
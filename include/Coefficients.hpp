@@ -0,0 +1,69 @@
+/**
+ * @file Coefficients.hpp
+ * @author Koushtav Chakrabarty (koushtav@fleptic.eu)
+ * @brief Quantized DCT coefficients of a JPEG image
+ *
+ * The coefficient domain representation is produced by the decoder, right
+ * after the entropy decoding, and can be entropy coded again by the encoder.
+ * It's what lossless transformations & analysis of JPEG images work on.
+ */
+
+#ifndef COEFFICIENTS_HPP
+#define COEFFICIENTS_HPP
+
+#include <array>
+#include <vector>
+
+#include "Types.hpp"
+
+namespace kpeg
+{
+    /**
+     * @brief The quantized DCT coefficient blocks of a component.
+     * 
+     * The blocks are stored row by row, including the blocks that pad the
+     * component to a whole number of MCUs. Each block holds 64 coefficients
+     * in natural (row major) order, i.e., not in zig-zag order.
+     */
+    struct CoefficientComponent
+    {
+        int ID;
+        int HSampFactor;     // Horizontal sampling factor
+        int VSampFactor;     // Vertical sampling factor
+        int QTableNumber;    // Quantization table used
+        int blocksPerLine;
+        int blocksPerColumn;
+        
+        std::vector<Int16> coefficients;
+        
+        Int16* getBlock( const int row, const int column )
+        {
+            return &coefficients[ ( row * blocksPerLine + column ) * 64 ];
+        }
+        
+        const Int16* getBlock( const int row, const int column ) const
+        {
+            return &coefficients[ ( row * blocksPerLine + column ) * 64 ];
+        }
+    };
+    
+    /** Quantization table, in natural (row major) order */
+    typedef std::array<UInt16, 64> QuantizationTable;
+    
+    /**
+     * @brief The quantized DCT coefficients of all the components of an image,
+     * with the quantization tables needed to dequantize them.
+     */
+    struct JPEGCoefficients
+    {
+        int width;
+        int height;
+        
+        std::vector<CoefficientComponent> components;
+        
+        // Indexed by the quantization table number, unused tables are all 0s
+        std::array<QuantizationTable, 4> QTables;
+    };
+}
+
+#endif // COEFFICIENTS_HPP
@@ -5,7 +5,11 @@
  * @brief The implementation of a baseline, DCT JPEG decoder
  * 
  * Decoder module is the implementation of a 8-bit Sequential
- * Baseline DCT, grayscale/RGB encoder with no subsampling (4:4:4).
+ * Baseline DCT, grayscale or Y-Cb-Cr (RGB) decoder with any chroma
+ * subsampling (4:4:4, 4:2:2, 4:2:0, 4:4:0, ...), upsampled by
+ * replication. The MCUs are decoded by kernels specialised for
+ * grayscale, 4:4:4, 4:2:2 & 4:2:0, generic ones for the rest.
+ * Colour images can also be decoded to their luminance only.
  */
 
 #ifndef DECODER_HPP
@@ -13,16 +17,72 @@
 
 #include <fstream>
 #include <vector>
+#include <memory>
 #include <utility>
 #include <bitset>
 
 #include "Types.hpp"
+#include "Coefficients.hpp"
+#include "ByteReader.hpp"
+#include "BitReader.hpp"
+#include "HuffmanTables.hpp"
 #include "Image.hpp"
-#include "HuffmanTree.hpp"
-#include "MCU.hpp"
+#include "Transform.hpp"
+#include "TaskScheduler.hpp"
+#include "BlockArena.hpp"
 
 namespace kpeg
 {
+    /**
+     * @brief Image information read from the headers of a JPEG file,
+     * without decoding the scan data.
+     */
+    struct JPEGInfo
+    {
+        struct Component
+        {
+            int ID;
+            int HSampFactor;  // Horizontal sampling factor
+            int VSampFactor;  // Vertical sampling factor
+            int QTableNumber; // Quantization table used
+        };
+        
+        int width;
+        int height;
+        int precision;          // Bits per sample
+        
+        std::vector<Component> components;
+        
+        UInt8 frameMarker;      // SOFn marker (second byte), e.g., 0xC0 for baseline DCT
+        bool isProgressive;
+        
+        UInt16 restartInterval; // 0 if there's no DRI segment
+        
+        bool hasComment;
+        UInt16 APPSegments;     // Bit n is set if an APPn segment is present
+    };
+    
+    /**
+     * @brief A quantization table, in natural order, with each entry scaled by
+     * the IDCT's factor for that coefficient, 1/4 C(u) C(v).
+     */
+    typedef std::array<float, 64> IDCTTable;
+    
+    /**
+     * @brief A component of the frame being decoded.
+     */
+    struct DecoderComponent
+    {
+        int ID;
+        int HSampFactor;     // Horizontal sampling factor
+        int VSampFactor;     // Vertical sampling factor
+        int QTableNumber;    // Quantization table used
+        int DCTableNumber;   // DC Huffman table used, from the SOS segment
+        int ACTableNumber;   // AC Huffman table used, from the SOS segment
+        int blocksPerLine;   // Including the blocks that pad the image to whole MCUs
+        int blocksPerColumn;
+    };
+    
     class JPEGDecoder
     {
         public:
@@ -39,8 +99,26 @@ namespace kpeg
             
             ResultCode decodeImageFile();
             
-//             void displayImage();
+            /**
+             * @brief Check the integrity of the image without decoding it.
+             * 
+             * Only the Huffman coded scan data is walked over, to check for
+             * invalid codes, out of range coefficients, missing or misplaced
+             * restart markers and scan data that ends before (or continues
+             * after) the last block. No pixels are reconstructed. Returns
+             * SUCCESS for a valid image.
+             */
+            ResultCode validate();
             
+            /**
+             * @brief Decode the image only up to its quantized DCT coefficients,
+             * without reconstructing any pixels. Returns SUCCESS if the whole
+             * scan was decoded.
+             */
+            ResultCode decodeCoefficients( JPEGCoefficients& coefficients );
+
+//             void displayImage();
+        
         public:
             
             JPEGDecoder();
@@ -51,63 +129,227 @@ namespace kpeg
             
             bool open( const std::string& filename );
             
+            /**
+             * @brief Open a JPEG image held in memory, the data is copied.
+             */
+            bool open( const UInt8* data, const std::size_t size );
+            
+            /**
+             * @brief Release the image data, and forget the tables & components
+             * of the image so the next one can't decode with them.
+             */
             void close();
             
+            /**
+             * @brief Set the number of threads decodeImageFile() uses, 0 (the
+             * default) uses the number of hardware threads.
+             * 
+             * The calling thread entropy decodes the rows of MCUs, the others
+             * reconstruct the pixels of the rows decoded so far. With 1 thread
+             * both are done on the calling thread, one row after the other.
+             */
+            void setThreadCount( const std::size_t count );
+            
+            /**
+             * @brief Reconstruct the rows on `scheduler`, shared with other decoders,
+             * in place of the decoder's own threads. nullptr goes back to those.
+             * 
+             * Decoders sharing a scheduler steal each other's rows, so a large
+             * image keeps all the threads busy after the small ones are done.
+             */
+            void setScheduler( TaskScheduler* scheduler );
+            
+            /**
+             * @brief Decode colour images to their luminance only, as GRAY8
+             * pixels. Grayscale (1 component) images always are.
+             * 
+             * The Cb & Cr blocks still have to be entropy decoded, to get to
+             * the blocks after them, but they aren't inverse transformed and
+             * there's no colour conversion. Takes effect from the next
+             * decodeImageFile().
+             */
+            void setGrayscaleOutput( const bool grayscale );
+            
+            /**
+             * @brief Read the image information from the headers of a JPEG file.
+             * 
+             * Parsing stops at the first SOS segment, the scan data is never
+             * read and no Huffman trees are built. Only the beginning of the
+             * file is read, more is read if the headers are larger.
+             */
+            static bool probe( const std::string& filename, JPEGInfo& info );
+            
+            /**
+             * @brief Read the image information from a JPEG image held in memory.
+             */
+            static bool probe( const UInt8* data, const std::size_t size, JPEGInfo& info );
+            
             ResultCode parseSegmentInfo( const UInt8 byte );
             
             void printDetectedSegmentNames();
             
             bool dumpRawData();
             
+            /**
+             * @brief Dump the decoded pixels to a PPM, PGM or PAM file,
+             * picked by the extension of `filename`.
+             */
+            bool dumpRawData( const std::string& filename );
+            
             inline void printCurrPos()
             {
-                std::cout << "Current file pos: 0x" << std::hex << m_imageFile.tellg() << std::endl;
+                std::cout << "Current file pos: 0x" << std::hex << m_reader.getPosition() << std::endl;
             }
-                        
+        
         private:
             
-            void parseJFIFSegment();
+            /**
+             * @brief Collect the image information from the segments read by `reader`.
+             * 
+             * Returns SUCCESS once the SOS segment is reached, DECODE_INCOMPLETE
+             * if the data ends before that and ERROR for a malformed file.
+             */
+            static ResultCode parseHeaderInfo( ByteReader& reader, JPEGInfo& info );
             
-            void parseQuantizationTable();
+            /**
+             * @brief Clear the quantization & Huffman tables and the components,
+             * an image must define all the tables it uses itself.
+             */
+            void clearImageState();
             
-            ResultCode parseSOF0Segment();
+            /**
+             * @brief Parse all the segments of the image file, up to the End of Image
+             * marker. Returns DECODE_DONE if the image is complete.
+             */
+            ResultCode parseSegments();
+            
+            /**
+             * @brief Entropy decode all the blocks of the scan, storing the
+             * coefficients in `coefficients` unless it's null.
+             */
+            ResultCode decodeScanBlocks( JPEGCoefficients* coefficients );
+            
+            ResultCode parseJFIFSegment( ByteReader& segment );
+            
+            ResultCode parseQuantizationTable( ByteReader& segment );
             
-            void parseHuffmanTable();
+            ResultCode parseSOF0Segment( ByteReader& segment );
             
-            void parseSOSSegment();
+            ResultCode parseHuffmanTable( ByteReader& segment );
+            
+            ResultCode parseSOSSegment( ByteReader& segment );
+            
+            ResultCode parseDRISegment( ByteReader& segment );
             
             void scanImageData();
             
-            void parseComment();
+            ResultCode parseComment( ByteReader& segment );
             
             //
             
-            // Convert bytes of the form XXFF00YY to just XXFFYY
-            void byteStuffScanData();
+            /**
+             * @brief Decode the scan to the pixels of the image.
+             * 
+             * The entropy decoding is serial, so it runs on the calling thread
+             * and hands each decoded row of MCUs to the workers, which do the
+             * IDCT & colour conversion while the next rows are decoded.
+             * 
+             * Returns DECODE_DONE, or DECODE_INCOMPLETE if the scan data is
+             * invalid, with the rows from the invalid MCU on left gray.
+             */
+            ResultCode decodeScanData();
+            
+            /**
+             * @brief Decode the Huffman coded coefficients of the next block of
+             * `component` to `block`, in natural order. `DCPred` is the DC
+             * prediction of the component, updated for the next block.
+             * 
+             * Only the nonzero coefficients are stored, `block` has to be all 0s.
+             * 
+             * Returns false, with the reason logged, for invalid scan data.
+             */
+            bool decodeBlock( BitReader& reader, const DecoderComponent& component, int& DCPred, Int16* block );
+            
+            /**
+             * @brief Entropy decode the MCUs of row `row` to `coefficients`, which
+             * holds the blocks of each component, one after the other, as rows
+             * of all 0 blocks. The coefficients are stored quantized, in natural
+             * order.
+             * 
+             * This & the other MCU kernels are specialised for `COMPONENTS` (1 or
+             * 3) components, luma sampled `H` x `V` & chroma 1 x 1, so their loops
+             * are fixed at compile time. An `H` & `V` of 0 take the sampling
+             * factors of the components, for any other layout.
+             * 
+             * Returns false, with the reason logged, for invalid scan data.
+             */
+            template <int COMPONENTS, int H, int V>
+            bool decodeMCURow( BitReader& reader, const int row, std::vector<int>& DCPred, int& restartCount, Int16* coefficients );
+            
+            /**
+             * @brief Decode the `HS` x `VS` blocks of component `c` in MCU `col` of
+             * a row, `coefficients` being the component's blocks in the row.
+             */
+            template <int HS, int VS>
+            bool decodeMCUBlocks( BitReader& reader, const int c, const int col, int& DCPred, Int16* coefficients );
+            
+            /**
+             * @brief Reconstruct the pixels of MCU row `row` from its coefficients,
+             * with `samples` as the space for the components' samples.
+             * 
+             * Rows write to different pixels, so they may be reconstructed in
+             * any order & in parallel.
+             */
+            template <int COMPONENTS, int H, int V>
+            void reconstructMCURow( const int row, const Int16* coefficients, std::vector<Int16>& samples );
             
             /**
-             * @brief Decode the RLE-Huffman encoded image pixel data
-             * @author Koushtav Chakrabarty (koushtav@fleptic.eu)
+             * @brief Dequantize, inverse DCT & level shift a block to the 8x8
+             * samples at `samples`, which are `stride` samples apart vertically.
              * 
-             * This function goes bit by bit over the image scan data
-             * and decodes it using the provided DC and AC Huffman tables
-             * for luminance (Y) and chrominance ( Cb & Cr ).
+             * The IDCT is done as 1-D transforms of the columns & then of the
+             * rows. The nonzero coefficients are dequantized with `table` as
+             * they're fed to the first pass.
              */
-            void decodeScanData();
+            void computeIDCT( const Int16* coefficients, const IDCTTable& table, Int16* samples, const int stride );
             
+            /**
+             * @brief Convert the Y-Cb-Cr samples of a row of pixels to R-G-B,
+             * `planes` being the samples of the components at that row. A
+             * single component is gray, copied to the GRAY8 pixels.
+             */
+            template <int COMPONENTS, int H>
+            void convertYCbCrToRGB( const Int16* const planes[3], const int y );
+            
+            /**
+             * @brief Pick the MCU kernels for the components & sampling factors
+             * of the frame, once it's been read from the SOF-0 segment.
+             */
+            void selectMCUKernels();
+            
+            template <int COMPONENTS, int H, int V>
+            void setMCUKernels();
+        
         private:
             
             void displayHuffmanCodes();
-            
+        
         private:
             
             std::string m_filename;
             
-            std::ifstream m_imageFile;
+            // The whole image file, the segments are parsed from memory
+            std::vector<UInt8> m_fileData;
+            
+            ByteReader m_reader;
             
             Image m_image;
             
-            std::vector<std::vector<UInt16>> m_QTables;//[4];
+            // Quantization tables #0-3, in natural (row major) order
+            std::array<QuantizationTable, 4> m_QTables;
+            
+            // The same tables, pre-scaled for the IDCT
+            std::array<IDCTTable, 4> m_IDCTTables;
             
             //int m_huffTableCount;
             
@@ -118,13 +360,42 @@ namespace kpeg
             
             std::vector< std::pair<int, int> > mDHTsScanned;
             
-            HuffmanTree m_huffmanTree[2][2];
+            HuffmanDecodeTable m_huffmanDecodeTables[2][2];
+            
+            std::vector<DecoderComponent> m_components;
+            
+            // Number of MCUs in each row and column of the image
+            int m_MCUCols;
+            int m_MCURows;
+            
+            // Largest sampling factors of the components, the MCU's size in blocks
+            int m_maxHSampFactor;
+            int m_maxVSampFactor;
+            
+            // The MCU kernels for the layout of the frame
+            bool (JPEGDecoder::*m_decodeMCURow)( BitReader&, const int, std::vector<int>&, int&, Int16* );
+            void (JPEGDecoder::*m_reconstructMCURow)( const int, const Int16*, std::vector<Int16>& );
+            
+            // Offset and size of the entropy coded data of the scan in m_fileData
+            std::size_t m_scanOffset;
+            std::size_t m_scanSize;
+            
+            // Number of MCUs in each restart interval, 0 if there are no restart markers
+            UInt16 m_restartInterval;
+            
+            std::size_t m_threadCount;
+            
+            // Reconstruct the luminance only, to GRAY8 pixels
+            bool m_grayscaleOutput;
+            
+            // Scheduler shared with other decoders, if any
+            TaskScheduler* m_scheduler;
             
-            // Image scan data
-            //std::vector<std::bitset<8>> m_scanData;
-            std::string m_scanData;
+            // The reconstruction workers, kept from one image to the next
+            std::unique_ptr<TaskScheduler> m_ownScheduler;
             
-            std::vector<MCU> m_MCU;
+            // The coefficients of the rows of MCUs being decoded & reconstructed
+            BlockArena m_blocks;
     };
 }
 
@@ -5,7 +5,8 @@
  * @brief The implementation of a baseline DCT JPEG encoder
  * 
  * Encoder module is the implementation of a 8-bit Sequential
- * Baseline DCT, grayscale/RGB encoder with no subsampling (4:4:4).
+ * Baseline DCT, grayscale/RGB encoder with 4:4:4, 4:2:2 or 4:2:0
+ * chroma subsampling.
  */
 
 #ifndef ENCODER_HPP
@@ -15,15 +16,21 @@
 #include <vector>
 #include <utility>
 #include <bitset>
+#include <memory>
 
 #include "Types.hpp"
 #include "Transform.hpp"
 #include "Image.hpp"
 #include "HuffmanTree.hpp"
-#include "MCU.hpp"
+#include "HuffmanTables.hpp"
+#include "BitWriter.hpp"
+#include "OutputSink.hpp"
+#include "Coefficients.hpp"
 
 namespace kpeg
 {
+    class ThreadPool;
+    
     // Luminance Quantization matrix, Quality: 50%
     const std::array<std::array<uint8_t, 8>, 8> M_QT_MAT_LUMA
     {
@@ -54,408 +61,34 @@ namespace kpeg
         }
     };
     
-    // Standard Huffman Tables
-    // See Annex-K of the JPEG standard
-    
-    const std::array<std::string, 12> DC_LUMA_HUFF_CODES = 
-    {
-        "00"        ,
-        "010"       ,
-        "011"       ,
-        "100"       ,
-        "101"       ,
-        "110"       ,
-        "1110"      ,
-        "11110"     ,
-        "111110"    ,
-        "1111110"   ,
-        "11111110"  ,
-        "111111110"
-    };
-    
-    const std::array<std::string, 12> DC_CHROMA_HUFF_CODES = 
-    {
-        "00"          ,
-        "01"          ,
-        "10"          ,
-        "110"         ,
-        "1110"        ,
-        "11110"       ,
-        "111110"      ,
-        "1111110"     ,
-        "11111110"    ,
-        "111111110"   ,
-        "1111111110"  ,
-        "11111111110"
-    };
-    
-    //const std::array<std::array<std::string, 11>, 16> AC_LUMA_HUFF_CODES = 
-    const std::vector<std::vector<std::string>> AC_LUMA_HUFF_CODES = 
-    {
-        {"1010", // 0/0(EOB)
-        "00", // 0/1
-        "01", // 0/2
-        "100", // 0/3
-        "1011", // 0/4
-        "11010", // 0/5
-        "1111000", // 0/6
-        "11111000", // 0/7
-        "1111110110", // 0/8
-        "1111111110000010", // 0/9
-        "1111111110000011"}, // 0/A
-        {"NULL" // 1/0
-        "1100", // 1/1
-        "11011", // 1/2
-        "1111001", // 1/3
-        "111110110", // 1/4
-        "11111110110", // 1/5
-        "1111111110000100", // 1/6
-        "1111111110000101", // 1/7
-        "1111111110000110", // 1/8
-        "1111111110000111", // 1/9
-        "1111111110001000"}, // 1/A
-        {"NULL", // 2/0
-        "11100", // 2/1
-        "11111001", // 2/2
-        "1111110111", // 2/3
-        "111111110100", // 2/4
-        "1111111110001001", // 2/5
-        "1111111110001010", // 2/6
-        "1111111110001011", // 2/7
-        "1111111110001100", // 2/8
-        "1111111110001101", // 2/9
-        "1111111110001110"}, // 2/A
-        {"NULL", // 3/0
-        "111010", // 3/1
-        "111110111",  // 3/2
-        "111111110101", // 3/3
-        "11111111110001111",  // 3/4
-        "11111111110010000",  // 3/5
-        "11111111110010001",  // 3/6
-        "11111111110010010",  // 3/7
-        "11111111110010011",  // 3/8
-        "11111111110010100",  // 3/9
-        "11111111110010101"},  // 3/A
-        {"NULL", // 4/0
-        "111011", // 4/1
-        "1111111000", // 4/2
-        "1111111110010110", // 4/3
-        "1111111110010111", // 4/4
-        "1111111110011000", // 4/5
-        "1111111110011001", // 4/6
-        "1111111110011010", // 4/7
-        "1111111110011011", // 4/8
-        "1111111110011100", // 4/9
-        "1111111110011101"}, // 4/A
-        {"NULL", // 5/0
-        "1111010", // 5/1
-        "11111110111", // 5/2
-        "1111111110011110", // 5/3
-        "1111111110011111", // 5/4
-        "1111111110100000", // 5/5
-        "1111111110100001", // 5/6
-        "1111111110100010", // 5/7
-        "1111111110100011", // 5/8
-        "1111111110100100", // 5/9
-        "1111111110100101"}, // 5/A
-        {"NULL", // 6/0
-        "1111011", // 6/1
-        "111111110110" // 6/2
-        "1111111110100110", // 6/3
-        "1111111110100111", // 6/4
-        "1111111110101000", // 6/5
-        "1111111110101001", // 6/6
-        "1111111110101010", // 6/7
-        "1111111110101011", // 6/8
-        "1111111110101100", // 6/9
-        "1111111110101101"}, // 6/A
-        {"NULL", // 7/0
-        "11111010", // 7/1
-        "111111110111", // 7/2
-        "1111111110101110", // 7/3
-        "1111111110101111", // 7/4
-        "1111111110110000", // 7/5
-        "1111111110110001", // 7/6
-        "1111111110110010", // 7/7
-        "1111111110110011", // 7/8
-        "1111111110110100", // 7/9
-        "1111111110110101"}, // 7/A
-        {"NULL", // 8/0
-        "111111000", // 8/1
-        "111111111000000", // 8/2
-        "1111111110110110", // 8/3
-        "1111111110110111", // 8/4
-        "1111111110111000", // 8/5
-        "1111111110111001", // 8/6
-        "1111111110111010", // 8/7
-        "1111111110111011", // 8/8
-        "1111111110111100", // 8/9
-        "1111111110111101"}, // 8/A
-        {"NULL", // 9/0
-        "111111001", // 9/1
-        "1111111110111110", // 9/2
-        "1111111110111111", // 9/3
-        "1111111111000000", // 9/4
-        "1111111111000001", // 9/5
-        "1111111111000010", // 9/6
-        "1111111111000011", // 9/7
-        "1111111111000100", // 9/8
-        "1111111111000101", // 9/9
-        "1111111111000110"}, // 9/A
-        {"NULL", // A/0
-        "111111010",  // A/1
-        "1111111111000111", // A/2
-        "1111111111001000", // A/3
-        "1111111111001001", // A/4
-        "1111111111001010", // A/5
-        "1111111111001011", // A/6
-        "1111111111001100", // A/7
-        "1111111111001101", // A/8
-        "1111111111001110", // A/9
-        "1111111111001111"}, // A/A
-        {"NULL", // B/0
-        "1111111001", // B/1
-        "1111111111010000", // B/2
-        "1111111111010001", // B/3
-        "1111111111010010", // B/4
-        "1111111111010011", // B/5
-        "1111111111010100", // B/6
-        "1111111111010101", // B/7
-        "1111111111010110", // B/8
-        "1111111111010111", // B/9
-        "1111111111011000"}, // B/A
-        {"NULL", // C/0
-        "1111111010", // C/1
-        "1111111111011001", // C/2
-        "1111111111011010", // C/3
-        "1111111111011011", // C/4
-        "1111111111011100", // C/5
-        "1111111111011101", // C/6
-        "1111111111011110", // C/7
-        "1111111111011111", // C/8
-        "1111111111100000", // C/9
-        "1111111111100001"}, // C/A
-        {"NULL", // D/0
-        "11111111000", // D/1
-        "1111111111100010", // D/2
-        "1111111111100011", // D/3
-        "1111111111100100", // D/4
-        "1111111111100101", // D/5
-        "1111111111100110", // D/6
-        "1111111111100111", // D/7
-        "1111111111101000", // D/8
-        "1111111111101001", // D/9
-        "1111111111101010"}, // D/A
-        {"NULL", // E/0
-        "1111111111101011", // E/1
-        "1111111111101100", // E/2
-        "1111111111101101", // E/3
-        "1111111111101110", // E/4
-        "1111111111101111", // E/5
-        "1111111111110000", // E/6
-        "1111111111110001", // E/7
-        "1111111111110010", // E/8
-        "1111111111110011", // E/9
-        "1111111111110100"}, // E/A
-        {"11111111001", // F/0 (Zero-run length)
-        "1111111111110101", // F/1
-        "1111111111110110", // F/2
-        "1111111111110111", // F/3
-        "1111111111111000", // F/4
-        "1111111111111001", // F/5
-        "1111111111111010", // F/6
-        "1111111111111011", // F/7
-        "1111111111111100", // F/8
-        "1111111111111101", // F/9
-        "1111111111111110"} // F/A
-    };
+    /** Symbol frequencies of the scan data, indexed as [HT_DC/HT_AC][HT_Y/HT_CbCr] */
+    typedef std::array< std::array< SymbolFrequencies, 2 >, 2 > ScanStatistics;
     
-    //const std::array<std::array<std::string, 11>, 16> AC_CHROMA_HUFF_CODES = 
-    const std::vector<std::vector<std::string>> AC_CHROMA_HUFF_CODES = 
+    /**
+     * @brief A component (Y, Cb or Cr) of the image being encoded.
+     * 
+     * The samples are padded to a whole number of MCUs by repeating
+     * the last column & row of the image, so every block is complete.
+     */
+    struct EncoderComponent
     {
-        {"00", // 0/0 (EOB)
-        "01", // 0/1
-        "100", // 0/2
-        "1010", // 0/3
-        "11000", // 0/4
-        "11001", // 0/5
-        "111000", // 0/6
-        "1111000", // 0/7
-        "111110100", // 0/8
-        "1111110110", // 0/9
-        "111111110100"},  // 0/A
-        {"NULL", // 1/0
-        "1011", // 1/1
-        "111001", // 1/2
-        "11110110", // 1/3
-        "111110101", // 1/4
-        "11111110110", // 1/5
-        "111111110101", // 1/6
-        "1111111110001000", // 1/7
-        "1111111110001001", // 1/8
-        "1111111110001010", // 1/9
-        "1111111110001011"}, // 1/A
-        {"NULL",  // 2/0
-        "11010", // 2/1
-        "11110111", // 2/2
-        "1111110111", // 2/3
-        "111111110110", // 2/4
-        "111111111000010", // 2/5
-        "1111111110001100", // 2/6
-        "1111111110001101", // 2/7
-        "1111111110001110", // 2/8
-        "1111111110001111", // 2/9
-        "1111111110010000"}, // 2/A
-        {"NULL", // 3/0
-        "11011", // 3/1
-        "11111000", // 3/2
-        "1111111000", // 3/3
-        "111111110111", // 3/4
-        "1111111110010001", // 3/5
-        "1111111110010010", // 3/6
-        "1111111110010011", // 3/7
-        "1111111110010100", // 3/8
-        "1111111110010101", // 3/9
-        "1111111110010110"}, // 3/A
-        {"NULL", // 4/0
-        "111010", // 4/1
-        "111110110", // 4/2
-        "1111111110010111", // 4/3
-        "1111111110011000", // 4/4
-        "1111111110011001", // 4/5
-        "1111111110011010", // 4/6
-        "1111111110011011", // 4/7
-        "1111111110011100", // 4/8
-        "1111111110011101", // 4/9
-        "1111111110011110"}, // 4/A
-        {"NULL", // 5/0
-        "111011", // 5/1
-        "1111111001", // 5/2
-        "1111111110011111", // 5/3
-        "1111111110100000", // 5/4
-        "1111111110100001", // 5/5
-        "1111111110100010", // 5/6
-        "1111111110100011", // 5/7
-        "1111111110100100", // 5/8
-        "1111111110100101", // 5/9
-        "1111111110100110"}, // 5/A
-        {"NULL", // 6/0
-        "1111001", // 6/1
-        "11111110111", // 6/2
-        "1111111110100111", // 6/3
-        "1111111110101000", // 6/4
-        "1111111110101001", // 6/5
-        "1111111110101010", // 6/6
-        "1111111110101011", // 6/7
-        "1111111110101100", // 6/8
-        "1111111110101101", // 6/9
-        "1111111110101110"}, // 6/A
-        {"NULL", // 7/0
-        "1111010", // 7/1
-        "11111111000", // 7/2
-        "1111111110101111", // 7/3
-        "1111111110110000", // 7/4
-        "1111111110110001", // 7/5
-        "1111111110110010", // 7/6
-        "1111111110110011", // 7/7
-        "1111111110110100", // 7/8
-        "1111111110110101", // 7/9
-        "1111111110110110"}, // 7/A
-        {"NULL", // 8/0
-        "11111001", // 8/1
-        "1111111110110111", // 8/2
-        "1111111110111000", // 8/3
-        "1111111110111001", // 8/4
-        "1111111110111010", // 8/5
-        "1111111110111011", // 8/6
-        "1111111110111100", // 8/7
-        "1111111110111101", // 8/8
-        "1111111110111110", // 8/9
-        "1111111110111111"}, // 8/A
-        {"NULL", // 9/0
-        "111110111", // 9/1
-        "1111111111000000", // 9/2
-        "1111111111000001", // 9/3
-        "1111111111000010", // 9/4
-        "1111111111000011", // 9/5
-        "1111111111000100", // 9/6
-        "1111111111000101", // 9/7
-        "1111111111000110", // 9/8
-        "1111111111000111", // 9/9
-        "1111111111001000"}, // 9/A
-        {"NULL", // A/0
-        "111111000", // A/1
-        "1111111111001001", // A/2
-        "1111111111001010", // A/3
-        "1111111111001011", // A/4
-        "1111111111001100", // A/5
-        "1111111111001101", // A/6
-        "1111111111001110", // A/7
-        "1111111111001111", // A/8
-        "1111111111010000", // A/9
-        "1111111111010001"}, // A/A
-        {"NULL", // B/0
-        "111111001", // B/1
-        "1111111111010010", // B/2
-        "1111111111010011", // B/3
-        "1111111111010100", // B/4
-        "1111111111010101", // B/5
-        "1111111111010110", // B/6
-        "1111111111010111", // B/7
-        "1111111111011000", // B/8
-        "1111111111011001", // B/9
-        "1111111111011010"}, // B/A
-        {"NULL", // C/0
-        "111111010", // C/1
-        "1111111111011011", // C/2
-        "1111111111011100", // C/3
-        "1111111111011101", // C/4
-        "1111111111011110", // C/5
-        "1111111111011111", // C/6
-        "1111111111100000", // C/7
-        "1111111111100001", // C/8
-        "1111111111100010", // C/9
-        "1111111111100011"}, // C/A
-        {"NULL", // D/0
-        "11111111001", // D/1
-        "1111111111100100", // D/2
-        "1111111111100101", // D/3
-        "1111111111100110", // D/4
-        "1111111111100111", // D/5
-        "1111111111101000", // D/6
-        "1111111111101001", // D/7
-        "1111111111101010", // D/8
-        "1111111111101011", // D/9
-        "1111111111101100"}, // D/A
-        {"NULL", // E/0
-        "11111111100000", // E/1
-        "1111111111101101", // E/2
-        "1111111111101110", // E/3
-        "1111111111101111", // E/4
-        "1111111111110000", // E/5
-        "1111111111110001", // E/6
-        "1111111111110010", // E/7
-        "1111111111110011", // E/8
-        "1111111111110100", // E/9
-        "1111111111110101"}, // E/A
-        {"1111111010", // F/0 (Zero-run length)
-        "111111111000011", // F/1
-        "1111111111110110", // F/2
-        "1111111111110111", // F/3
-        "1111111111111000", // F/4
-        "1111111111111001", // F/5
-        "1111111111111010", // F/6
-        "1111111111111011", // F/7
-        "1111111111111100", // F/8
-        "1111111111111101", // F/9
-        "1111111111111110"} // F/A
+        int HSampFactor; // Horizontal sampling factor
+        int VSampFactor; // Vertical sampling factor
+        int width;       // Padded width, in samples
+        int height;      // Padded height, in samples
+        
+        // The samples, replaced in place by the quantized DCT coefficients of each 8x8 block (row major)
+        std::vector<float> data;
+        
+        // DCT coefficients, cached to re-quantize at different qualities
+        std::vector<float> DCTCoefficients;
     };
     
     // Encoder
     class JPEGEncoder
     {
         public:
-        
+            
             enum ResultCode
             {
                 SUCCESS ,
@@ -464,6 +97,24 @@ namespace kpeg
                 ENCODE_INCOMPLETE ,
                 ENCODE_DONE
             };
+            
+            enum ChromaSubsampling
+            {
+                SUBSAMPLING_444 , // Full resolution chroma
+                SUBSAMPLING_422 , // Half horizontal chroma resolution
+                SUBSAMPLING_420   // Half horizontal & vertical chroma resolution
+            };
+            
+            enum PixelFormat
+            {
+                PIXEL_FORMAT_RGB ,     // Interleaved 8-bit R, G, B
+                PIXEL_FORMAT_RGBA ,    // Interleaved 8-bit R, G, B, A (alpha is ignored)
+                PIXEL_FORMAT_BGR ,     // Interleaved 8-bit B, G, R
+                PIXEL_FORMAT_GRAY ,    // 8-bit gray
+                PIXEL_FORMAT_YUV444P , // Planar 8-bit Y, Cb, Cr, chroma at full resolution
+                PIXEL_FORMAT_YUV422P , // Planar 8-bit Y, Cb, Cr, chroma at half width
+                PIXEL_FORMAT_YUV420P   // Planar 8-bit Y, Cb, Cr, chroma at half width & height
+            };
         
         public:
             
@@ -475,23 +126,269 @@ namespace kpeg
             
             bool open( const std::string& filename );
             
-            bool encodeImage();
+            /**
+             * @brief Use the caller's interleaved pixels (RGB, RGBA, BGR or GRAY)
+             * as the image to encode.
+             * 
+             * `stride` is the number of bytes between the starts of two rows.
+             * The pixels are read in place by encodeImage(), so they must stay
+             * valid until it returns.
+             */
+            bool open( const UInt8* pixels,
+                       const int width,
+                       const int height,
+                       const std::size_t stride,
+                       const PixelFormat format );
+            
+            /**
+             * @brief Use the caller's planar Y, Cb & Cr samples (full range, as
+             * in JFIF) as the image to encode.
+             * 
+             * The samples are copied into the components as is, skipping the
+             * colorspace transformation, and the chroma subsampling follows the
+             * format. Chroma planes are rounded up to whole samples, e.g.,
+             * ( width + 1 ) / 2 wide for 4:2:2 & 4:2:0.
+             */
+            bool open( const UInt8* const planes[3],
+                       const std::size_t strides[3],
+                       const int width,
+                       const int height,
+                       const PixelFormat format );
+            
+            /**
+             * @brief Use quantized DCT coefficients, e.g., from JPEGDecoder::decodeCoefficients(),
+             * as the image to encode.
+             * 
+             * The coefficients are copied and encodeImage() only entropy codes
+             * them, with the quantization tables they come with, so quality
+             * and target size don't apply. The Y, Cb & Cr components must have
+             * full resolution chroma or chroma subsampled 2:1 horizontally
+             * and/or vertically (4:4:4, 4:2:2, 4:4:0 or 4:2:0), with both
+             * chroma components sharing a quantization table.
+             */
+            bool open( const JPEGCoefficients& coefficients );
+            
+            /**
+             * @brief Use quantized DCT coefficients, requantized with the
+             * tables of the given quality (or of the target size, if set).
+             * 
+             * The coefficients are dequantized with their own tables and go
+             * through the same quantization stage as a DCT'ed image, no
+             * IDCT/DCT is needed. The new tables are never finer than the
+             * source ones, which would only cost bits without adding detail.
+             */
+            bool open( const JPEGCoefficients& coefficients, const int quality );
+            
+            /**
+             * @brief Encode the opened image and write the JFIF file to `sink`.
+             */
+            bool encodeImage( OutputSink& sink );
+            
+            /**
+             * @brief Encode the opened image to a JFIF file, written through a buffered FileSink.
+             * 
+             * The file is only created once the image is encoded, a failed
+             * encode leaves no file behind & an existing one as is.
+             */
+            bool encodeImage( const std::string& filename );
+            
+            /**
+             * @brief Encode the opened image into a memory buffer, resized to fit the JFIF file.
+             */
+            bool encodeImage( std::vector<UInt8>& buffer );
+            
+            /**
+             * @brief Encode the opened image into a caller provided buffer of
+             * `capacity` bytes, `size` is set to the number of bytes written.
+             * 
+             * Fails without writing past the buffer if the file doesn't fit.
+             */
+            bool encodeImage( UInt8* buffer, const std::size_t capacity, std::size_t& size );
             
-            bool saveToJFIFFile();
+            /**
+             * @brief Set the number of MCUs in each restart interval.
+             * 
+             * A non-zero interval makes the encoder write a DRI segment and
+             * RSTn markers between the intervals. Each interval is entropy
+             * coded independently, on the encoder's worker threads. An
+             * interval of 0 (the default) disables restart markers.
+             */
+            void setRestartInterval( const UInt16 interval );
             
+            /**
+             * @brief Set the number of worker threads used for entropy coding
+             * the restart intervals, 0 uses the number of hardware threads.
+             */
+            void setThreadCount( const std::size_t count );
+            
+            /**
+             * @brief Use Huffman tables built for the image instead of the
+             * standard tables from Annex-K of the JPEG standard.
+             * 
+             * This adds a first pass over the quantized coefficients
+             * to gather the symbol statistics, but usually makes the
+             * scan data 5-10% smaller.
+             */
+            void setOptimizeHuffmanTables( const bool optimize );
+            
+            /**
+             * @brief Set the IJG style quality factor (1 - 100) used to scale
+             * the quantization tables. 50 (the default) uses the tables
+             * from Annex-K of the JPEG standard as is.
+             */
+            void setQuality( const int quality );
+            
+            /**
+             * @brief Set the maximum size of the JFIF file in bytes, 0 (the
+             * default) disables the size limit.
+             * 
+             * The encoder binary searches the highest quality whose estimated
+             * file size fits in the limit. The DCT is computed only once, each
+             * probe only re-quantizes the cached DCT coefficients and counts
+             * the entropy coded bits without writing them. The file of the
+             * selected quality is then entropy coded for real, stepping the
+             * quality down until it fits. encodeImage() fails if the file
+             * doesn't fit even at quality 1. The quality set by setQuality()
+             * is left as is.
+             */
+            void setTargetSize( const std::size_t bytes );
+            
+            /**
+             * @brief Set the chroma subsampling, 4:4:4 (the default) keeps
+             * the chroma components at full resolution.
+             * 
+             * With 4:2:2 & 4:2:0 each chroma sample is the average of the
+             * 2x1 or 2x2 pixels it covers, and each MCU holds 2 or 4 luma
+             * blocks followed by one block of each chroma component.
+             */
+            void setChromaSubsampling( const ChromaSubsampling subsampling );
+            
+            /**
+             * @brief Encode only the luminance, as a single component (grayscale)
+             * image. Gray input, PGM files & PIXEL_FORMAT_GRAY buffers, is always
+             * encoded as grayscale.
+             * 
+             * The single component has one block per MCU, there's no chroma to
+             * subsample, and only the luminance tables are written.
+             */
+            void setGrayscale( const bool grayscale );
+        
         private:
             
+            /**
+             * @brief Use the standard Huffman tables from Annex-K, replacing the
+             * optimized tables of a previous image.
+             */
+            void setStandardHuffmanTables();
+            
+            /**
+             * @brief Set the sampling factors & padded sizes of the components
+             * and the MCU layout of the image.
+             */
+            void setupComponents();
+            
+            /**
+             * @brief Convert the R-G-B pixels to Y-Cb-Cr samples, downsampling
+             * the chroma components in the same pass.
+             */
             void transformColorspace();
             
+            /**
+             * @brief Read row `y` of the input image as R, G, B float triplets.
+             */
+            void readPixelRow( const int y, std::vector<float>& RGB );
+            
+            /**
+             * @brief Copy planar Y-Cb-Cr input into the components, repeating
+             * the last column & row of each plane into the padding.
+             */
+            void copyPlanarComponents();
+            
             void levelShiftComponents();
             
             void computeDCT();
             
+            /**
+             * @brief Scale the Annex-K quantization tables for the given quality.
+             */
+            void generateQuantizationTables( const int quality );
+            
+            /**
+             * @brief Quantize the cached DCT coefficients with the current
+             * quantization tables.
+             */
             void quantize();
             
-            std::array<std::vector<int>, 3> generateRLE( const int y, const int x );
+            /**
+             * @brief Walk the quantized 8x8 block at block row `by` and block
+             * column `bx` of component `c` in zig-zag order, calling
+             * `emit( HT_DC/HT_AC, symbol, value )` for each Huffman symbol.
+             * 
+             * `DCPred` is the DC coefficient of the previous block of the
+             * component, updated to this block's. Nothing is stored in between,
+             * so the coding doesn't touch the heap.
+             */
+            template <typename Emit>
+            void forEachBlockSymbol( const int c, const int by, const int bx, int& DCPred, Emit&& emit );
+            
+            /**
+             * @brief Count the Huffman symbols of the MCUs in the range [firstMCU, lastMCU).
+             */
+            ScanStatistics countMCURangeSymbols( const int firstMCU, const int lastMCU );
+            
+            /**
+             * @brief Build the optimal Huffman tables from the symbol statistics
+             * of all the restart intervals.
+             */
+            void optimizeHuffmanTables();
+            
+            /**
+             * @brief Write the JFIF headers, the scan data and the end marker to `sink`.
+             */
+            bool writeJFIF( OutputSink& sink );
+            
+            void writeHuffmanTable( std::vector<UInt8>& out, const int type, const int id );
+            
+            void writeMarker( std::vector<UInt8>& out, const UInt8 marker );
+            
+            /**
+             * @brief Append a 16-bit word, in big endian byte order.
+             */
+            void writeWord( std::vector<UInt8>& out, const UInt16 word );
+            
+            /**
+             * @brief Estimate the size of the JFIF file for the currently
+             * quantized coefficients, without entropy coding them.
+             */
+            std::size_t estimateFileSize();
             
-            const std::string generateScanData();
+            /**
+             * @brief Find the highest quality for which the estimated file
+             * size is within the target size.
+             */
+            int searchQuality();
+            
+            /**
+             * @brief Encode the image in memory at `quality` & lower qualities
+             * until the JFIF file fits in the target size, then write it to `sink`.
+             */
+            bool encodeWithinTargetSize( OutputSink& sink, int quality );
+            
+            /**
+             * @brief The worker threads for entropy coding & counting the
+             * symbols of the restart intervals, started on first use.
+             */
+            ThreadPool& getThreadPool();
+            
+            /**
+             * @brief Entropy code the MCUs in the range [firstMCU, lastMCU).
+             * 
+             * The DC predictions start from 0, so a restart interval
+             * can be coded independently of all the others.
+             */
+            std::vector<UInt8> encodeMCURange( const int firstMCU, const int lastMCU );
+            
+            const std::vector<UInt8> generateScanData();
         
         private:
             
@@ -499,13 +396,66 @@ namespace kpeg
             
             std::ifstream m_imageFile;
             
-            std::ofstream m_outputJPEG;
-            
             Image m_image;
             
+            int m_width;
+            
+            int m_height;
+            
+            // Caller's pixel buffer(s), used instead of m_image when m_rawInput is set
+            bool m_rawInput;
+            
+            PixelFormat m_pixelFormat;
+            
+            const UInt8* m_planes[3];
+            
+            std::size_t m_strides[3];
+            
+            // The components were filled with quantized coefficients by open(), so
+            // encodeImage() skips straight to the entropy coding
+            bool m_coefficientInput;
+            
+            // With coefficient input, the coefficients are dequantized for the
+            // quantization stage, and the tables they came with are kept
+            bool m_requantize;
+            
+            std::vector<std::vector<UInt16>> m_sourceQTables;
+            
+            // Quantization tables for luminance (0) & chrominance (1), in row major order
             std::vector<std::vector<UInt16>> m_QTables;
             
-            std::vector<MCU> m_MCU;
+            // The Y, Cb & Cr components
+            std::array<EncoderComponent, 3> m_components;
+            
+            // Components being encoded, 1 (Y only) or 3
+            int m_componentCount;
+            
+            bool m_grayscale;
+            
+            ChromaSubsampling m_subsampling;
+            
+            // Number of MCU columns & rows, including partial MCUs at the right & bottom edges
+            int m_MCUCols;
+            
+            int m_MCURows;
+            
+            int m_quality;
+            
+            std::size_t m_targetSize;
+            
+            // Huffman tables & codes, indexed as [HT_DC/HT_AC][HT_Y/HT_CbCr]
+            HuffmanTable m_huffmanTables[2][2];
+            
+            HuffmanCodeTable m_huffmanCodes[2][2];
+            
+            bool m_optimizeHuffmanTables;
+            
+            UInt16 m_restartInterval;
+            
+            std::size_t m_threadCount;
+            
+            // Shared by all the passes over the restart intervals of an image
+            std::unique_ptr<ThreadPool> m_threadPool;
     };
 }
 
@@ -1,9 +1,175 @@
+/**
+ * @file HuffmanTables.hpp
+ * @author Koushtav Chakrabarty (koushtav@fleptic.eu)
+ * @brief Huffman table specifications and code tables used for entropy coding
+ *
+ * The standard tables are the typical Huffman tables from Annex-K of the
+ * JPEG standard (ITU-T.81, page 149), stored in the same form as they
+ * appear in a DHT segment: 16 code length counts followed by the symbols.
+ */
+
 #ifndef HUFFMAN_TABLES_HPP
 #define HUFFMAN_TABLES_HPP
 
+#include <array>
+
+#include "Types.hpp"
+
 namespace kpeg
 {
+    // Luminance, DC coefficient differences (Table K.3)
+    const std::array<UInt8, 16> DC_LUMA_HUFF_BITS =
+    {
+        { 0x00, 0x01, 0x05, 0x01, 0x01, 0x01, 0x01, 0x01,
+          0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }
+    };
+
+    const std::array<UInt8, 12> DC_LUMA_HUFF_VALS =
+    {
+        { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+          0x08, 0x09, 0x0A, 0x0B }
+    };
+
+    // Chrominance, DC coefficient differences (Table K.4)
+    const std::array<UInt8, 16> DC_CHROMA_HUFF_BITS =
+    {
+        { 0x00, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+          0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00 }
+    };
+
+    const std::array<UInt8, 12> DC_CHROMA_HUFF_VALS =
+    {
+        { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+          0x08, 0x09, 0x0A, 0x0B }
+    };
+
+    // Luminance, AC coefficients (Table K.5)
+    const std::array<UInt8, 16> AC_LUMA_HUFF_BITS =
+    {
+        { 0x00, 0x02, 0x01, 0x03, 0x03, 0x02, 0x04, 0x03,
+          0x05, 0x05, 0x04, 0x04, 0x00, 0x00, 0x01, 0x7D }
+    };
+
+    const std::array<UInt8, 162> AC_LUMA_HUFF_VALS =
+    {
+        { 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+          0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+          0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08,
+          0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+          0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16,
+          0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+          0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+          0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+          0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+          0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+          0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+          0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+          0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+          0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+          0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6,
+          0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+          0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4,
+          0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+          0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA,
+          0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+          0xF9, 0xFA }
+    };
+
+    // Chrominance, AC coefficients (Table K.6)
+    const std::array<UInt8, 16> AC_CHROMA_HUFF_BITS =
+    {
+        { 0x00, 0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04,
+          0x07, 0x05, 0x04, 0x04, 0x00, 0x01, 0x02, 0x77 }
+    };
+
+    const std::array<UInt8, 162> AC_CHROMA_HUFF_VALS =
+    {
+        { 0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+          0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+          0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+          0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+          0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34,
+          0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+          0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38,
+          0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+          0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+          0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+          0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+          0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+          0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96,
+          0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+          0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4,
+          0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+          0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2,
+          0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+          0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9,
+          0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+          0xF9, 0xFA }
+    };
+
+    /**
+     * @brief A single Huffman code, right aligned in `code`.
+     */
+    struct HuffmanCode
+    {
+        UInt16 code;   // The code bits (e.g., 0b1010 for "1010")
+        UInt8  length; // Number of bits in the code, 0 if the symbol has no code
+    };
+
+    /** Huffman codes indexed by symbol (e.g., 0x00 - 0xFF for AC run/size pairs) */
+    typedef std::array<HuffmanCode, 256> HuffmanCodeTable;
+    
+    /** Number of occurrences of each symbol in the scan data */
+    typedef std::array<UInt32, 256> SymbolFrequencies;
+
+    /** Codes of up to this many bits are decoded with a single table lookup */
+    const int HUFFMAN_LOOKUP_BITS = 9;
+    
+    /**
+     * @brief Tables for decoding the codes of a Huffman table.
+     */
+    struct HuffmanDecodeTable
+    {
+        // Indexed by the next HUFFMAN_LOOKUP_BITS bits: ( code length << 8 ) | symbol,
+        // or 0 if the code is longer
+        std::array<UInt16, 1 << HUFFMAN_LOOKUP_BITS> lookup;
+        
+        // Indexed by code length: the largest code of that length, -1 if
+        // there's none, and the offset from a code to its symbol index
+        std::array<Int32, 17> maxCode;
+        std::array<Int32, 17> valOffset;
+        
+        // The symbols, in order of code length
+        std::array<UInt8, 256> symbols;
+    };
+    
+    /**
+     * @brief Build a Huffman table (as found in a DHT segment) from the
+     * code length counts and the symbol list.
+     */
+    HuffmanTable makeHuffmanTable( const UInt8* bits, const UInt8* vals );
+
+    /**
+     * @brief Generate the canonical Huffman codes for a Huffman table.
+     *
+     * See Annex-C of the JPEG standard (ITU-T.81, page 50).
+     */
+    HuffmanCodeTable generateHuffmanCodes( const HuffmanTable& htable );
+    
+    /**
+     * @brief Generate the decoding tables for a Huffman table.
+     *
+     * See Annex-F.2.2.3 of the JPEG standard (ITU-T.81, page 107).
+     */
+    HuffmanDecodeTable generateHuffmanDecodeTable( const HuffmanTable& htable );
     
+    /**
+     * @brief Build the optimal Huffman table for the given symbol frequencies,
+     * with no code longer than 16 bits and no code made up of all 1-bits.
+     *
+     * See Annex-K.2 of the JPEG standard (ITU-T.81, page 147).
+     */
+    HuffmanTable generateOptimalHuffmanTable( const SymbolFrequencies& frequencies );
 }
 
 #endif // HUFFMAN_TABLES_HPP
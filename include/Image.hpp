@@ -15,10 +15,24 @@
 #include <memory>
 
 #include "Types.hpp"
-#include "MCU.hpp"
 
 namespace kpeg
 {    
+    /** Binary formats for dumping the decoded pixels */
+    enum class RawImageFormat
+    {
+        PPM , // RGB pixmap (P6)
+        PGM , // Graymap of the luminance (P5)
+        PAM   // RGBA arbitrary map (P7), with an opaque alpha channel
+    };
+    
+    /** The pixels held by an Image */
+    enum class PixelType
+    {
+        RGB8 , // 8-bit R, G, B pixels
+        GRAY8  // 8-bit gray samples, one byte per pixel
+    };
+    
     ///// Image structure /////
     
     class Image
@@ -27,19 +41,45 @@ namespace kpeg
             
             Image();
             
-            // Used by decoder
-            void createImageFromMCUs( const std::vector<MCU>& MCUVector );
+            /**
+             * @brief Allocate the pixels of the type & dimensions set, used by
+             * the decoder to write the pixels to as the scan is decoded.
+             */
+            void createPixels();
             
             PixelPtr getPixelPtr();
             
+            /**
+             * @brief Row `y` of the GRAY8 pixels, allocated by createPixels().
+             */
+            UInt8* getGrayRow( const std::size_t y );
+            
+            /**
+             * @brief Set the type of the pixels allocated by createPixels().
+             */
+            void setPixelType( const PixelType type );
+            
+            /**
+             * @brief The type of the pixels, GRAY8 for a PGM file read by
+             * readRawData(), whose samples are also replicated to the three
+             * components of its float pixels.
+             */
+            PixelType getPixelType() const;
+            
             FPixelPtr getFlPixelPtr();
             
             const unsigned getWidth() const;
             
             const unsigned getHeight() const;
             
+            /**
+             * @brief Dump the pixels to a PPM, PGM or PAM file, picked by the
+             * extension of `filename` (PPM if it isn't .pgm or .pam).
+             */
             const bool dumpRawData( const std::string& filename );
             
+            const bool dumpRawData( const std::string& filename, const RawImageFormat format );
+            
             const bool readRawData( const std::string& filename );
             
             void setImageFilename( const std::string& filename );
@@ -49,11 +89,13 @@ namespace kpeg
             void setComment( const std::string& comment );
             
             void setDimensions( const std::size_t width, const std::size_t height );
-            
+        
         private:
             
             std::string  m_filename;
+            PixelType    m_pixelType;
             PixelPtr     m_pixelPtr;
+            std::vector<UInt8> m_grayPixels;
             FPixelPtr    m_flPixelPtr;
             std::string  m_JPEGversion;
             std::string  m_comment;
@@ -66,6 +108,12 @@ namespace kpeg
     const Int16 bitStringtoValue( const std::string& bitStr );
     
     const Int16 getValueCategory( const Int16 value );
+    
+    /**
+     * @brief The `category` bits written after the Huffman code of a value,
+     * i.e., the value itself if positive, else its one's complement.
+     */
+    const UInt16 getValueBits( const Int16 value, const Int16 category );
 }
 
 #endif // IMAGE_HPP
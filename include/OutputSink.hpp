@@ -0,0 +1,139 @@
+/**
+ * @file OutputSink.hpp
+ * @author Koushtav Chakrabarty (koushtav@fleptic.eu)
+ * @brief Destinations for the bytes of an encoded JFIF file
+ *
+ * The encoder writes the JFIF file in a few large chunks (the headers,
+ * the scan data and the end marker) to an OutputSink, which decides
+ * where the bytes end up: a growable memory buffer, a fixed buffer
+ * provided by the caller, a file, or a user callback.
+ */
+
+#ifndef OUTPUT_SINK_HPP
+#define OUTPUT_SINK_HPP
+
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Types.hpp"
+
+namespace kpeg
+{
+    /**
+     * @brief Interface for the destination of the encoded bytes.
+     */
+    class OutputSink
+    {
+        public:
+            
+            virtual ~OutputSink();
+            
+            /**
+             * @brief Write `size` bytes, returns false if they couldn't all be written.
+             */
+            virtual bool write( const UInt8* data, const std::size_t size ) = 0;
+            
+            /**
+             * @brief Push out any buffered bytes, called once the whole file is written.
+             */
+            virtual bool flush();
+    };
+    
+    /**
+     * @brief Appends the bytes to a growable buffer in memory.
+     */
+    class MemorySink : public OutputSink
+    {
+        public:
+            
+            bool write( const UInt8* data, const std::size_t size ) override;
+            
+            const std::vector<UInt8>& getBuffer() const;
+            
+            /**
+             * @brief Move the buffer out of the sink, leaving it empty.
+             */
+            std::vector<UInt8> releaseBuffer();
+        
+        private:
+            
+            std::vector<UInt8> m_buffer;
+    };
+    
+    /**
+     * @brief Writes the bytes to a fixed size buffer owned by the caller.
+     *
+     * A write that doesn't fit in the remaining space fails and writes
+     * nothing, so the encoder stops instead of overrunning the buffer.
+     */
+    class FixedBufferSink : public OutputSink
+    {
+        public:
+            
+            FixedBufferSink( UInt8* buffer, const std::size_t capacity );
+            
+            bool write( const UInt8* data, const std::size_t size ) override;
+            
+            /**
+             * @brief Number of bytes written so far.
+             */
+            std::size_t getSize() const;
+        
+        private:
+            
+            UInt8* m_buffer;
+            
+            std::size_t m_capacity;
+            
+            std::size_t m_size;
+    };
+    
+    /**
+     * @brief Writes the bytes to a binary file, through an internal buffer.
+     */
+    class FileSink : public OutputSink
+    {
+        public:
+            
+            explicit FileSink( const std::string& filename, const std::size_t bufferSize = 64 * 1024 );
+            
+            ~FileSink();
+            
+            bool isOpen() const;
+            
+            bool write( const UInt8* data, const std::size_t size ) override;
+            
+            bool flush() override;
+        
+        private:
+            
+            std::ofstream m_file;
+            
+            std::vector<UInt8> m_buffer;
+            
+            std::size_t m_bufferSize;
+    };
+    
+    /**
+     * @brief Passes the bytes to a user provided function, e.g., to
+     * stream them out over a socket.
+     */
+    class CallbackSink : public OutputSink
+    {
+        public:
+            
+            typedef std::function<bool( const UInt8*, std::size_t )> WriteCallback;
+            
+            explicit CallbackSink( WriteCallback callback );
+            
+            bool write( const UInt8* data, const std::size_t size ) override;
+        
+        private:
+            
+            WriteCallback m_callback;
+    };
+}
+
+#endif // OUTPUT_SINK_HPP
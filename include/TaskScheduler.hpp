@@ -0,0 +1,149 @@
+/**
+ * @file TaskScheduler.hpp
+ * @author Koushtav Chakrabarty (koushtav@fleptic.eu)
+ * @brief A work-stealing scheduler for fine grained tasks
+ */
+
+#ifndef TASK_SCHEDULER_HPP
+#define TASK_SCHEDULER_HPP
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+
+namespace kpeg
+{
+    /**
+     * @brief A set of tasks to wait for together.
+     */
+    class TaskGroup
+    {
+        public:
+            
+            TaskGroup();
+            
+            TaskGroup( const TaskGroup& ) = delete;
+            
+            TaskGroup& operator=( const TaskGroup& ) = delete;
+            
+            bool isDone() const;
+        
+        private:
+            
+            friend class TaskScheduler;
+            
+            // Tasks submitted & not finished yet
+            std::atomic<std::size_t> m_pending;
+            
+            // Tasks still in a deque, waiting threads only run these
+            std::atomic<std::size_t> m_queued;
+            
+            // Tasks finished so far, for waiting on the next one
+            std::size_t m_finished;
+            
+            // Signalled when a task of the group is queued or finishes
+            std::mutex m_mutex;
+            
+            std::condition_variable m_condition;
+    };
+    
+    /**
+     * @brief TaskScheduler runs tasks on a fixed number of workers, each with
+     * its own deque of tasks.
+     *
+     * A worker takes the tasks it submitted itself from the back of its deque,
+     * most recent first, while it's still got their data in cache. A worker
+     * with nothing to do steals the oldest task from the front of another
+     * worker's deque, so the load balances out however uneven the tasks are.
+     * Threads waiting for a group of tasks run the group's own tasks in the
+     * meantime, so tasks can submit & wait for tasks of their own, & sleep
+     * once there are none left to run. A waiting thread never picks up an
+     * unrelated task, which could keep it busy long after its group is done.
+     */
+    class TaskScheduler
+    {
+        public:
+            
+            /**
+             * @brief Create `threadCount` workers. A count of 0 uses the
+             * number of hardware threads.
+             */
+            explicit TaskScheduler( const std::size_t threadCount = 0 );
+            
+            ~TaskScheduler();
+            
+            TaskScheduler( const TaskScheduler& ) = delete;
+            
+            TaskScheduler& operator=( const TaskScheduler& ) = delete;
+            
+            /**
+             * @brief Queue `task` as part of `group`, on the deque of the calling
+             * worker, or spread over the workers for other threads.
+             */
+            void submit( TaskGroup& group, std::function<void()> task );
+            
+            /**
+             * @brief Run the tasks of `group` until all of them are done.
+             */
+            void wait( TaskGroup& group );
+            
+            /**
+             * @brief Run a queued task of `group`, or sleep until one of its
+             * tasks finishes if none is queued. Returns at once if all of
+             * them are done.
+             */
+            void waitForTask( TaskGroup& group );
+            
+            std::size_t getThreadCount() const;
+        
+        private:
+            
+            struct Task
+            {
+                std::function<void()> function;
+                TaskGroup* group;
+            };
+            
+            struct WorkerQueue
+            {
+                std::mutex mutex;
+                std::deque<Task> tasks;
+            };
+            
+            void workerLoop( const std::size_t index );
+            
+            /**
+             * @brief Take a task, from the back of deque `index` first if it's
+             * the calling worker's own, then from the front of the others.
+             * Only the tasks of `group` are taken, unless it's null.
+             */
+            bool takeTask( const std::size_t index, Task& task, const TaskGroup* group );
+            
+            void runTask( Task& task );
+        
+        private:
+            
+            std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+            
+            std::vector<std::thread> m_workers;
+            
+            // Deque for the next task submitted from outside the workers
+            std::atomic<std::size_t> m_nextQueue;
+            
+            // Tasks queued over all the deques, idle workers sleep while it's 0
+            std::atomic<std::size_t> m_queuedCount;
+            
+            std::mutex m_sleepMutex;
+            
+            std::condition_variable m_sleepCondition;
+            
+            bool m_stop;
+    };
+}
+
+#endif // TASK_SCHEDULER_HPP
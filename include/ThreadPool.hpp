@@ -0,0 +1,81 @@
+/**
+ * @file ThreadPool.hpp
+ * @author Koushtav Chakrabarty (koushtav@fleptic.eu)
+ * @brief A fixed size pool of worker threads
+ */
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+namespace kpeg
+{
+    /**
+     * @brief ThreadPool runs submitted tasks on a fixed number of worker threads.
+     * 
+     * Tasks are picked up in FIFO order. The result (or exception) of a task
+     * is handed back through the std::future returned by `submit()`. The
+     * destructor waits for all the queued tasks to finish.
+     */
+    class ThreadPool
+    {
+        public:
+            
+            /**
+             * @brief Create a pool of `threadCount` workers. A count of 0
+             * uses the number of hardware threads.
+             */
+            explicit ThreadPool( const std::size_t threadCount = 0 );
+            
+            ~ThreadPool();
+            
+            ThreadPool( const ThreadPool& ) = delete;
+            
+            ThreadPool& operator=( const ThreadPool& ) = delete;
+            
+            template <typename Task>
+            auto submit( Task&& task ) -> std::future<decltype( task() )>
+            {
+                typedef decltype( task() ) Result;
+                
+                auto packaged = std::make_shared<std::packaged_task<Result()>>( std::forward<Task>( task ) );
+                std::future<Result> result = packaged->get_future();
+                
+                {
+                    std::lock_guard<std::mutex> lock( m_mutex );
+                    m_tasks.emplace( [packaged]() { (*packaged)(); } );
+                }
+                
+                m_condition.notify_one();
+                return result;
+            }
+            
+            std::size_t getThreadCount() const;
+            
+        private:
+            
+            void workerLoop();
+            
+        private:
+            
+            std::vector<std::thread> m_workers;
+            
+            std::queue<std::function<void()>> m_tasks;
+            
+            std::mutex m_mutex;
+            
+            std::condition_variable m_condition;
+            
+            bool m_stop;
+    };
+}
+
+#endif // THREAD_POOL_HPP
@@ -0,0 +1,76 @@
+/**
+ * @file Transcoder.hpp
+ * @author Koushtav Chakrabarty (koushtav@fleptic.eu)
+ * @brief Transformations of JPEG images in the DCT coefficient domain
+ *
+ * The transformations work on the quantized coefficients straight out of
+ * the decoder's entropy stage and the result is entropy coded again by the
+ * encoder, without any IDCT/DCT in between.
+ */
+
+#ifndef TRANSCODER_HPP
+#define TRANSCODER_HPP
+
+#include <string>
+
+#include "Coefficients.hpp"
+
+namespace kpeg
+{
+    enum LosslessTransform
+    {
+        TRANSFORM_FLIP_HORIZONTAL , // Mirror left to right
+        TRANSFORM_FLIP_VERTICAL ,   // Mirror top to bottom
+        TRANSFORM_TRANSPOSE ,       // Mirror along the main diagonal
+        TRANSFORM_TRANSVERSE ,      // Mirror along the anti-diagonal
+        TRANSFORM_ROTATE_90 ,       // Rotate 90 degrees clockwise
+        TRANSFORM_ROTATE_180 ,
+        TRANSFORM_ROTATE_270
+    };
+    
+    /**
+     * @brief Get the transformation from its name, one of "flip-h", "flip-v",
+     * "transpose", "transverse", "rot90", "rot180" or "rot270".
+     */
+    bool getLosslessTransform( const std::string& name, LosslessTransform& transform );
+    
+    /**
+     * @brief Rotate, flip or transpose the image without any loss.
+     *
+     * The block grid is permuted and the coefficients inside each block are
+     * transposed and/or negated (the odd frequencies change sign when a block
+     * is mirrored). A partial MCU can't be moved away from the right/bottom
+     * edge, so an edge that ends up mirrored is trimmed to whole MCUs, like
+     * 'jpegtran -trim'.
+     */
+    bool transformCoefficients( const JPEGCoefficients& source,
+                                const LosslessTransform transform,
+                                JPEGCoefficients& result );
+    
+    /**
+     * @brief Crop the image without any loss.
+     * 
+     * The top left corner ( x, y ) must be on an MCU boundary, the size is
+     * clipped to the image. Only the blocks in the rectangle are copied, the
+     * DC coefficients are absolute here so the encoder computes the new DC
+     * differences, starting from the first block of the cropped image.
+     */
+    bool cropCoefficients( const JPEGCoefficients& source,
+                           const int x,
+                           const int y,
+                           const int width,
+                           const int height,
+                           JPEGCoefficients& result );
+    
+    /**
+     * @brief Halve the width & height of the image in the DCT domain.
+     * 
+     * Each 2x2 group of blocks of a component is merged into one block: the
+     * 4x4 low frequencies of the four blocks are dequantized and combined
+     * with a precomputed operator, equivalent to an 8x8 DCT of the four 4x4
+     * inverse DCTs. The result is quantized again with the source tables.
+     */
+    bool downscaleCoefficients( const JPEGCoefficients& source, JPEGCoefficients& result );
+}
+
+#endif // TRANSCODER_HPP
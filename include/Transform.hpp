@@ -1,21 +1,240 @@
+/**
+ * @file Transform.hpp
+ * @author Koushtav Chakrabarty (koushtav@fleptic.eu)
+ * @brief Zig-zag, DCT & colour conversion tables, generated at compile time
+ */
+
 #ifndef TRANSFORM_HPP
 #define TRANSFORM_HPP
 
 #include <utility>
+#include <cstddef>
+
+#include "Types.hpp"
 
 namespace kpeg
 {
     /**
-     * @brief Convert a zig-zag order index to its corresponding matrix indices.
+     * @brief A read only array usable in constant expressions. (std::array
+     * can't be written to in a C++14 constexpr function.)
+     */
+    template <typename T, std::size_t N>
+    struct ConstTable
+    {
+        T values[N];
+        
+        constexpr const T& operator[]( const std::size_t index ) const
+        {
+            return values[index];
+        }
+    };
+    
+    ///// Zig-zag order /////
+    
+    /**
+     * @brief Walk the 8x8 block along the anti-diagonals, alternating up-right
+     * & down-left, giving the natural (row major) index of each zig-zag index.
      */
-    const std::pair<const int, const int> zzOrderToMatIndices( const int zzindex );
+    constexpr ConstTable<int, 64> makeNaturalOrder()
+    {
+        ConstTable<int, 64> order{};
+        int row = 0, column = 0;
+        
+        for ( int i = 0; i < 64; ++i )
+        {
+            order.values[i] = row * 8 + column;
+            
+            if ( ( row + column ) % 2 == 0 )
+            {
+                if ( column == 7 )
+                    row++;
+                else if ( row == 0 )
+                    column++;
+                else
+                {
+                    row--;
+                    column++;
+                }
+            }
+            else
+            {
+                if ( row == 7 )
+                    column++;
+                else if ( column == 0 )
+                    row++;
+                else
+                {
+                    row++;
+                    column--;
+                }
+            }
+        }
+        
+        return order;
+    }
+    
+    constexpr ConstTable<int, 64> makeZigZagOrder()
+    {
+        ConstTable<int, 64> order{};
+        ConstTable<int, 64> natural = makeNaturalOrder();
+        
+        for ( int i = 0; i < 64; ++i )
+            order.values[ natural[i] ] = i;
+        
+        return order;
+    }
     
+    /** Natural order index of each zig-zag index */
+    constexpr ConstTable<int, 64> NATURAL_ORDER = makeNaturalOrder();
+    
+    /** Zig-zag index of each natural order index */
+    constexpr ConstTable<int, 64> ZIGZAG_ORDER = makeZigZagOrder();
+    
+    /**
+     * @brief Convert a zig-zag order index to its corresponding matrix indices.
+     */
+    constexpr std::pair<int, int> zzOrderToMatIndices( const int zzindex )
+    {
+        return { NATURAL_ORDER[zzindex] / 8, NATURAL_ORDER[zzindex] % 8 };
+    }
     
     /**
      * @brief Convert matrix indices to its corresponding zig-zag order index.
      */
+    constexpr int matIndicesToZZOrder( const int row, const int column )
+    {
+        return ZIGZAG_ORDER[row * 8 + column];
+    }
+    
+    ///// DCT /////
+    
+    /**
+     * @brief cos( nπ/16 ), from the values for n = 0..8 & the symmetries of
+     * the cosine (std::cos isn't constexpr).
+     */
+    constexpr double cosineSixteenths( const int n )
+    {
+        constexpr double COSINES[9] =
+        {
+            1.0,
+            0.98078528040323044913,
+            0.92387953251128675613,
+            0.83146961230254523708,
+            0.70710678118654752440,
+            0.55557023301960222474,
+            0.38268343236508977173,
+            0.19509032201612826785,
+            0.0
+        };
+        
+        int m = n % 32;
+        
+        if ( m > 16 )
+            m = 32 - m;
+        
+        return m > 8 ? -COSINES[16 - m] : COSINES[m];
+    }
+    
+    constexpr ConstTable<float, 64> makeDCTCosines()
+    {
+        ConstTable<float, 64> cosines{};
+        
+        for ( int x = 0; x < 8; ++x )
+            for ( int u = 0; u < 8; ++u )
+                cosines.values[x * 8 + u] = cosineSixteenths( ( 2 * x + 1 ) * u );
+        
+        return cosines;
+    }
+    
+    constexpr ConstTable<float, 64> makeDCTScales()
+    {
+        ConstTable<float, 64> scales{};
+        
+        for ( int i = 0; i < 64; ++i )
+        {
+            double Cu = i / 8 == 0 ? cosineSixteenths( 4 ) : 1.0; // 1/sqrt(2)
+            double Cv = i % 8 == 0 ? cosineSixteenths( 4 ) : 1.0;
+            
+            scales.values[i] = 0.25 * Cu * Cv;
+        }
+        
+        return scales;
+    }
     
-    const int matIndicesToZZOrder( const int row, const int column );
+    /** DCT_COSINES[x * 8 + u] = cos( ( 2x + 1 )uπ/16 ), the cosine of frequency u at sample x */
+    constexpr ConstTable<float, 64> DCT_COSINES = makeDCTCosines();
+    
+    /** The DCT's scale factor 1/4 C(u) C(v) of each natural order coefficient */
+    constexpr ConstTable<float, 64> DCT_SCALES = makeDCTScales();
+    
+    ///// Y-Cb-Cr to R-G-B /////
+    
+    // The colour conversion factors are fixed point, with 16 fractional bits
+    constexpr int COLOR_FRACTION_BITS = 16;
+    constexpr int COLOR_ONE_HALF = 1 << ( COLOR_FRACTION_BITS - 1 );
+    
+    constexpr int toFixedPoint( const double value )
+    {
+        return value < 0 ? -toFixedPoint( -value ) : int( value * ( 1 << COLOR_FRACTION_BITS ) + 0.5 );
+    }
+    
+    /**
+     * @brief The term `factor` x ( Cb or Cr - 128 ) of a colour, for each chroma
+     * value. `round` adds one half, & the term is shifted down to an integer
+     * unless it's kept `fixedPoint` to be summed with another first.
+     */
+    constexpr ConstTable<int, 256> makeChromaTable( const double factor, const bool round, const bool fixedPoint )
+    {
+        ConstTable<int, 256> table{};
+        
+        for ( int i = 0; i < 256; ++i )
+        {
+            int term = toFixedPoint( factor ) * ( i - 128 ) + ( round ? COLOR_ONE_HALF : 0 );
+            table.values[i] = fixedPoint ? term : term >> COLOR_FRACTION_BITS;
+        }
+        
+        return table;
+    }
+    
+    /** R = Y + CR_TO_R[Cr] */
+    constexpr ConstTable<int, 256> CR_TO_R = makeChromaTable( 1.402, true, false );
+    
+    /** B = Y + CB_TO_B[Cb] */
+    constexpr ConstTable<int, 256> CB_TO_B = makeChromaTable( 1.772, true, false );
+    
+    /** G = Y + ( ( CB_TO_G[Cb] + CR_TO_G[Cr] ) >> COLOR_FRACTION_BITS ) */
+    constexpr ConstTable<int, 256> CB_TO_G = makeChromaTable( -0.344136, true, true );
+    constexpr ConstTable<int, 256> CR_TO_G = makeChromaTable( -0.714136, false, true );
+    
+    ///// Range limiting /////
+    
+    /**
+     * @brief Clamp table for the samples -384..639, indexed by the sample's
+     * low 10 bits, so the negative samples wrap around to the top half.
+     */
+    constexpr ConstTable<UInt8, 1024> makeRangeLimit()
+    {
+        ConstTable<UInt8, 1024> table{};
+        
+        for ( int i = 0; i < 1024; ++i )
+        {
+            int sample = i < 640 ? i : i - 1024;
+            table.values[i] = sample < 0 ? 0 : sample > 255 ? 255 : sample;
+        }
+        
+        return table;
+    }
+    
+    constexpr ConstTable<UInt8, 1024> RANGE_LIMIT = makeRangeLimit();
+    
+    /**
+     * @brief Clamp a sample to 0..255, without branching. Samples outside of
+     * -384..639 only come from corrupt data, & wrap around.
+     */
+    constexpr UInt8 clampSample( const int sample )
+    {
+        return RANGE_LIMIT[sample & 1023];
+    }
 }
 
 #endif // TRANSFORM_HPP
@@ -1,9 +1,16 @@
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
 
 #include "Utility.hpp"
 #include "Logger.hpp"
 #include "Decoder.hpp"
 #include "Encoder.hpp"
+#include "Transcoder.hpp"
+#include "Batch.hpp"
 
 void printHelp()
 {
@@ -13,30 +20,261 @@ void printHelp()
     std::cout << "Help\n" << std::endl;
     std::cout << "<filename.jpg>                  : Decompress a JPEG image to a PPM image" << std::endl;
     std::cout << "<filename.ppm> <filename.jpg>   : Convert input PNG file to JPEG" << std::endl;
+    std::cout << "-g <filename.jpg>               : Decompress the luminance of a JPEG image to a PGM image" << std::endl;
+    std::cout << "-g <filename.ppm> <filename.jpg> : Convert input PPM/PGM file to a grayscale JPEG" << std::endl;
+    std::cout << "-i <filename.jpg>               : Print the image information from the JPEG headers" << std::endl;
+    std::cout << "-v <filename.jpg>               : Check the integrity of a JPEG image without decoding it" << std::endl;
+    std::cout << "-t <transform> <in.jpg> <out.jpg> : Losslessly flip-h, flip-v, transpose, transverse, rot90, rot180 or rot270 a JPEG image" << std::endl;
+    std::cout << "-c <WxH+X+Y> <in.jpg> <out.jpg> : Losslessly crop a JPEG image, X & Y must be on MCU boundaries" << std::endl;
+    std::cout << "-s <in.jpg> <out.jpg>           : Halve the size of a JPEG image in the DCT domain" << std::endl;
+    std::cout << "-q <quality> <in.jpg> <out.jpg> : Requantize a JPEG image to a lower quality (1 - 100) without the IDCT/DCT" << std::endl;
+    std::cout << "--batch [-j <threads>] [-f] <files/directories...> : Decode the JPEG & encode the PPM/PGM files on a pool of threads, -f overwrites existing outputs" << std::endl;
     std::cout << "-h                              : Print this help message and exit" << std::endl;
 }
 
-void decodeJPEG(const std::string& filename)
+bool decodeJPEG(const std::string& filename, const bool grayscale = false)
 {
     if ( !kpeg::isValidFilename( filename ) )
     {
         LOG(kpeg::Logger::Level::ERROR) << "Invalid input file name passed." << std::endl;
-        return;
+        return false;
     }
     
     kpeg::JPEGDecoder decoder;
-    decoder.open( filename );
-    if ( decoder.decodeImageFile() == kpeg::JPEGDecoder::ResultCode::DECODE_DONE )
+    decoder.setGrayscaleOutput( grayscale );
+    
+    return decoder.open( filename ) &&
+           decoder.decodeImageFile() == kpeg::JPEGDecoder::ResultCode::DECODE_DONE &&
+           decoder.dumpRawData();
+}
+
+bool printImageInfo(const std::string& filename)
+{
+    kpeg::JPEGInfo info;
+    
+    if ( !kpeg::JPEGDecoder::probe( filename, info ) )
+    {
+        LOG(kpeg::Logger::Level::ERROR) << "Unable to read the JPEG headers of: \'" + filename + "\'" << std::endl;
+        return false;
+    }
+    
+    std::cout << "Dimensions       : " << info.width << "x" << info.height << std::endl;
+    std::cout << "Precision        : " << info.precision << "-bit" << std::endl;
+    std::cout << "Frame type       : " << ( info.isProgressive ? "Progressive" : info.frameMarker == 0xC0 ? "Baseline" : "Sequential" ) << std::endl;
+    std::cout << "Components       : " << info.components.size() << std::endl;
+    
+    for ( auto&& component : info.components )
+    {
+        std::cout << "  Component " << component.ID << "    : " << component.HSampFactor << "x" << component.VSampFactor
+                  << ", quantization table #" << component.QTableNumber << std::endl;
+    }
+    
+    std::cout << "Restart interval : " << info.restartInterval << std::endl;
+    std::cout << "Comment          : " << ( info.hasComment ? "Yes" : "No" ) << std::endl;
+    std::cout << "APPn segments    :";
+    
+    for ( int n = 0; n < 16; ++n )
+    {
+        if ( info.APPSegments & ( 1 << n ) )
+            std::cout << " APP" << n;
+    }
+    
+    std::cout << std::endl;
+    return true;
+}
+
+bool validateJPEG(const std::string& filename)
+{
+    kpeg::JPEGDecoder decoder;
+    
+    if ( !decoder.open( filename ) )
+        return false;
+    
+    auto status = decoder.validate();
+    
+    std::cout << filename << ": " << ( status == kpeg::JPEGDecoder::ResultCode::SUCCESS ? "Valid" :
+                                       status == kpeg::JPEGDecoder::ResultCode::TERMINATE ? "Not supported" : "Invalid" ) << std::endl;
+    
+    return status == kpeg::JPEGDecoder::ResultCode::SUCCESS;
+}
+
+bool transformJPEG(const std::string& name, const std::string& filenameIn, const std::string& filenameOut)
+{
+    kpeg::LosslessTransform transform;
+    
+    if ( !kpeg::getLosslessTransform( name, transform ) )
+    {
+        LOG(kpeg::Logger::Level::ERROR) << "Unknown transformation: \'" + name + "\'" << std::endl;
+        return false;
+    }
+    
+    kpeg::JPEGDecoder decoder;
+    kpeg::JPEGCoefficients coefficients, transformed;
+    
+    if ( !decoder.open( filenameIn ) || decoder.decodeCoefficients( coefficients ) != kpeg::JPEGDecoder::ResultCode::SUCCESS )
+        return false;
+    
+    kpeg::JPEGEncoder encoder;
+    
+    if ( !kpeg::transformCoefficients( coefficients, transform, transformed ) ||
+         !encoder.open( transformed ) || !encoder.encodeImage( filenameOut ) )
     {
-        decoder.dumpRawData();
+        LOG(kpeg::Logger::Level::ERROR) << "An error ocurred while transforming." << std::endl;
+        return false;
     }
+    
+    return true;
+}
+
+bool cropJPEG(const std::string& geometry, const std::string& filenameIn, const std::string& filenameOut)
+{
+    int width = 0, height = 0, x = 0, y = 0;
+    
+    if ( std::sscanf( geometry.c_str(), "%dx%d+%d+%d", &width, &height, &x, &y ) != 4 )
+    {
+        LOG(kpeg::Logger::Level::ERROR) << "Invalid crop geometry: \'" + geometry + "\', expected WxH+X+Y" << std::endl;
+        return false;
+    }
+    
+    kpeg::JPEGDecoder decoder;
+    kpeg::JPEGCoefficients coefficients, cropped;
+    
+    if ( !decoder.open( filenameIn ) || decoder.decodeCoefficients( coefficients ) != kpeg::JPEGDecoder::ResultCode::SUCCESS )
+        return false;
+    
+    kpeg::JPEGEncoder encoder;
+    
+    if ( !kpeg::cropCoefficients( coefficients, x, y, width, height, cropped ) ||
+         !encoder.open( cropped ) || !encoder.encodeImage( filenameOut ) )
+    {
+        LOG(kpeg::Logger::Level::ERROR) << "An error ocurred while cropping." << std::endl;
+        return false;
+    }
+    
+    return true;
+}
+
+bool downscaleJPEG(const std::string& filenameIn, const std::string& filenameOut)
+{
+    kpeg::JPEGDecoder decoder;
+    kpeg::JPEGCoefficients coefficients, downscaled;
+    
+    if ( !decoder.open( filenameIn ) || decoder.decodeCoefficients( coefficients ) != kpeg::JPEGDecoder::ResultCode::SUCCESS )
+        return false;
+    
+    kpeg::JPEGEncoder encoder;
+    
+    if ( !kpeg::downscaleCoefficients( coefficients, downscaled ) ||
+         !encoder.open( downscaled ) || !encoder.encodeImage( filenameOut ) )
+    {
+        LOG(kpeg::Logger::Level::ERROR) << "An error ocurred while downscaling." << std::endl;
+        return false;
+    }
+    
+    return true;
 }
 
-void encodeImage(const std::string& filenameIn, const std::string& filenameOut)
+bool requantizeJPEG(const std::string& quality, const std::string& filenameIn, const std::string& filenameOut)
+{
+    char* end = nullptr;
+    long value = std::strtol( quality.c_str(), &end, 10 );
+    
+    if ( quality.empty() || *end != '\0' || value < 1 || value > 100 )
+    {
+        LOG(kpeg::Logger::Level::ERROR) << "Invalid quality: \'" + quality + "\', expected 1 - 100" << std::endl;
+        return false;
+    }
+    
+    kpeg::JPEGDecoder decoder;
+    kpeg::JPEGCoefficients coefficients;
+    
+    if ( !decoder.open( filenameIn ) || decoder.decodeCoefficients( coefficients ) != kpeg::JPEGDecoder::ResultCode::SUCCESS )
+        return false;
+    
+    kpeg::JPEGEncoder encoder;
+    
+    if ( !encoder.open( coefficients, int( value ) ) || !encoder.encodeImage( filenameOut ) )
+    {
+        LOG(kpeg::Logger::Level::ERROR) << "An error ocurred while requantizing." << std::endl;
+        return false;
+    }
+    
+    return true;
+}
+
+int runBatch(int argc, char** argv)
+{
+    std::size_t threadCount = 0;
+    bool overwrite = false;
+    int first = 2;
+    
+    if ( argc > first + 1 && (std::string)argv[first] == "-j" )
+    {
+        char* end = nullptr;
+        long value = std::strtol( argv[3], &end, 10 );
+        
+        if ( *argv[3] == '\0' || *end != '\0' || value < 0 )
+        {
+            LOG(kpeg::Logger::Level::ERROR) << "Invalid thread count: \'" << argv[3] << "\', expected 0 (all the hardware threads) or more" << std::endl;
+            return EXIT_FAILURE;
+        }
+        
+        threadCount = std::size_t( value );
+        first += 2;
+    }
+    
+    if ( argc > first && (std::string)argv[first] == "-f" )
+    {
+        overwrite = true;
+        first++;
+    }
+    
+    std::vector<kpeg::BatchJob> jobs;
+    
+    if ( first >= argc )
+    {
+        LOG(kpeg::Logger::Level::ERROR) << "No files or directories to process." << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    if ( !kpeg::BatchProcessor::collectJobs( std::vector<std::string>( argv + first, argv + argc ), jobs, overwrite ) )
+        return EXIT_FAILURE;
+    
+    // Only the errors are logged, the workers would interleave everything else
+    kpeg::Logger::get().setLevel( kpeg::Logger::Level::ERROR );
+    
+    kpeg::BatchProcessor processor( threadCount );
+    
+    auto start = std::chrono::steady_clock::now();
+    auto results = processor.run( jobs );
+    double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    
+    std::size_t failed = 0, inputBytes = 0;
+    
+    for ( auto&& result : results )
+    {
+        std::cout << ( result.success ? "[OK]     " : "[FAILED] " ) << result.input << " -> " << result.output << " : "
+                  << result.inputBytes << " -> " << result.outputBytes << " bytes, "
+                  << std::fixed << std::setprecision( 1 ) << result.seconds * 1000 << " ms, "
+                  << std::setprecision( 2 ) << result.inputBytes / ( result.seconds * 1e6 ) << " MB/s" << std::endl;
+        
+        failed += !result.success;
+        inputBytes += result.inputBytes;
+    }
+    
+    std::cout << results.size() << " files (" << failed << " failed) on " << processor.getThreadCount() << " threads in "
+              << std::fixed << std::setprecision( 3 ) << seconds << " s: "
+              << std::setprecision( 2 ) << results.size() / seconds << " files/s, "
+              << inputBytes / ( seconds * 1e6 ) << " MB/s" << std::endl;
+    
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+bool encodeImage(const std::string& filenameIn, const std::string& filenameOut, const bool grayscale = false)
 {
 //     std::cout << "Enoder not complete: This is a work in progress" << std::endl;
 //     return;
-    
+
 //     if ( !kpeg::isValidFilename( filenameIn ) )
 //     {
 //         LOG(kpeg::Logger::Level::ERROR) << "Invalid input file name passed." << std::endl;
@@ -44,11 +282,14 @@ void encodeImage(const std::string& filenameIn, const std::string& filenameOut)
 //     }
     
     kpeg::JPEGEncoder encoder;
-    encoder.open( filenameIn );
-    if ( !encoder.encodeImage() )
+    encoder.setGrayscale( grayscale );
+    if ( !encoder.open( filenameIn ) || !encoder.encodeImage( filenameOut ) )
     {
         LOG(kpeg::Logger::Level::ERROR) << "An error ocurred while encoding." << std::endl;
+        return false;
     }
+    
+    return true;
 }
 
 int handleInput(int argc, char** argv)
@@ -59,20 +300,54 @@ int handleInput(int argc, char** argv)
         return EXIT_FAILURE;
     }
     
-    if ( argc == 2 && (std::string)argv[1] == "-h" )
+    if ( (std::string)argv[1] == "--batch" )
+    {
+        return runBatch( argc, argv );
+    }
+    else if ( argc == 2 && (std::string)argv[1] == "-h" )
     {
         printHelp();
         return EXIT_SUCCESS;
     }
     else if ( argc == 2 )
     {
-        decodeJPEG( argv[1] );
-        return EXIT_SUCCESS;
+        return decodeJPEG( argv[1] ) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    else if ( argc == 3 && (std::string)argv[1] == "-i" )
+    {
+        return printImageInfo( argv[2] ) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    else if ( argc == 3 && (std::string)argv[1] == "-v" )
+    {
+        return validateJPEG( argv[2] ) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    else if ( argc == 3 && (std::string)argv[1] == "-g" )
+    {
+        return decodeJPEG( argv[2], true ) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    else if ( argc == 4 && (std::string)argv[1] == "-g" )
+    {
+        return encodeImage( argv[2], argv[3], true ) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    else if ( argc == 5 && (std::string)argv[1] == "-c" )
+    {
+        return cropJPEG( argv[2], argv[3], argv[4] ) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    else if ( argc == 5 && (std::string)argv[1] == "-q" )
+    {
+        return requantizeJPEG( argv[2], argv[3], argv[4] ) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    else if ( argc == 5 && (std::string)argv[1] == "-t" )
+    {
+        return transformJPEG( argv[2], argv[3], argv[4] ) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    else if ( argc == 4 && (std::string)argv[1] == "-s" )
+    {
+        return downscaleJPEG( argv[2], argv[3] ) ? EXIT_SUCCESS : EXIT_FAILURE;
     }
     else if ( argc == 3 )
     {
-        encodeImage( argv[1], argv[2] );
-        return EXIT_SUCCESS;
+        return encodeImage( argv[1], argv[2] ) ? EXIT_SUCCESS : EXIT_FAILURE;
     }
     
     return EXIT_FAILURE;
@@ -106,9 +381,9 @@ int main( int argc, char** argv )
         kpeg::Logger::get().setLevel( kpeg::Logger::Level::DEBUG );
         
         LOG(kpeg::Logger::Level::INFO) << "KPEG - Simple JPEG Encoder & Decoder" << std::endl;
-
+        
         ////////////////////////////
-         
+
 //         kpeg::JPEGDecoder decoder;
 //         decoder.open("../misc/images/sample.jpg");
 //         //decoder.printDetectedSegmentNames();
@@ -116,11 +391,11 @@ int main( int argc, char** argv )
 //         {
 //             decoder.dumpRawData();
 //         }
-         
+        
         //huffmanTreeTest();
         //transformTest();
         //colorTest();
-        
+
 //         kpeg::JPEGEncoder encoder;
 //         encoder.open( "scene.ppm" );
 //         if ( !encoder.encodeImage() )
@@ -189,7 +464,7 @@ void huffmanTreeTest()
     
     htable[15].first = 1;
     htable[15].second = { 0x56 };
-        
+    
     kpeg::HuffmanTree htree( htable );
     kpeg::inOrder( htree.getTree() );
     
@@ -321,7 +596,7 @@ std::array<std::array<float, 8>, 8> IDCTTest( std::array<std::array<float, 8>, 8
         for ( unsigned u = 0; u < 8; ++u )
             icoeffs[v][u] += 128;
     }
-
+    
     return icoeffs;
 }
 
@@ -338,7 +613,7 @@ void colorTest()
     R = std::max( 0, std::min( R, 255 ) );
     G = std::max( 0, std::min( G, 255 ) );
     B = std::max( 0, std::min( B, 255 ) );
-            
+    
     std::cout << "(" << R
               << "," << G << ","
               << B << ") "
@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <map>
+#include <set>
+#include <sys/stat.h>
+
+#include "Batch.hpp"
+#include "Logger.hpp"
+
+namespace kpeg
+{
+    static std::string getExtension( const std::string& filename )
+    {
+        std::size_t dotPos = filename.rfind( '.' );
+        
+        if ( dotPos == std::string::npos || filename.find( '/', dotPos ) != std::string::npos )
+            return "";
+        
+        std::string extension = filename.substr( dotPos + 1 );
+        std::transform( extension.begin(), extension.end(), extension.begin(), ::tolower );
+        return extension;
+    }
+    
+    static bool makeJob( const std::string& filename, BatchJob& job )
+    {
+        std::string extension = getExtension( filename );
+        std::string basename = filename.substr( 0, filename.size() - extension.size() );
+        
+        if ( extension == "jpg" || extension == "jpeg" )
+            job = { filename, basename + "ppm", true };
+        else if ( extension == "ppm" || extension == "pgm" )
+            job = { filename, basename + "jpg", false };
+        else
+            return false;
+        
+        return true;
+    }
+    
+    static std::size_t getFileSize( const std::string& filename )
+    {
+        struct stat info;
+        return stat( filename.c_str(), &info ) == 0 ? info.st_size : 0;
+    }
+    
+    BatchProcessor::BatchProcessor( const std::size_t threadCount ) :
+     m_scheduler{threadCount}
+    {
+        LOG(Logger::Level::INFO) << "Created batch processor with " << m_scheduler.getThreadCount() << " workers" << std::endl;
+    }
+    
+    bool BatchProcessor::collectJobs( const std::vector<std::string>& paths, std::vector<BatchJob>& jobs, const bool overwrite )
+    {
+        std::vector<BatchJob> candidates;
+        
+        for ( auto&& path : paths )
+        {
+            struct stat info;
+            
+            if ( stat( path.c_str(), &info ) != 0 )
+            {
+                LOG(Logger::Level::ERROR) << "Unable to read: \'" + path + "\'" << std::endl;
+                return false;
+            }
+            
+            if ( !S_ISDIR( info.st_mode ) )
+            {
+                BatchJob job;
+                
+                if ( !makeJob( path, job ) )
+                {
+                    LOG(Logger::Level::ERROR) << "Not a JPEG or PPM/PGM file: \'" + path + "\'" << std::endl;
+                    return false;
+                }
+                
+                candidates.push_back( job );
+                continue;
+            }
+            
+            DIR* directory = opendir( path.c_str() );
+            
+            if ( directory == nullptr )
+            {
+                LOG(Logger::Level::ERROR) << "Unable to open directory: \'" + path + "\'" << std::endl;
+                return false;
+            }
+            
+            std::vector<std::string> filenames;
+            
+            while ( dirent* entry = readdir( directory ) )
+            {
+                std::string filename = path + ( path.back() == '/' ? "" : "/" ) + entry->d_name;
+                
+                if ( stat( filename.c_str(), &info ) == 0 && S_ISREG( info.st_mode ) )
+                    filenames.push_back( filename );
+            }
+            
+            closedir( directory );
+            
+            // Directory entries come in no particular order
+            std::sort( filenames.begin(), filenames.end() );
+            
+            for ( auto&& filename : filenames )
+            {
+                BatchJob job;
+                
+                if ( makeJob( filename, job ) )
+                    candidates.push_back( job );
+            }
+        }
+        
+        // The jobs run concurrently, so no job may write a file another one
+        // reads or writes
+        std::set<std::string> inputs;
+        std::map<std::string, int> outputCounts;
+        
+        for ( auto&& job : candidates )
+        {
+            inputs.insert( job.input );
+            outputCounts[job.output]++;
+        }
+        
+        for ( auto&& job : candidates )
+        {
+            if ( inputs.count( job.output ) > 0 || outputCounts[job.output] > 1 )
+            {
+                LOG(Logger::Level::INFO) << "Skipping \'" + job.input + "\', another file is read from or written to \'" + job.output + "\'" << std::endl;
+                continue;
+            }
+            
+            struct stat info;
+            
+            if ( !overwrite && stat( job.output.c_str(), &info ) == 0 )
+            {
+                LOG(Logger::Level::INFO) << "Skipping \'" + job.input + "\', \'" + job.output + "\' already exists" << std::endl;
+                continue;
+            }
+            
+            jobs.push_back( job );
+        }
+        
+        return true;
+    }
+    
+    std::vector<BatchResult> BatchProcessor::run( const std::vector<BatchJob>& jobs )
+    {
+        std::vector<BatchResult> results( jobs.size() );
+        TaskGroup group;
+        
+        for ( std::size_t i = 0; i < jobs.size(); ++i )
+            m_scheduler.submit( group, [this, &jobs, &results, i]() { results[i] = runJob( jobs[i] ); } );
+        
+        m_scheduler.wait( group );
+        
+        return results;
+    }
+    
+    std::size_t BatchProcessor::getThreadCount() const
+    {
+        return m_scheduler.getThreadCount();
+    }
+    
+    BatchResult BatchProcessor::runJob( const BatchJob& job )
+    {
+        auto start = std::chrono::steady_clock::now();
+        
+        BatchResult result{ job.input, job.output, false, getFileSize( job.input ), 0, 0.0 };
+        WorkerState* state = acquireState();
+        
+        if ( job.decode )
+        {
+            if ( state->decoder.open( job.input ) )
+            {
+                result.success = state->decoder.decodeImageFile() == JPEGDecoder::ResultCode::DECODE_DONE &&
+                                 state->decoder.dumpRawData( job.output );
+                state->decoder.close();
+            }
+        }
+        else
+        {
+            result.success = state->encoder.open( job.input ) && state->encoder.encodeImage( job.output );
+        }
+        
+        releaseState( state );
+        
+        if ( result.success )
+            result.outputBytes = getFileSize( job.output );
+        
+        result.seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+        
+        return result;
+    }
+    
+    BatchProcessor::WorkerState* BatchProcessor::acquireState()
+    {
+        std::lock_guard<std::mutex> lock( m_stateMutex );
+        
+        if ( m_freeStates.empty() )
+        {
+            m_states.emplace_back( new WorkerState );
+            
+            // The rows of all the images in flight are spread over the
+            // workers, the encoder's restart intervals aren't
+            m_states.back()->decoder.setScheduler( &m_scheduler );
+            m_states.back()->encoder.setThreadCount( 1 );
+            
+            return m_states.back().get();
+        }
+        
+        WorkerState* state = m_freeStates.back();
+        m_freeStates.pop_back();
+        return state;
+    }
+    
+    void BatchProcessor::releaseState( WorkerState* state )
+    {
+        std::lock_guard<std::mutex> lock( m_stateMutex );
+        m_freeStates.push_back( state );
+    }
+}
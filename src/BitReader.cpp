@@ -0,0 +1,145 @@
+#include "BitReader.hpp"
+#include "Markers.hpp"
+
+namespace kpeg
+{
+    BitReader::BitReader() :
+     m_data{nullptr} ,
+     m_size{0} ,
+     m_position{0} ,
+     m_buffer{0} ,
+     m_bitCount{0} ,
+     m_paddingBits{0} ,
+     m_markerFound{false}
+    {
+    }
+    
+    BitReader::BitReader( const UInt8* data, const std::size_t size ) :
+     m_data{data} ,
+     m_size{size} ,
+     m_position{0} ,
+     m_buffer{0} ,
+     m_bitCount{0} ,
+     m_paddingBits{0} ,
+     m_markerFound{false}
+    {
+    }
+    
+    UInt32 BitReader::peekBits( const int length )
+    {
+        if ( m_bitCount < length )
+            fill();
+        
+        return m_buffer >> ( 32 - length );
+    }
+    
+    void BitReader::skipBits( const int length )
+    {
+        m_buffer <<= length;
+        m_bitCount -= length;
+    }
+    
+    UInt32 BitReader::readBits( const int length )
+    {
+        if ( length == 0 )
+            return 0;
+        
+        UInt32 bits = peekBits( length );
+        skipBits( length );
+        return bits;
+    }
+    
+    int BitReader::readValue( const int size )
+    {
+        if ( size == 0 )
+            return 0;
+        
+        int value = readBits( size );
+        
+        // Values with a leading 0-bit are negative
+        return value < ( 1 << ( size - 1 ) ) ? value - ( 1 << size ) + 1 : value;
+    }
+    
+    int BitReader::readSymbol( const HuffmanDecodeTable& table )
+    {
+        // Short codes take a single lookup
+        UInt16 entry = table.lookup[ peekBits( HUFFMAN_LOOKUP_BITS ) ];
+        
+        if ( entry != 0 )
+        {
+            skipBits( entry >> 8 );
+            return entry & 0xFF;
+        }
+        
+        // Longer codes are found by their length (ITU-T.81, F.2.2.3)
+        UInt32 bits = peekBits( 16 );
+        
+        for ( int length = HUFFMAN_LOOKUP_BITS + 1; length <= 16; ++length )
+        {
+            Int32 code = bits >> ( 16 - length );
+            
+            if ( code <= table.maxCode[length] )
+            {
+                skipBits( length );
+                return table.symbols[ code + table.valOffset[length] ];
+            }
+        }
+        
+        return -1;
+    }
+    
+    bool BitReader::isAtMarker()
+    {
+        fill();
+        
+        return m_bitCount - m_paddingBits < 8;
+    }
+    
+    bool BitReader::readRestartMarker( const int number )
+    {
+        if ( !isAtMarker() || !m_markerFound || m_size - m_position < 2 ||
+             m_data[m_position + 1] != JFIF_RST0 + number )
+            return false;
+        
+        m_position += 2;
+        m_buffer = 0;
+        m_bitCount = 0;
+        m_paddingBits = 0;
+        m_markerFound = false;
+        return true;
+    }
+    
+    bool BitReader::isPastEnd() const
+    {
+        return m_bitCount < m_paddingBits;
+    }
+    
+    void BitReader::fill()
+    {
+        while ( m_bitCount <= 24 )
+        {
+            UInt8 byte = 0;
+            
+            if ( !m_markerFound && m_position < m_size )
+            {
+                byte = m_data[m_position];
+                
+                if ( byte != JFIF_BYTE_FF )
+                    m_position++;
+                else if ( m_position + 1 < m_size && m_data[m_position + 1] == JFIF_BYTE_0 )
+                    m_position += 2;
+                else
+                {
+                    m_markerFound = true;
+                    byte = 0;
+                    m_paddingBits += 8;
+                }
+            }
+            else
+                m_paddingBits += 8;
+            
+            m_buffer |= UInt32( byte ) << ( 24 - m_bitCount );
+            m_bitCount += 8;
+        }
+    }
+}
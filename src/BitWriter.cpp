@@ -0,0 +1,48 @@
+#include "BitWriter.hpp"
+#include "Markers.hpp"
+
+namespace kpeg
+{
+    BitWriter::BitWriter() :
+     m_buffer{0} ,
+     m_bitCount{0}
+    {
+    }
+    
+    void BitWriter::writeBits( const UInt32 bits, const int length )
+    {
+        if ( length <= 0 )
+            return;
+        
+        m_buffer = ( m_buffer << length ) | ( bits & ( ( 1u << length ) - 1 ) );
+        m_bitCount += length;
+        
+        while ( m_bitCount >= 8 )
+        {
+            m_bitCount -= 8;
+            emitByte( UInt8( m_buffer >> m_bitCount ) );
+        }
+        
+        // Drop the bits that have been written out
+        m_buffer &= ( 1u << m_bitCount ) - 1;
+    }
+    
+    void BitWriter::flush()
+    {
+        if ( m_bitCount > 0 )
+            writeBits( 0x7F, 8 - m_bitCount );
+    }
+    
+    const std::vector<UInt8>& BitWriter::getBytes() const
+    {
+        return m_bytes;
+    }
+    
+    void BitWriter::emitByte( const UInt8 byte )
+    {
+        m_bytes.push_back( byte );
+        
+        if ( byte == JFIF_BYTE_FF )
+            m_bytes.push_back( (UInt8)JFIF_BYTE_0 );
+    }
+}
@@ -0,0 +1,44 @@
+#include <cstring>
+#include <cstdint>
+
+#include "BlockArena.hpp"
+
+namespace kpeg
+{
+    BlockArena::BlockArena() :
+     m_storage{nullptr} ,
+     m_blocks{nullptr} ,
+     m_capacity{0}
+    {
+    }
+    
+    void BlockArena::reserve( const std::size_t count )
+    {
+        if ( count <= m_capacity )
+            return;
+        
+        // Room for the blocks from the first aligned address on
+        m_storage.reset( new UInt8[ count * 64 * sizeof( Int16 ) + ALIGNMENT - 1 ] );
+        
+        std::uintptr_t address = reinterpret_cast<std::uintptr_t>( m_storage.get() );
+        address = ( address + ALIGNMENT - 1 ) & ~std::uintptr_t( ALIGNMENT - 1 );
+        
+        m_blocks = reinterpret_cast<Int16*>( address );
+        m_capacity = count;
+    }
+    
+    void BlockArena::clear( const std::size_t index, const std::size_t count )
+    {
+        std::memset( getBlock( index ), 0, count * 64 * sizeof( Int16 ) );
+    }
+    
+    Int16* BlockArena::getBlock( const std::size_t index )
+    {
+        return m_blocks + index * 64;
+    }
+    
+    std::size_t BlockArena::getCapacity() const
+    {
+        return m_capacity;
+    }
+}
@@ -0,0 +1,86 @@
+#include <cstring>
+
+#include "ByteReader.hpp"
+#include "Markers.hpp"
+
+namespace kpeg
+{
+    ByteReader::ByteReader() :
+     m_data{nullptr} ,
+     m_size{0} ,
+     m_position{0}
+    {
+    }
+    
+    ByteReader::ByteReader( const UInt8* data, const std::size_t size ) :
+     m_data{data} ,
+     m_size{size} ,
+     m_position{0}
+    {
+    }
+    
+    bool ByteReader::readUInt8( UInt8& value )
+    {
+        if ( m_position >= m_size )
+            return false;
+        
+        value = m_data[m_position++];
+        return true;
+    }
+    
+    bool ByteReader::readUInt16( UInt16& value )
+    {
+        if ( m_size - m_position < 2 )
+            return false;
+        
+        value = ( UInt16( m_data[m_position] ) << 8 ) | m_data[m_position + 1];
+        m_position += 2;
+        return true;
+    }
+    
+    bool ByteReader::skip( const std::size_t count )
+    {
+        if ( m_size - m_position < count )
+            return false;
+        
+        m_position += count;
+        return true;
+    }
+    
+    bool ByteReader::subReader( const std::size_t count, ByteReader& reader )
+    {
+        if ( m_size - m_position < count )
+            return false;
+        
+        reader = ByteReader( m_data + m_position, count );
+        m_position += count;
+        return true;
+    }
+    
+    void ByteReader::seekToNextFF()
+    {
+        const void* next = std::memchr( m_data + m_position, JFIF_BYTE_FF, m_size - m_position );
+        
+        m_position = next == nullptr ? m_size : static_cast<const UInt8*>( next ) - m_data;
+    }
+    
+    std::size_t ByteReader::getPosition() const
+    {
+        return m_position;
+    }
+    
+    std::size_t ByteReader::getRemaining() const
+    {
+        return m_size - m_position;
+    }
+    
+    bool ByteReader::isAtEnd() const
+    {
+        return m_position >= m_size;
+    }
+    
+    const UInt8* ByteReader::getCurrent() const
+    {
+        return m_data + m_position;
+    }
+}
@@ -1,4 +1,5 @@
-#include <arpa/inet.h> // htons
+#include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <sstream>
 
@@ -6,16 +7,63 @@
 #include "Logger.hpp"
 #include "Markers.hpp"
 #include "Utility.hpp"
+#include "BoundedQueue.hpp"
 
 namespace kpeg
 {
-    JPEGDecoder::JPEGDecoder() //:
+    // Fewest blocks reconstructed by a task, fewer aren't worth the scheduling
+    static const int MIN_TASK_BLOCKS = 128;
+    
+    // Sample planes of the rows being reconstructed, per thread & kept between images
+    static thread_local std::vector<Int16> t_samples;
+    
+    // A Huffman table is defined once a DHT segment gave it some codes
+    static bool isHuffmanTableDefined( const HuffmanTable& htable )
+    {
+        for ( auto&& codeLength : htable )
+        {
+            if ( codeLength.first > 0 )
+                return true;
+        }
+        
+        return false;
+    }
+    
+    JPEGDecoder::JPEGDecoder() :
+     m_QTables{} ,
+     m_IDCTTables{} ,
+     m_MCUCols{0} ,
+     m_MCURows{0} ,
+     m_maxHSampFactor{1} ,
+     m_maxVSampFactor{1} ,
+     m_decodeMCURow{nullptr} ,
+     m_reconstructMCURow{nullptr} ,
+     m_scanOffset{0} ,
+     m_scanSize{0} ,
+     m_restartInterval{0} ,
+     m_threadCount{0} ,
+     m_grayscaleOutput{false} ,
+     m_scheduler{nullptr}
      //m_huffTableCount(0)
     {
         LOG(Logger::Level::INFO) << "Created \'JPEGDecoder object\'." << std::endl;
     }
-            
-    JPEGDecoder::JPEGDecoder( const std::string& filename ) //:
+    
+    JPEGDecoder::JPEGDecoder( const std::string& filename ) :
+     m_QTables{} ,
+     m_IDCTTables{} ,
+     m_MCUCols{0} ,
+     m_MCURows{0} ,
+     m_maxHSampFactor{1} ,
+     m_maxVSampFactor{1} ,
+     m_decodeMCURow{nullptr} ,
+     m_reconstructMCURow{nullptr} ,
+     m_scanOffset{0} ,
+     m_scanSize{0} ,
+     m_restartInterval{0} ,
+     m_threadCount{0} ,
+     m_grayscaleOutput{false} ,
+     m_scheduler{nullptr}
      //m_huffTableCount(0)
     {
         LOG(Logger::Level::INFO) << "Created \'JPEGDecoder object\'." << std::endl;
@@ -29,14 +77,31 @@ namespace kpeg
     
     bool JPEGDecoder::open( const std::string& filename )
     {
-        m_imageFile.open( filename, std::ios::in | std::ios::binary );
+        std::ifstream imageFile( filename, std::ios::in | std::ios::binary | std::ios::ate );
         
-        if ( !m_imageFile.is_open() || !m_imageFile.good() )
+        if ( !imageFile.is_open() || !imageFile.good() )
         {
             LOG(Logger::Level::ERROR) << "Unable to open image: \'" + filename + "\'" << std::endl;
             return false;
         }
         
+        // The whole file is read at once, the segments are parsed in memory
+        std::streamsize size = imageFile.tellg();
+        imageFile.seekg( 0, std::ios::beg );
+        
+        m_fileData.resize( size > 0 ? size : 0 );
+        imageFile.read( reinterpret_cast<char *>( m_fileData.data() ), m_fileData.size() );
+        
+        if ( imageFile.gcount() != size )
+        {
+            LOG(Logger::Level::ERROR) << "Unable to read image: \'" + filename + "\'" << std::endl;
+            m_fileData.clear();
+            return false;
+        }
+        
+        m_reader = ByteReader( m_fileData.data(), m_fileData.size() );
+        clearImageState();
+        
         LOG(Logger::Level::INFO) << "Opened JPEG image: \'" + filename + "\'" << std::endl;
         
         m_filename = filename;
@@ -44,33 +109,257 @@ namespace kpeg
         return true;
     }
     
+    bool JPEGDecoder::open( const UInt8* data, const std::size_t size )
+    {
+        if ( data == nullptr || size == 0 )
+        {
+            LOG(Logger::Level::ERROR) << "Unable to open image, empty buffer" << std::endl;
+            return false;
+        }
+        
+        m_fileData.assign( data, data + size );
+        m_reader = ByteReader( m_fileData.data(), m_fileData.size() );
+        m_filename = "";
+        clearImageState();
+        
+        LOG(Logger::Level::INFO) << "Opened JPEG image from memory, " << size << " bytes" << std::endl;
+        
+        return true;
+    }
+    
     void JPEGDecoder::close()
     {
-        m_imageFile.close();
+        m_fileData.clear();
+        m_reader = ByteReader();
+        clearImageState();
         LOG(Logger::Level::INFO) << "Closed image file: \'" + m_filename + "\'" << std::endl;
     }
     
+    void JPEGDecoder::clearImageState()
+    {
+        m_QTables = {};
+        m_IDCTTables = {};
+        
+        for ( auto type : { HT_DC, HT_AC } )
+        {
+            for ( auto id : { HT_Y, HT_CbCr } )
+            {
+                m_huffmanTable[type][id] = HuffmanTable{};
+                m_huffmanDecodeTables[type][id] = HuffmanDecodeTable{};
+            }
+        }
+        
+        mDHTsScanned.clear();
+        m_components.clear();
+        m_scanOffset = m_scanSize = 0;
+        m_restartInterval = 0;
+    }
+    
+    void JPEGDecoder::setThreadCount( const std::size_t count )
+    {
+        m_threadCount = count;
+    }
+    
+    void JPEGDecoder::setGrayscaleOutput( const bool grayscale )
+    {
+        m_grayscaleOutput = grayscale;
+    }
+    
+    void JPEGDecoder::setScheduler( TaskScheduler* scheduler )
+    {
+        m_scheduler = scheduler;
+    }
+    
+    bool JPEGDecoder::probe( const std::string& filename, JPEGInfo& info )
+    {
+        std::ifstream imageFile( filename, std::ios::in | std::ios::binary );
+        
+        if ( !imageFile.is_open() )
+        {
+            LOG(Logger::Level::ERROR) << "Unable to open image: \'" + filename + "\'" << std::endl;
+            return false;
+        }
+        
+        // The headers of most files fit in the first read, if not
+        // the buffer is grown and the headers are parsed again
+        std::vector<UInt8> buffer;
+        std::size_t chunkSize = 64 * 1024;
+        
+        while ( true )
+        {
+            std::size_t size = buffer.size();
+            buffer.resize( size + chunkSize );
+            imageFile.read( reinterpret_cast<char *>( buffer.data() + size ), chunkSize );
+            buffer.resize( size + imageFile.gcount() );
+            
+            ByteReader reader( buffer.data(), buffer.size() );
+            ResultCode code = parseHeaderInfo( reader, info );
+            
+            if ( code != ResultCode::DECODE_INCOMPLETE )
+                return code == ResultCode::SUCCESS;
+            
+            if ( !imageFile )
+                break;
+            
+            chunkSize *= 2;
+        }
+        
+        // Truncated file, the information is complete if the frame header was read
+        return !info.components.empty();
+    }
+    
+    bool JPEGDecoder::probe( const UInt8* data, const std::size_t size, JPEGInfo& info )
+    {
+        ByteReader reader( data, size );
+        ResultCode code = parseHeaderInfo( reader, info );
+        
+        return code == ResultCode::SUCCESS || ( code == ResultCode::DECODE_INCOMPLETE && !info.components.empty() );
+    }
+    
+    JPEGDecoder::ResultCode JPEGDecoder::parseHeaderInfo( ByteReader& reader, JPEGInfo& info )
+    {
+        info = JPEGInfo{};
+        
+        UInt8 byte = 0;
+        
+        if ( reader.getRemaining() < 2 )
+            return ResultCode::DECODE_INCOMPLETE;
+        
+        if ( !reader.readUInt8( byte ) || byte != JFIF_BYTE_FF || !reader.readUInt8( byte ) || byte != JFIF_SOI )
+        {
+            LOG(Logger::Level::DEBUG) << "Start of Image marker missing, not a JPEG file" << std::endl;
+            return ResultCode::ERROR;
+        }
+        
+        while ( reader.readUInt8( byte ) )
+        {
+            if ( byte != JFIF_BYTE_FF )
+                return ResultCode::ERROR;
+            
+            // A marker may be preceded by any number of 0xFF fill bytes
+            while ( reader.readUInt8( byte ) && byte == JFIF_BYTE_FF );
+            
+            if ( byte == JFIF_BYTE_FF )
+                return ResultCode::DECODE_INCOMPLETE;
+            
+            if ( byte == JFIF_EOI )
+                return info.components.empty() ? ResultCode::ERROR : ResultCode::SUCCESS;
+            
+            if ( byte >= JFIF_RST0 && byte <= JFIF_RST7 )
+                continue;
+            
+            UInt16 length = 0;
+            ByteReader segment;
+            
+            if ( !reader.readUInt16( length ) )
+                return ResultCode::DECODE_INCOMPLETE;
+            
+            if ( length < 2 )
+                return ResultCode::ERROR;
+            
+            // Everything needed is in the headers before the scan
+            if ( byte == JFIF_SOS )
+                return info.components.empty() ? ResultCode::ERROR : ResultCode::SUCCESS;
+            
+            if ( !reader.subReader( length - 2, segment ) )
+                return ResultCode::DECODE_INCOMPLETE;
+            
+            // SOF0 to SOF15, except for DHT, JPG & DAC that share the range
+            if ( byte >= JFIF_SOF0 && byte <= JFIF_SOF15 && byte != JFIF_DHT && byte != JFIF_JPG && byte != JFIF_DAC )
+            {
+                UInt8 precision = 0, compCount = 0;
+                UInt16 height = 0, width = 0;
+                
+                if ( !segment.readUInt8( precision ) ||
+                     !segment.readUInt16( height ) || !segment.readUInt16( width ) ||
+                     !segment.readUInt8( compCount ) || segment.getRemaining() < compCount * 3u )
+                    return ResultCode::ERROR;
+                
+                info.frameMarker = byte;
+                info.isProgressive = byte == JFIF_SOF2 || byte == JFIF_SOF6 || byte == JFIF_SOF10 || byte == JFIF_SOF14;
+                info.precision = precision;
+                info.width = width;
+                info.height = height;
+                info.components.resize( compCount );
+                
+                for ( auto&& component : info.components )
+                {
+                    UInt8 compID = 0, sampFactor = 0, QTNo = 0;
+                    
+                    segment.readUInt8( compID );
+                    segment.readUInt8( sampFactor );
+                    segment.readUInt8( QTNo );
+                    
+                    component.ID = compID;
+                    component.HSampFactor = sampFactor >> 4;
+                    component.VSampFactor = sampFactor & 0x0F;
+                    component.QTableNumber = QTNo;
+                }
+            }
+            else if ( byte == JFIF_DRI )
+            {
+                if ( !segment.readUInt16( info.restartInterval ) )
+                    return ResultCode::ERROR;
+            }
+            else if ( byte == JFIF_COM )
+            {
+                info.hasComment = true;
+            }
+            else if ( byte >= JFIF_APP0 && byte <= JFIF_APP15 )
+            {
+                info.APPSegments |= 1 << ( byte - JFIF_APP0 );
+            }
+        }
+        
+        return ResultCode::DECODE_INCOMPLETE;
+    }
+    
     JPEGDecoder::ResultCode JPEGDecoder::parseSegmentInfo( const UInt8 byte )
     {
         if ( byte == JFIF_BYTE_0 || byte == JFIF_BYTE_FF )
             return ERROR;
         
-        switch( byte )
+        // Markers without a segment
+        switch ( byte )
         {
             case JFIF_SOI       :   LOG(Logger::Level::INFO) << "Found segment, Start of Image (FFD8)" << std::endl; return ResultCode::SUCCESS;
-            case JFIF_APP0      :   LOG(Logger::Level::INFO) << "Found segment, JPEG/JFIF Image Marker segment (APP0)" << std::endl; parseJFIFSegment(); return ResultCode::SUCCESS;
-            case JFIF_COM       :   LOG(Logger::Level::INFO) << "Found segment, Comment(FFFE)" << std::endl; parseComment(); return ResultCode::SUCCESS;
-            case JFIF_DQT       :   LOG(Logger::Level::INFO) << "Found segment, Define Quantization Table (FFDB)" << std::endl; parseQuantizationTable(); return ResultCode::SUCCESS;
-            case JFIF_SOF0      :   LOG(Logger::Level::INFO) << "Found segment, Start of Frame 0: Baseline DCT (FFC0)" << std::endl; return parseSOF0Segment(); //return ResultCode::SUCCESS;
+            case JFIF_EOI       :   LOG(Logger::Level::INFO) << "Found segment, End of Image (FFD9)" << std::endl; return ResultCode::DECODE_DONE;
+        }
+        
+        if ( byte >= JFIF_RST0 && byte <= JFIF_RST7 )
+        {
+            LOG(Logger::Level::DEBUG) << "Ignoring restart marker outside of the scan data" << std::endl;
+            return ResultCode::SUCCESS;
+        }
+        
+        // Every other marker is followed by the segment length, which includes
+        // the two length bytes. The segment body is handed to the parsers as a
+        // reader of its own, so unknown segments are skipped in one step.
+        UInt16 length = 0;
+        ByteReader segment;
+        
+        if ( !m_reader.readUInt16( length ) || length < 2 || !m_reader.subReader( length - 2, segment ) )
+        {
+            LOG(Logger::Level::ERROR) << "Truncated segment for marker: 0xFF" << std::hex << std::setfill('0') << std::setw(2) << (int)byte << std::dec << std::endl;
+            return ResultCode::ERROR;
+        }
+        
+        switch( byte )
+        {
+            case JFIF_APP0      :   LOG(Logger::Level::INFO) << "Found segment, JPEG/JFIF Image Marker segment (APP0)" << std::endl; return parseJFIFSegment( segment );
+            case JFIF_COM       :   LOG(Logger::Level::INFO) << "Found segment, Comment(FFFE)" << std::endl; return parseComment( segment );
+            case JFIF_DQT       :   LOG(Logger::Level::INFO) << "Found segment, Define Quantization Table (FFDB)" << std::endl; return parseQuantizationTable( segment );
+            case JFIF_SOF0      :   LOG(Logger::Level::INFO) << "Found segment, Start of Frame 0: Baseline DCT (FFC0)" << std::endl; return parseSOF0Segment( segment );
             case JFIF_SOF1      :   LOG(Logger::Level::INFO) << "Found segment, Start of Frame 1: Extended Sequential DCT (FFC1), Not supported" << std::endl; return ResultCode::TERMINATE;
-             case JFIF_SOF2      :   LOG(Logger::Level::INFO) << "Found segment, Start of Frame 2: Progressive DCT (FFC2), Not supported" << std::endl; return ResultCode::TERMINATE;
-//             case JFIF_SOF2      :   LOG(Logger::Level::INFO) << "Found segment, Start of Frame 2: Progressive DCT (FFC2)" << std::endl; parseSOF0Segment(); return ResultCode::SUCCESS;
-            case JFIF_DHT       :   LOG(Logger::Level::INFO) << "Found segment, Define Huffman Table (FFC4)" << std::endl; parseHuffmanTable(); return ResultCode::SUCCESS;
-            case JFIF_SOS       :   LOG(Logger::Level::INFO) << "Found segment, Start of Scan (FFDA)" << std::endl; parseSOSSegment(); return ResultCode::SUCCESS;
-//             case JFIF_EOI       :   LOG(Logger::Level::INFO) << "Found segment, End of Image (FFD9)" << std::endl;  return ResultCode::SUCCESS;
+            case JFIF_SOF2      :   LOG(Logger::Level::INFO) << "Found segment, Start of Frame 2: Progressive DCT (FFC2), Not supported" << std::endl; return ResultCode::TERMINATE;
+            case JFIF_DHT       :   LOG(Logger::Level::INFO) << "Found segment, Define Huffman Table (FFC4)" << std::endl; return parseHuffmanTable( segment );
+            case JFIF_SOS       :   LOG(Logger::Level::INFO) << "Found segment, Start of Scan (FFDA)" << std::endl; return parseSOSSegment( segment );
+            case JFIF_DRI       :   LOG(Logger::Level::INFO) << "Found segment, Define Restart Interval (FFDD)" << std::endl; return parseDRISegment( segment );
         }
         
-        //return ResultCode::DECODE_INCOMPLETE;
+        LOG(Logger::Level::DEBUG) << "Skipped segment for marker: 0xFF" << std::hex << std::setfill('0') << std::setw(2) << (int)byte
+                                  << std::dec << ", length: " << length << std::endl;
+        
         return ResultCode::SUCCESS;
     }
     
@@ -81,110 +370,364 @@ namespace kpeg
         if ( extPos == std::string::npos )
             extPos = m_filename.find( ".jpeg" );
         
-        std::string targetFilename = m_filename.substr( 0, extPos ) + ".ppm";
-        m_image.dumpRawData( targetFilename );
+        std::string targetFilename = m_filename.substr( 0, extPos ) + ( m_image.getPixelType() == PixelType::GRAY8 ? ".pgm" : ".ppm" );
         
-        return true;
+        return dumpRawData( targetFilename );
+    }
+    
+    bool JPEGDecoder::dumpRawData( const std::string& filename )
+    {
+        return m_image.dumpRawData( filename );
     }
     
     JPEGDecoder::ResultCode JPEGDecoder::decodeImageFile()
     {
-        if ( !m_imageFile.is_open() || !m_imageFile.good() )
+        LOG(Logger::Level::INFO) << "Started decoding process..." << std::endl;
+        
+        ResultCode status = parseSegments();
+        
+        // A file truncated after the scan data is still decoded
+        if ( status == ResultCode::DECODE_INCOMPLETE && m_reader.isAtEnd() && m_scanSize > 0 )
         {
-            LOG(Logger::Level::ERROR) << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
-            return ResultCode::ERROR;
+            LOG(Logger::Level::INFO) << "End of Image marker missing, decoding the scan data read so far" << std::endl;
+            status = ResultCode::DECODE_DONE;
         }
         
-        LOG(Logger::Level::INFO) << "Started decoding process..." << std::endl;
+        if ( status == ResultCode::DECODE_DONE && m_components.size() != 1 && m_components.size() != 3 )
+        {
+            LOG(Logger::Level::INFO) << "Only grayscale (1 component) & Y-Cb-Cr (3 component) images are supported!" << std::endl;
+            status = ResultCode::TERMINATE;
+        }
         
-        UInt8 byte;
-        ResultCode status = ResultCode::DECODE_DONE;
+        if ( status == ResultCode::DECODE_DONE )
+        {
+            for ( auto&& component : m_components )
+            {
+                if ( m_QTables[component.QTableNumber][0] == 0 )
+                {
+                    LOG(Logger::Level::ERROR) << "Quantization table #" << component.QTableNumber << " isn't defined" << std::endl;
+                    status = ResultCode::ERROR;
+                    break;
+                }
+            }
+        }
         
-        // TODO: Fix this spaghetti code for keeping track of decode status
+        if ( status == ResultCode::DECODE_DONE )
+            status = decodeScanData();
         
-        while ( m_imageFile >> std::noskipws >> byte )
+        if ( status == ResultCode::DECODE_DONE )
         {
-            if ( byte == JFIF_BYTE_FF )
+            LOG(Logger::Level::INFO) << "Finished decoding process [OK]." << std::endl;
+        }
+        else if ( status == ResultCode::TERMINATE )
+        {
+            LOG(Logger::Level::INFO) << "Terminated decoding process [NOT-OK]." << std::endl;
+        }
+        
+        else if ( status == ResultCode::DECODE_INCOMPLETE )
+        {
+            LOG(Logger::Level::INFO) << "Decoding process incomplete [NOT-OK]." << std::endl;
+        }
+        
+        return status;
+    }
+    
+    JPEGDecoder::ResultCode JPEGDecoder::validate()
+    {
+        LOG(Logger::Level::INFO) << "Started validating image..." << std::endl;
+        
+        ResultCode status = parseSegments();
+        
+        if ( status == ResultCode::DECODE_INCOMPLETE )
+        {
+            LOG(Logger::Level::ERROR) << "Image data ends before the End of Image marker" << std::endl;
+        }
+        
+        if ( status == ResultCode::DECODE_DONE )
+            status = decodeScanBlocks( nullptr );
+        
+        if ( status != ResultCode::SUCCESS )
+        {
+            LOG(Logger::Level::INFO) << "Image validation failed [NOT-OK]." << std::endl;
+            return status == ResultCode::TERMINATE ? ResultCode::TERMINATE : ResultCode::ERROR;
+        }
+        
+        LOG(Logger::Level::INFO) << "Image validated, " << m_MCUCols * m_MCURows << " MCUs [OK]." << std::endl;
+        return ResultCode::SUCCESS;
+    }
+    
+    JPEGDecoder::ResultCode JPEGDecoder::decodeCoefficients( JPEGCoefficients& coefficients )
+    {
+        LOG(Logger::Level::INFO) << "Started decoding DCT coefficients..." << std::endl;
+        
+        ResultCode status = parseSegments();
+        
+        if ( status == ResultCode::DECODE_INCOMPLETE )
+        {
+            LOG(Logger::Level::ERROR) << "Image data ends before the End of Image marker" << std::endl;
+        }
+        
+        if ( status != ResultCode::DECODE_DONE )
+        {
+            LOG(Logger::Level::INFO) << "Decoding DCT coefficients failed [NOT-OK]." << std::endl;
+            return status == ResultCode::TERMINATE ? ResultCode::TERMINATE : ResultCode::ERROR;
+        }
+        
+        coefficients.width = m_image.getWidth();
+        coefficients.height = m_image.getHeight();
+        coefficients.components.clear();
+        
+        for ( auto&& component : m_components )
+        {
+            CoefficientComponent coeffComponent;
+            coeffComponent.ID = component.ID;
+            coeffComponent.HSampFactor = component.HSampFactor;
+            coeffComponent.VSampFactor = component.VSampFactor;
+            coeffComponent.QTableNumber = component.QTableNumber;
+            coeffComponent.blocksPerLine = component.blocksPerLine;
+            coeffComponent.blocksPerColumn = component.blocksPerColumn;
+            coeffComponent.coefficients.assign( component.blocksPerLine * component.blocksPerColumn * 64, 0 );
+            
+            coefficients.components.push_back( std::move( coeffComponent ) );
+        }
+        
+        coefficients.QTables = m_QTables;
+        
+        status = decodeScanBlocks( &coefficients );
+        
+        if ( status != ResultCode::SUCCESS )
+        {
+            LOG(Logger::Level::INFO) << "Decoding DCT coefficients failed [NOT-OK]." << std::endl;
+            return status;
+        }
+        
+        LOG(Logger::Level::INFO) << "Finished decoding DCT coefficients [OK]." << std::endl;
+        return ResultCode::SUCCESS;
+    }
+    
+    JPEGDecoder::ResultCode JPEGDecoder::decodeScanBlocks( JPEGCoefficients* coefficients )
+    {
+        BitReader reader( m_fileData.data() + m_scanOffset, m_scanSize );
+        
+        std::vector<int> DCPred( m_components.size(), 0 );
+        Int16 block[64];
+        
+        int MCUCount = m_MCUCols * m_MCURows;
+        int restartCount = 0;
+        
+        for ( int i = 0; i < MCUCount; ++i )
+        {
+            if ( m_restartInterval > 0 && i > 0 && i % m_restartInterval == 0 )
             {
-                m_imageFile >> std::noskipws >> byte;
-                
-                ResultCode code = parseSegmentInfo(byte);
+                if ( !reader.isAtMarker() )
+                {
+                    LOG(Logger::Level::ERROR) << "Extra scan data before the restart marker at MCU-" << i + 1 << std::endl;
+                    return ResultCode::ERROR;
+                }
                 
-                if ( code == ResultCode::SUCCESS )
-                    continue;
-                else if ( code == ResultCode::TERMINATE )
+                if ( !reader.readRestartMarker( restartCount % 8 ) )
                 {
-                    status = ResultCode::TERMINATE;
-                    break;
+                    LOG(Logger::Level::ERROR) << "Missing restart marker RST" << restartCount % 8 << " before MCU-" << i + 1 << std::endl;
+                    return ResultCode::ERROR;
                 }
-                else if ( code == ResultCode::DECODE_INCOMPLETE )
+                
+                restartCount++;
+                std::fill( DCPred.begin(), DCPred.end(), 0 );
+            }
+            
+            int MCURow = i / m_MCUCols;
+            int MCUCol = i % m_MCUCols;
+            
+            // Each MCU holds HSampFactor x VSampFactor blocks of each
+            // component (in row major order), one component after the other
+            for ( std::size_t c = 0; c < m_components.size(); ++c )
+            {
+                const DecoderComponent& component = m_components[c];
+                
+                for ( int v = 0; v < component.VSampFactor; ++v )
                 {
-                    status = ResultCode::DECODE_INCOMPLETE;
-                    break;
+                    for ( int h = 0; h < component.HSampFactor; ++h )
+                    {
+                        // Only checked, the coefficients are dropped
+                        Int16* coeffs = block;
+                        
+                        if ( coefficients != nullptr )
+                            coeffs = coefficients->components[c].getBlock( MCURow * component.VSampFactor + v,
+                                                                           MCUCol * component.HSampFactor + h );
+                        else
+                            std::fill( block, block + 64, 0 );
+                        
+                        if ( !decodeBlock( reader, component, DCPred[c], coeffs ) )
+                        {
+                            LOG(Logger::Level::ERROR) << "Invalid scan data in MCU-" << i + 1 << std::endl;
+                            return ResultCode::ERROR;
+                        }
+                    }
                 }
             }
-            else
+            
+            if ( reader.isPastEnd() )
+            {
+                LOG(Logger::Level::ERROR) << "Scan data ends before the end of MCU-" << i + 1 << " of " << MCUCount << std::endl;
+                return ResultCode::ERROR;
+            }
+        }
+        
+        if ( !reader.isAtMarker() )
+        {
+            LOG(Logger::Level::ERROR) << "Scan data continues after the last MCU, block count mismatch" << std::endl;
+            return ResultCode::ERROR;
+        }
+        
+        return ResultCode::SUCCESS;
+    }
+    
+    JPEGDecoder::ResultCode JPEGDecoder::parseSegments()
+    {
+        if ( m_fileData.empty() )
+        {
+            LOG(Logger::Level::ERROR) << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
+            return ResultCode::ERROR;
+        }
+        
+        m_reader = ByteReader( m_fileData.data(), m_fileData.size() );
+        m_components.clear();
+        m_scanOffset = m_scanSize = 0;
+        m_restartInterval = 0;
+        
+        UInt8 byte;
+        ResultCode status = ResultCode::DECODE_INCOMPLETE;
+        
+        while ( m_reader.readUInt8( byte ) )
+        {
+            if ( byte != JFIF_BYTE_FF )
             {
-                //std::cout <<m_imageFile.tellg() << "ZZZZZZ: " << std::hex << byte << std::endl;
                 LOG(Logger::Level::ERROR) << "[ FATAL ] Invalid JFIF file! Terminating..." << std::endl;
                 status = ResultCode::ERROR;
                 break;
             }
+            
+            // A marker may be preceded by any number of 0xFF fill bytes
+            while ( m_reader.readUInt8( byte ) && byte == JFIF_BYTE_FF );
+            
+            ResultCode code = parseSegmentInfo( byte );
+            
+            if ( code == ResultCode::SUCCESS )
+                continue;
+            
+            status = code;
+            break;
         }
         
-        if ( status == ResultCode::DECODE_DONE )
+        if ( status == ResultCode::DECODE_DONE && m_scanSize == 0 )
         {
-            decodeScanData();
-            m_image.createImageFromMCUs( m_MCU );
-            LOG(Logger::Level::INFO) << "Finished decoding process [OK]." << std::endl;
+            LOG(Logger::Level::ERROR) << "No image scan data found" << std::endl;
+            status = ResultCode::ERROR;
         }
-        else if ( status == ResultCode::TERMINATE )
+        
+        return status;
+    }
+    
+    bool JPEGDecoder::decodeBlock( BitReader& reader, const DecoderComponent& component, int& DCPred, Int16* block )
+    {
+        // The DC coefficient is coded as the difference from the previous block's
+        int category = reader.readSymbol( m_huffmanDecodeTables[HT_DC][component.DCTableNumber] );
+        
+        if ( category < 0 || category > 11 )
         {
-            LOG(Logger::Level::INFO) << "Terminated decoding process [NOT-OK]." << std::endl;
+            LOG(Logger::Level::ERROR) << ( category < 0 ? "Invalid DC Huffman code" : "DC difference out of range" )
+                                      << " in component " << component.ID << std::endl;
+            return false;
         }
         
-        else if ( status == ResultCode::DECODE_INCOMPLETE )
+        DCPred += reader.readValue( category );
+        
+        if ( DCPred < -2048 || DCPred > 2047 )
         {
-            LOG(Logger::Level::INFO) << "Decoding process incomplete [NOT-OK]." << std::endl;
+            LOG(Logger::Level::ERROR) << "DC coefficient out of range in component " << component.ID << std::endl;
+            return false;
         }
         
-        return status;
+        block[0] = DCPred;
+        
+        // Then the ( zero run, size ) coded AC coefficients, till EOB or the last coefficient
+        for ( int k = 1; k < 64; ++k )
+        {
+            int symbol = reader.readSymbol( m_huffmanDecodeTables[HT_AC][component.ACTableNumber] );
+            
+            if ( symbol < 0 )
+            {
+                LOG(Logger::Level::ERROR) << "Invalid AC Huffman code in component " << component.ID << std::endl;
+                return false;
+            }
+            
+            int zeroCount = symbol >> 4;
+            int size = symbol & 0x0F;
+            
+            if ( size == 0 )
+            {
+                // EOB, the rest of the coefficients are 0
+                if ( zeroCount != 15 )
+                    break;
+                
+                // ZRL, a run of 16 zeros
+                k += 15;
+                continue;
+            }
+            
+            k += zeroCount;
+            
+            if ( k > 63 || size > 10 )
+            {
+                LOG(Logger::Level::ERROR) << ( k > 63 ? "AC coefficients past the end of the block" : "AC coefficient out of range" )
+                                          << " in component " << component.ID << std::endl;
+                return false;
+            }
+            
+            block[ NATURAL_ORDER[k] ] = reader.readValue( size );
+        }
+        
+        return true;
     }
-    
+
 //     void JPEGDecoder::displayImage()
 //     {
 //         LOG(Logger::Level::INFO) << "Displaying decoded JPEG image: \'" + m_filename + "\'" << std::endl;
-//         
+//
 //         m_imageViewer.setImagePtr( m_image.getPixelPtr() );
 //         m_imageViewer.draw();
-//         
+//
 //         LOG(Logger::Level::INFO) << "Finished displaying decoded image [OK]]" << std::endl;
 //     }
     
-    void JPEGDecoder::parseJFIFSegment()
+    JPEGDecoder::ResultCode JPEGDecoder::parseJFIFSegment( ByteReader& segment )
     {
-        if ( !m_imageFile.is_open() || !m_imageFile.good() )
-        {
-            LOG(Logger::Level::ERROR) << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
-            return;
-        }
-        
         LOG(Logger::Level::DEBUG) << "Parsing JPEG/JFIF marker segment (APP-0)..." << std::endl;
         
-        UInt16 lenByte = 0;
-        UInt8 byte = 0;
+        LOG(Logger::Level::DEBUG) << "JFIF Application marker segment length: " << segment.getRemaining() + 2 << std::endl;
         
-        m_imageFile.read( reinterpret_cast<char *>( &lenByte ), 2 );
-        lenByte = htons( lenByte );
-        std::size_t curPos = m_imageFile.tellg();
+        // APP0 is also used by JFIF extensions ('JFXX\0'), which are skipped
+        const UInt8* identifier = segment.getCurrent();
         
-        LOG(Logger::Level::DEBUG) << "JFIF Application marker segment length: " << lenByte << std::endl;
+        if ( segment.getRemaining() < 5 || std::string( identifier, identifier + 5 ) != std::string( "JFIF\0", 5 ) )
+        {
+            LOG(Logger::Level::DEBUG) << "Skipped non JFIF APP-0 segment" << std::endl;
+            return ResultCode::SUCCESS;
+        }
         
         // Skip the 'JFIF\0' bytes
-        m_imageFile.seekg( 5, std::ios_base::cur );
+        segment.skip( 5 );
         
-        UInt8 majVersionByte, minVersionByte;
-        m_imageFile >> std::noskipws >> majVersionByte >> minVersionByte;
+        UInt8 majVersionByte = 0, minVersionByte = 0, densityByte = 0;
+        UInt16 xDensity = 0, yDensity = 0;
+        
+        if ( !segment.readUInt8( majVersionByte ) || !segment.readUInt8( minVersionByte ) ||
+             !segment.readUInt8( densityByte ) ||
+             !segment.readUInt16( xDensity ) || !segment.readUInt16( yDensity ) )
+        {
+            LOG(Logger::Level::ERROR) << "Truncated JFIF marker segment (APP-0)" << std::endl;
+            return ResultCode::ERROR;
+        }
         
         LOG(Logger::Level::DEBUG) << "JFIF version: " << (int)majVersionByte << "." << (int)(minVersionByte >> 4) << (int)(minVersionByte & 0x0F) << std::endl;
         
@@ -194,9 +737,6 @@ namespace kpeg
         
         m_image.setJPEGVersion( std::string( majorVersion + "." + minorVersion ) );
         
-        UInt8 densityByte;
-        m_imageFile >> std::noskipws >> densityByte;
-        
         std::string densityUnit = "";
         switch( densityByte )
         {
@@ -206,224 +746,208 @@ namespace kpeg
         }
         
         LOG(Logger::Level::DEBUG) << "Image density unit: " << densityUnit << std::endl;
-        
-        UInt16 xDensity = 0, yDensity = 0;
-        
-        m_imageFile.read( reinterpret_cast<char *>( &xDensity ), 2 );
-        m_imageFile.read( reinterpret_cast<char *>( &yDensity ), 2 );
-        
-        xDensity = htons(xDensity);
-        yDensity = htons(yDensity);
-        
         LOG(Logger::Level::DEBUG) << "Horizontal image density: " << xDensity << std::endl;
         LOG(Logger::Level::DEBUG) << "Vertical image density: " << yDensity << std::endl;
         
-        // Ignore the image thumbnail data
-        UInt8 xThumb = 0, yThumb = 0;
-        m_imageFile >> std::noskipws >> xThumb >> yThumb;        
-        m_imageFile.seekg( 3 * xThumb * yThumb, std::ios_base::cur );
+        // The image thumbnail data, if any, is ignored along with the rest of the segment
         
         LOG(Logger::Level::DEBUG) << "Finished parsing JPEG/JFIF marker segment (APP-0) [OK]" << std::endl;
-        //std::cout << "Current file pos: " << m_imageFile.tellg() << std::endl;
+        return ResultCode::SUCCESS;
     }
     
-    void JPEGDecoder::parseQuantizationTable()
+    JPEGDecoder::ResultCode JPEGDecoder::parseQuantizationTable( ByteReader& segment )
     {
-        if ( !m_imageFile.is_open() || !m_imageFile.good() )
-        {
-            LOG(Logger::Level::ERROR) << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
-            return;
-        }
-        
         LOG(Logger::Level::DEBUG) << "Parsing quantization table segment..." << std::endl;
+        LOG(Logger::Level::DEBUG) << "Quantization table segment length: " << segment.getRemaining() + 2 << std::endl;
         
-        UInt16 lenByte = 0;
+        // A DQT segment may hold several tables
         UInt8 PqTq;
-        UInt8 Qi;
-        //int QTNumber = 0;
-        
-        m_imageFile.read( reinterpret_cast<char *>( &lenByte ), 2 );
-        lenByte = htons( lenByte );
-        LOG(Logger::Level::DEBUG) << "Quantization table segment length: " << (int)lenByte << std::endl;
         
-        lenByte -= 2;
-        
-        //std::cout << "ZZZZ: " << int(lenByte) / 65 << std::endl;
-        
-        for ( int qt = 0; qt < int(lenByte) / 65; ++qt )
+        while ( segment.readUInt8( PqTq ) )
         {
-            m_imageFile >> std::noskipws >> PqTq;
-            
             int precision = PqTq >> 4; // Precision is always 8-bit for baseline DCT
             int QTtable = PqTq & 0x0F; // Quantization table number (0-3)
             
             LOG(Logger::Level::DEBUG) << "Quantization Table Number: " << QTtable << std::endl;
             LOG(Logger::Level::DEBUG) << "Quantization Table #" << QTtable << " precision: " << (precision == 0 ? "8-bit" : "16-bit" ) << std::endl;
             
-            m_QTables.push_back({});
-            
-            // Populate quantization table #QTtable
+            if ( QTtable > 3 )
+            {
+                LOG(Logger::Level::ERROR) << "Invalid quantization table number: " << QTtable << std::endl;
+                return ResultCode::ERROR;
+            }
             
+            // Populate quantization table #QTtable, the entries are in zig-zag order
             for ( auto i = 0; i < 64; ++i )
             {
-                m_imageFile >> std::noskipws >> Qi;
+                UInt8 byte = 0;
+                UInt16 Qi = 0;
                 
-//                 if ( Qi == JFIF_BYTE_FF )
-//                 {
-//                     LOG(Logger::Level::ERROR) << "Unexpected start of marker at offest: " << (int)m_imageFile.tellg() - 1 << std::endl;
-//                     return;
-//                 }
+                bool ok = precision == 0 ? segment.readUInt8( byte ) : segment.readUInt16( Qi );
                 
-                m_QTables[QTtable].push_back( (UInt16)Qi );
-            }
-        }
-        
-//         int qt[8][8];
-//         for ( auto i = 0; i < m_QTables[QTtable].size(); ++i )
-//         {
-//             auto y = zzOrderToMatIndices( i ).first;
-//             auto x = zzOrderToMatIndices( i ).second;            
-//             qt[y][x] = m_QTables[QTtable][i];
-//             //std::cout << i << std::endl;
-//         }
-//         
-//         for ( auto i = 0; i < 8; ++i)
-//         {
-//             for ( auto j = 0; j < 8; ++j)
-//                 std::cout << qt[i][j] << " ";
-//             std::cout << std::endl;
-//         }
+                if ( !ok )
+                {
+                    LOG(Logger::Level::ERROR) << "Truncated quantization table #" << QTtable << std::endl;
+                    return ResultCode::ERROR;
+                }
+                
+                m_QTables[QTtable][ NATURAL_ORDER[i] ] = precision == 0 ? byte : Qi;
+            }
+            
+            // The IDCT's scale factor of each coefficient is folded into its
+            // quantization step, so it's applied as part of the dequantization
+            for ( auto i = 0; i < 64; ++i )
+                m_IDCTTables[QTtable][i] = DCT_SCALES[i] * m_QTables[QTtable][i];
+        }
         
         LOG(Logger::Level::DEBUG) << "Finished parsing quantization table segment [OK]" << std::endl;
-//         printCurrPos();
+        return ResultCode::SUCCESS;
     }
     
-    JPEGDecoder::ResultCode JPEGDecoder::parseSOF0Segment()
+    JPEGDecoder::ResultCode JPEGDecoder::parseSOF0Segment( ByteReader& segment )
     {
-        if ( !m_imageFile.is_open() || !m_imageFile.good() )
-        {
-            LOG(Logger::Level::ERROR) << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
-            return ResultCode::ERROR;
-        }
-        
         LOG(Logger::Level::DEBUG) << "Parsing SOF-0 segment..." << std::endl;
         
-        UInt16 lenByte, imgHeight, imgWidth;
-        UInt8 precision, compCount;
-        
-        m_imageFile.read( reinterpret_cast<char *>( &lenByte ), 2 );
-        lenByte = htons( lenByte );
+        UInt16 imgHeight = 0, imgWidth = 0;
+        UInt8 precision = 0, compCount = 0;
         
-        LOG(Logger::Level::DEBUG) << "SOF-0 segment length: " << (int)lenByte << std::endl;
+        LOG(Logger::Level::DEBUG) << "SOF-0 segment length: " << segment.getRemaining() + 2 << std::endl;
         
-        m_imageFile >> std::noskipws >> precision;
-        LOG(Logger::Level::DEBUG) << "SOF-0 segment data precision: " << (int)precision << std::endl;
-        
-        m_imageFile.read( reinterpret_cast<char *>( &imgHeight ), 2 );
-        m_imageFile.read( reinterpret_cast<char *>( &imgWidth ), 2 );
-        
-        imgHeight = htons( imgHeight );
-        imgWidth = htons( imgWidth );
+        if ( !segment.readUInt8( precision ) ||
+             !segment.readUInt16( imgHeight ) || !segment.readUInt16( imgWidth ) ||
+             !segment.readUInt8( compCount ) )
+        {
+            LOG(Logger::Level::ERROR) << "Truncated SOF-0 segment" << std::endl;
+            return ResultCode::ERROR;
+        }
         
+        LOG(Logger::Level::DEBUG) << "SOF-0 segment data precision: " << (int)precision << std::endl;
         LOG(Logger::Level::DEBUG) << "Image height: " << (int)imgHeight << std::endl;
         LOG(Logger::Level::DEBUG) << "Image width: " << (int)imgWidth << std::endl;
-        
-        m_imageFile >> std::noskipws >> compCount;
-        
         LOG(Logger::Level::DEBUG) << "No. of components: " << (int)compCount << std::endl;
         
         UInt8 compID = 0, sampFactor = 0, QTNo = 0;
         
-        bool isNonSampled = true;
+        m_components.clear();
         
-        for ( auto i = 0; i < 3; ++i )
+        int maxHSampFactor = 1, maxVSampFactor = 1;
+        
+        for ( auto i = 0; i < compCount; ++i )
         {
-            m_imageFile >> std::noskipws >> compID >> sampFactor >> QTNo;
+            if ( !segment.readUInt8( compID ) || !segment.readUInt8( sampFactor ) || !segment.readUInt8( QTNo ) )
+            {
+                LOG(Logger::Level::ERROR) << "Truncated SOF-0 component info" << std::endl;
+                return ResultCode::ERROR;
+            }
             
             LOG(Logger::Level::DEBUG) << "Component ID: " << (int)compID << std::endl;
             LOG(Logger::Level::DEBUG) << "Sampling Factor, Horizontal: " << int( sampFactor >> 4 ) << ", Vertical: " << int( sampFactor & 0x0F ) << std::endl;
             LOG(Logger::Level::DEBUG) << "Quantization table no.: " << (int)QTNo << std::endl;
             
-            if ( ( sampFactor >> 4 ) != 1 || ( sampFactor & 0x0F ) != 1 )
-                isNonSampled = false;
+            DecoderComponent component{};
+            component.ID = compID;
+            component.HSampFactor = sampFactor >> 4;
+            component.VSampFactor = sampFactor & 0x0F;
+            component.QTableNumber = QTNo;
+            
+            if ( component.HSampFactor < 1 || component.HSampFactor > 4 ||
+                 component.VSampFactor < 1 || component.VSampFactor > 4 || QTNo > 3 )
+            {
+                LOG(Logger::Level::ERROR) << "Invalid SOF-0 component info" << std::endl;
+                return ResultCode::ERROR;
+            }
+            
+            m_components.push_back( component );
         }
         
-        if ( !isNonSampled )
+        // A single component is coded one block at a time, whatever its sampling factors
+        if ( m_components.size() == 1 )
+            m_components[0].HSampFactor = m_components[0].VSampFactor = 1;
+        
+        for ( auto&& component : m_components )
         {
-            LOG(Logger::Level::INFO) << "Chroma subsampling not yet supported!" << std::endl;
-            LOG(Logger::Level::DEBUG) << "Chroma subsampling is not 4:4:4, terminating..." << std::endl;
-            return ResultCode::TERMINATE;
+            maxHSampFactor = std::max( maxHSampFactor, component.HSampFactor );
+            maxVSampFactor = std::max( maxVSampFactor, component.VSampFactor );
+        }
+        
+        if ( imgWidth == 0 || imgHeight == 0 || m_components.empty() )
+        {
+            LOG(Logger::Level::ERROR) << "Invalid image dimensions or component count" << std::endl;
+            return ResultCode::ERROR;
+        }
+        
+        // An MCU covers the blocks of all the components, for
+        // an area of ( 8 * max sampling factor ) pixels per side
+        m_MCUCols = ( imgWidth + 8 * maxHSampFactor - 1 ) / ( 8 * maxHSampFactor );
+        m_MCURows = ( imgHeight + 8 * maxVSampFactor - 1 ) / ( 8 * maxVSampFactor );
+        
+        m_maxHSampFactor = maxHSampFactor;
+        m_maxVSampFactor = maxVSampFactor;
+        
+        for ( auto&& component : m_components )
+        {
+            component.blocksPerLine = m_MCUCols * component.HSampFactor;
+            component.blocksPerColumn = m_MCURows * component.VSampFactor;
         }
         
+        selectMCUKernels();
+        
         LOG(Logger::Level::DEBUG) << "Finished parsing SOF-0 segment [OK]" << std::endl;
-        //printCurrPos();
         
         m_image.setDimensions( imgWidth, imgHeight );
         
         return ResultCode::SUCCESS;
     }
     
-    void JPEGDecoder::parseHuffmanTable()
+    JPEGDecoder::ResultCode JPEGDecoder::parseHuffmanTable( ByteReader& segment )
     {
-        if ( !m_imageFile.is_open() || !m_imageFile.good() )
-        {
-            LOG(Logger::Level::ERROR) << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
-            return;
-        }
-        
         LOG(Logger::Level::DEBUG) << "Parsing Huffman table segment..." << std::endl;
+        LOG(Logger::Level::DEBUG) << "Huffman table length: " << segment.getRemaining() + 2 << std::endl;
         
-        UInt16 len;
-        m_imageFile.read( reinterpret_cast<char *>( &len ), 2 );
-        len = htons( len );
-        
-        LOG(Logger::Level::DEBUG) << "Huffman table length: " << (int)len << std::endl;
+        // A DHT segment may hold several tables
+        UInt8 htinfo;
         
-        int segmentEnd = (int)m_imageFile.tellg() + len - 2;
-        //len -= 2;
-        
-        while ( m_imageFile.tellg() < segmentEnd )
+        while ( segment.readUInt8( htinfo ) )
         {
-            UInt8 htinfo;
-            m_imageFile >> std::noskipws >> htinfo;
-            
             int HTType = int( (htinfo & 0x10) >> 4 );
             int HTNumber = int(htinfo & 0x0F);
             
             LOG(Logger::Level::DEBUG) << "Huffman table type: " << HTType << std::endl;
             LOG(Logger::Level::DEBUG) << "Huffman table #: " << HTNumber << std::endl;
             
-            int totalSymbolCount = 0;
-            UInt8 symbolCount;
-            
-            //LOG(Logger::Level::DEBUG) << "Displaying Huffman table, (Type: " << HTType << ", #: " << HTNumber << ") symbol counts... " << std::endl;
-            for ( auto i = 1; i <= 16; ++i )
+            if ( HTNumber > 1 )
             {
-                m_imageFile >> std::noskipws >> symbolCount;
-    //             LOG(Logger::Level::DEBUG) << "Huffman table, (Type:" << HTType << ",#:" << HTNumber << "), Length=" << i << " : " << (int)symbolCount << std::endl;
-                //LOG(Logger::Level::DEBUG) << "Code length=" << i << " : " << (int)symbolCount << std::endl;
-                
-                m_huffmanTable[HTType][HTNumber][i-1].first = (int)symbolCount;
-                totalSymbolCount += (int)symbolCount;
+                LOG(Logger::Level::ERROR) << "Unsupported Huffman table #: " << HTNumber << std::endl;
+                return ResultCode::ERROR;
             }
             
-            int syms = 0;
-            for ( auto i = 0; syms < totalSymbolCount;  )
+            HuffmanTable& htable = m_huffmanTable[HTType][HTNumber];
+            
+            // The symbol count for each code length, then the symbols in order of code length
+            for ( auto i = 0; i < 16; ++i )
             {
-                UInt8 code;
-                m_imageFile >> std::noskipws >> code;
-                //LOG(Logger::Level::DEBUG) << "Huffman code: 0x" << std::hex << std::setfill('0') << std::setw(2) << std::setprecision(8) << (int)code << "(" << std::bitset<8>(int(code)) << ")" << std::endl;
+                UInt8 symbolCount = 0;
                 
-                if ( m_huffmanTable[HTType][HTNumber][i].first == 0 )
+                if ( !segment.readUInt8( symbolCount ) )
                 {
-                    while ( m_huffmanTable[HTType][HTNumber][++i].first == 0 );
+                    LOG(Logger::Level::ERROR) << "Truncated Huffman table" << std::endl;
+                    return ResultCode::ERROR;
                 }
                 
-                m_huffmanTable[HTType][HTNumber][i].second.push_back( code );
-                syms++;
+                htable[i].first = (int)symbolCount;
+                htable[i].second.clear();
+            }
+            
+            for ( auto i = 0; i < 16; ++i )
+            {
+                if ( segment.getRemaining() < std::size_t( htable[i].first ) )
+                {
+                    LOG(Logger::Level::ERROR) << "Truncated Huffman table" << std::endl;
+                    return ResultCode::ERROR;
+                }
                 
-                if ( m_huffmanTable[HTType][HTNumber][i].first == m_huffmanTable[HTType][HTNumber][i].second.size() )
-                    i++;
+                htable[i].second.assign( segment.getCurrent(), segment.getCurrent() + htable[i].first );
+                segment.skip( htable[i].first );
             }
             
             LOG(Logger::Level::DEBUG) << "Printing symbols for Huffman table (" << HTType << "," << HTNumber << ")..." << std::endl;
@@ -432,7 +956,7 @@ namespace kpeg
             for ( auto i = 0; i < 16; ++i )
             {
                 std::string codeStr = "";
-                for ( auto&& symbol : m_huffmanTable[HTType][HTNumber][i].second )
+                for ( auto&& symbol : htable[i].second )
                 {
                     std::stringstream ss;
                     ss << "0x" << std::hex << std::setfill('0') << std::setw(2) << std::setprecision(16) << (int)symbol;
@@ -440,71 +964,47 @@ namespace kpeg
                     totalCodes++;
                 }
                 
-                LOG(Logger::Level::DEBUG) << "Code length: " << i+1 // m_huffmanTable[HTType][HTNumber][i].first
-                                        << ", Symbol count: " << m_huffmanTable[HTType][HTNumber][i].second.size()
+                LOG(Logger::Level::DEBUG) << "Code length: " << i+1
+                                        << ", Symbol count: " << htable[i].second.size()
                                         << ", Symbols: " << codeStr << std::endl;
             }
             
             LOG(Logger::Level::DEBUG) << "Total Huffman codes for Huffman table(Type:" << HTType << ",#:" << HTNumber << "): " << totalCodes << std::endl;
             
-            m_huffmanTree[HTType][HTNumber].constructHuffmanTree( m_huffmanTable[HTType][HTNumber] );
-            auto htree = m_huffmanTree[HTType][HTNumber].getTree();
-            LOG(Logger::Level::DEBUG) << "Huffman codes:-" << std::endl;
-            inOrder( htree );
+            m_huffmanDecodeTables[HTType][HTNumber] = generateHuffmanDecodeTable( htable );
         }
         
         LOG(Logger::Level::DEBUG) << "Finished parsing Huffman table segment [OK]" << std::endl;
-        
-//          printCurrPos();
+        return ResultCode::SUCCESS;
     }
     
-    void JPEGDecoder::parseSOSSegment()
+    JPEGDecoder::ResultCode JPEGDecoder::parseSOSSegment( ByteReader& segment )
     {
-//         if ( m_huffTableCount < 4 )
-//         {
-//             //m_huffmanTable
-//             //return;
-//             m_huffmanTable[1][0] = m_huffmanTable[0][1];
-//             m_huffmanTable[1][1] = m_huffmanTable[0][1];
-//             
-//             m_huffmanTree[1][0].constructHuffmanTree( m_huffmanTable[1][0] );
-//             m_huffmanTree[1][1].constructHuffmanTree( m_huffmanTable[1][1] );
-//         }
-        
-        if ( !m_imageFile.is_open() || !m_imageFile.good() )
-        {
-            LOG(Logger::Level::ERROR) << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
-            return;
-        }
-        
         LOG(Logger::Level::DEBUG) << "Parsing SOS segment..." << std::endl;
+        LOG(Logger::Level::DEBUG) << "SOS segment length: " << segment.getRemaining() + 2 << std::endl;
         
-        UInt16 len;
-        
-        m_imageFile.read( reinterpret_cast<char *>( &len ), 2 );
-        len = htons( len );
-        
-        LOG(Logger::Level::DEBUG) << "SOS segment length: " << len << std::endl;
-        
-        UInt8 compCount; // Number of components
+        UInt8 compCount = 0; // Number of components
         UInt16 compInfo; // Component ID and Huffman table used
         
-        m_imageFile >> std::noskipws >> compCount;
+        segment.readUInt8( compCount );
         
         if ( compCount < 1 || compCount > 4 )
         {
             LOG(Logger::Level::ERROR) << "Invalid component count in image scan: " << (int)compCount << ", terminating decoding process..." << std::endl;
-            return;
+            return ResultCode::ERROR;
         }
         
         LOG(Logger::Level::DEBUG) << "Number of components in scan data: " << (int)compCount << std::endl;
         
         for ( auto i = 0; i < compCount; ++i )
         {
-            m_imageFile.read( reinterpret_cast<char *>( &compInfo ), 2 );
-            compInfo = htons( compInfo );
+            if ( !segment.readUInt16( compInfo ) )
+            {
+                LOG(Logger::Level::ERROR) << "Truncated SOS segment" << std::endl;
+                return ResultCode::ERROR;
+            }
             
-            UInt8 cID = compInfo >> 8; // 1st byte denotes component ID 
+            UInt8 cID = compInfo >> 8; // 1st byte denotes component ID
             
             // 2nd byte denotes the Huffman table used:
             // Bits 7 to 4: DC Table #(0 to 3)
@@ -513,344 +1013,466 @@ namespace kpeg
             UInt8 ACTableNum = ( compInfo & 0x000f );
             
             LOG(Logger::Level::DEBUG) << "Component ID: " << (int)cID << ", DC Table #: " << (int)DCTableNum << ", AC Table #: " << (int)ACTableNum << std::endl;
+            
+            auto component = std::find_if( m_components.begin(), m_components.end(),
+                                           [cID]( const DecoderComponent& comp ) { return comp.ID == cID; } );
+            
+            if ( component == m_components.end() || DCTableNum > 1 || ACTableNum > 1 )
+            {
+                LOG(Logger::Level::ERROR) << "Invalid component or Huffman table in SOS segment" << std::endl;
+                return ResultCode::ERROR;
+            }
+            
+            if ( !isHuffmanTableDefined( m_huffmanTable[HT_DC][DCTableNum] ) || !isHuffmanTableDefined( m_huffmanTable[HT_AC][ACTableNum] ) )
+            {
+                LOG(Logger::Level::ERROR) << "Huffman table used by component " << (int)cID << " isn't defined" << std::endl;
+                return ResultCode::ERROR;
+            }
+            
+            component->DCTableNumber = DCTableNum;
+            component->ACTableNumber = ACTableNum;
         }
         
-        // Skip the next three bytes
-        for ( auto i = 0; i < 3; ++i )
+        // Only a single scan with all the components is supported
+        if ( compCount != m_components.size() )
         {
-            UInt8 byte;
-            m_imageFile >> std::noskipws >> byte;
+            LOG(Logger::Level::INFO) << "Non-interleaved scans not yet supported!" << std::endl;
+            return ResultCode::TERMINATE;
         }
         
-//         printCurrPos();
+        // The spectral selection & successive approximation bytes
+        // are fixed for baseline DCT, they're ignored
         
         LOG(Logger::Level::DEBUG) << "Finished parsing SOS segment [OK]" << std::endl;
         
         scanImageData();
+        return ResultCode::SUCCESS;
     }
     
-    void JPEGDecoder::scanImageData()
+    JPEGDecoder::ResultCode JPEGDecoder::parseDRISegment( ByteReader& segment )
     {
-        if ( !m_imageFile.is_open() || !m_imageFile.good() )
+        LOG(Logger::Level::DEBUG) << "Parsing DRI segment..." << std::endl;
+        
+        if ( !segment.readUInt16( m_restartInterval ) )
         {
-            LOG(Logger::Level::ERROR) << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
-            return;
+            LOG(Logger::Level::ERROR) << "Truncated DRI segment" << std::endl;
+            return ResultCode::ERROR;
         }
         
+        LOG(Logger::Level::DEBUG) << "Restart interval: " << m_restartInterval << " MCUs" << std::endl;
+        LOG(Logger::Level::DEBUG) << "Finished parsing DRI segment [OK]" << std::endl;
+        return ResultCode::SUCCESS;
+    }
+    
+    void JPEGDecoder::scanImageData()
+    {
         LOG(Logger::Level::DEBUG) << "Scanning image data..." << std::endl;
         
-        UInt8 byte;
+        // The scan data is only located here, it's decoded later
+        m_scanOffset = m_reader.getPosition();
         
-        while ( m_imageFile >> std::noskipws >> byte )
+        while ( !m_reader.isAtEnd() )
         {
-            if ( byte == JFIF_BYTE_FF )
+            m_reader.seekToNextFF();
+            
+            if ( m_reader.getRemaining() < 2 )
+                break;
+            
+            UInt8 byte = m_reader.getCurrent()[1];
+            
+            // Stuffed 0x00 bytes and restart markers are part of the scan data,
+            // 0xFF may be a fill byte before a marker
+            if ( byte == JFIF_BYTE_0 || byte == JFIF_BYTE_FF || ( byte >= JFIF_RST0 && byte <= JFIF_RST7 ) )
             {
-                UInt8 prevByte = byte;
-                
-                m_imageFile >> std::noskipws >> byte;
-                
-                if ( byte == JFIF_EOI )
-                {
-                    LOG(Logger::Level::INFO) << "Found segment, End of Image (FFD9)" << std::endl;
-                    return;
-                }
-                
-                std::bitset<8> bits1( prevByte );
-                LOG(Logger::Level::DEBUG) << "0x" << std::hex << std::setfill('0') << std::setw(2)
-                                          << std::setprecision(8) << (int)prevByte
-                                          << ", Bits: " << bits1 << std::endl;
-                                          
-                //m_scanData.push_back( bits1 );
-                m_scanData.append( bits1.to_string() );
+                m_reader.skip( byte == JFIF_BYTE_FF ? 1 : 2 );
+                continue;
             }
             
-            std::bitset<8> bits( byte );
-            LOG(Logger::Level::DEBUG) << "0x" << std::hex << std::setfill('0') << std::setw(2)
-                                      << std::setprecision(8) << (int)byte
-                                      << ", Bits: " << bits << std::endl;
-            
-            //m_scanData.push_back( std::move( bits ) );
-            m_scanData.append( bits.to_string() );
+            // Any other marker (usually EOI) ends the scan, it's left for parseSegments()
+            break;
         }
         
+        m_scanSize = m_reader.getPosition() - m_scanOffset;
+        
+        LOG(Logger::Level::DEBUG) << "Scan data size: " << m_scanSize << " bytes" << std::endl;
         LOG(Logger::Level::DEBUG) << "Finished scanning image data [OK]" << std::endl;
     }
     
-    void JPEGDecoder::parseComment()
+    JPEGDecoder::ResultCode JPEGDecoder::parseComment( ByteReader& segment )
+    {
+        LOG(Logger::Level::DEBUG) << "Parsing comment segment..." << std::endl;
+        LOG(Logger::Level::DEBUG) << "Comment segment length: " << segment.getRemaining() + 2 << std::endl;
+        
+        std::string comment( segment.getCurrent(), segment.getCurrent() + segment.getRemaining() );
+        
+        LOG(Logger::Level::DEBUG) << "Comment segment content: " << comment << std::endl;
+        LOG(Logger::Level::DEBUG) << "Finished parsing comment segment [OK]" << std::endl;
+        
+        m_image.setComment( comment );
+        return ResultCode::SUCCESS;
+    }
+    
+    JPEGDecoder::ResultCode JPEGDecoder::decodeScanData()
     {
-        if ( !m_imageFile.is_open() || !m_imageFile.good() )
+        LOG(Logger::Level::DEBUG) << "Decoding image scan data..." << std::endl;
+        
+        m_image.setPixelType( m_components.size() == 1 || m_grayscaleOutput ? PixelType::GRAY8 : PixelType::RGB8 );
+        m_image.createPixels();
+        
+        // Blocks of all the components in a row of MCUs
+        std::size_t blocksPerRow = 0;
+        
+        for ( auto&& component : m_components )
+            blocksPerRow += component.blocksPerLine * component.VSampFactor;
+        
+        TaskScheduler* scheduler = m_scheduler;
+        
+        if ( scheduler == nullptr )
         {
-            LOG(Logger::Level::ERROR) << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
-            return;
+            // The calling thread does its share of the reconstruction too
+            std::size_t threadCount = m_threadCount > 0 ? m_threadCount : std::max( 1u, std::thread::hardware_concurrency() );
+            std::size_t workerCount = threadCount - 1;
+            
+            if ( workerCount > 0 && ( m_ownScheduler == nullptr || m_ownScheduler->getThreadCount() != workerCount ) )
+                m_ownScheduler.reset( new TaskScheduler( workerCount ) );
+            
+            scheduler = workerCount > 0 ? m_ownScheduler.get() : nullptr;
         }
         
-        LOG(Logger::Level::DEBUG) << "Parsing comment segment..." << std::endl;
-        
-        UInt16 lenByte = 0;
-        UInt8 byte = 0;
-        std::string comment;
+        BitReader reader( m_fileData.data() + m_scanOffset, m_scanSize );
         
-        m_imageFile.read( reinterpret_cast<char *>(&lenByte), 2 );
-        lenByte = htons( lenByte );
-        std::size_t curPos = m_imageFile.tellg();
+        std::vector<int> DCPred( m_components.size(), 0 );
+        int restartCount = 0;
+        bool valid = true;
         
-        LOG(Logger::Level::DEBUG) << "Comment segment length: " << lenByte << std::endl;
+        // The rows after invalid scan data are left with all 0 coefficients (gray)
+        auto decodeRow = [&]( const int row, const std::size_t firstBlock )
+        {
+            m_blocks.clear( firstBlock, blocksPerRow );
+            
+            if ( !valid )
+                return;
+            
+            if ( !(this->*m_decodeMCURow)( reader, row, DCPred, restartCount, m_blocks.getBlock( firstBlock ) ) )
+            {
+                LOG(Logger::Level::ERROR) << "Invalid scan data, image incomplete from MCU row " << row + 1 << " on" << std::endl;
+                valid = false;
+            }
+            // The blocks past the end of a truncated file are decoded from padding
+            else if ( reader.isPastEnd() )
+            {
+                LOG(Logger::Level::ERROR) << "Scan data ends before the end of MCU row " << row + 1 << " of " << m_MCURows << std::endl;
+                valid = false;
+            }
+        };
         
-        for ( auto i = 0; i < lenByte - 2; ++i )
+        if ( scheduler == nullptr )
         {
-            m_imageFile >> std::noskipws >> byte;
+            m_blocks.reserve( blocksPerRow );
             
-            if ( byte == JFIF_BYTE_FF )
+            for ( int row = 0; row < m_MCURows; ++row )
             {
-                LOG(Logger::Level::ERROR) << "Unexpected start of marker at offest: " << curPos + i << std::endl;
-                LOG(Logger::Level::DEBUG) << "Comment segment content: " << comment << std::endl;
-                return;
+                decodeRow( row, 0 );
+                (this->*m_reconstructMCURow)( row, m_blocks.getBlock( 0 ), t_samples );
             }
             
-            //std::cout << "Count: " << i << ", Byte: " << (unsigned char)byte << ", Position: " << (std::size_t)m_imageFile.tellg() - 1 <<  std::endl;
-            comment.push_back( static_cast<char>(byte) );
+            if ( !valid )
+                return ResultCode::DECODE_INCOMPLETE;
+            
+            LOG(Logger::Level::DEBUG) << "Decoded " << m_MCURows << " MCU rows [OK]" << std::endl;
+            return ResultCode::DECODE_DONE;
         }
         
-        LOG(Logger::Level::DEBUG) << "Comment segment content: " << comment << std::endl;
-        LOG(Logger::Level::DEBUG) << "Finished parsing comment segment [OK]" << std::endl;
-        //std::cout << "Current file pos: " << m_imageFile.tellg() << std::endl;
+        // The rows are reconstructed in chunks big enough to be worth a task
+        const int chunkRows = std::max<int>( 1, ( MIN_TASK_BLOCKS + blocksPerRow - 1 ) / blocksPerRow );
+        const int chunkCount = ( m_MCURows + chunkRows - 1 ) / chunkRows;
         
-        m_image.setComment( comment );
+        // Enough chunk buffers for each thread to have one to reconstruct,
+        // with the entropy decoding on the next ones
+        const std::size_t slotCount = std::min<std::size_t>( 2 * ( scheduler->getThreadCount() + 1 ), chunkCount );
+        
+        const std::size_t blocksPerSlot = chunkRows * blocksPerRow;
+        
+        m_blocks.reserve( slotCount * blocksPerSlot );
+        BoundedQueue<int> freeSlots( slotCount );
+        
+        for ( std::size_t slot = 0; slot < slotCount; ++slot )
+            freeSlots.push( slot );
+        
+        TaskGroup group;
+        
+        for ( int firstRow = 0; firstRow < m_MCURows; firstRow += chunkRows )
+        {
+            int slot;
+            
+            // Help with the reconstruction while all the buffers are in use
+            while ( !freeSlots.tryPop( slot ) )
+                scheduler->waitForTask( group );
+            
+            const int lastRow = std::min( firstRow + chunkRows, m_MCURows );
+            
+            for ( int row = firstRow; row < lastRow; ++row )
+                decodeRow( row, slot * blocksPerSlot + ( row - firstRow ) * blocksPerRow );
+            
+            const Int16* coefficients = m_blocks.getBlock( slot * blocksPerSlot );
+            
+            scheduler->submit( group, [this, &freeSlots, slot, coefficients, firstRow, lastRow, blocksPerRow]()
+            {
+                for ( int row = firstRow; row < lastRow; ++row )
+                    (this->*m_reconstructMCURow)( row, coefficients + ( row - firstRow ) * blocksPerRow * 64, t_samples );
+                
+                freeSlots.push( slot );
+            } );
+        }
+        
+        scheduler->wait( group );
+        
+        if ( !valid )
+            return ResultCode::DECODE_INCOMPLETE;
+        
+        LOG(Logger::Level::DEBUG) << "Decoded " << m_MCURows << " MCU rows in " << chunkCount << " tasks [OK]" << std::endl;
+        return ResultCode::DECODE_DONE;
     }
     
-    void JPEGDecoder::byteStuffScanData()
+    void JPEGDecoder::selectMCUKernels()
     {
-        if ( m_scanData.empty() )
+        m_decodeMCURow = nullptr;
+        m_reconstructMCURow = nullptr;
+        
+        if ( m_components.size() == 1 )
+        {
+            setMCUKernels<1, 1, 1>();
+            LOG(Logger::Level::DEBUG) << "Using the grayscale MCU kernels" << std::endl;
+            return;
+        }
+        
+        if ( m_grayscaleOutput )
+        {
+            LOG(Logger::Level::DEBUG) << "Reconstructing the luminance only" << std::endl;
+        }
+        
+        if ( m_components.size() != 3 )
+            return;
+        
+        const int H = m_components[0].HSampFactor;
+        const int V = m_components[0].VSampFactor;
+        
+        bool chroma1x1 = true;
+        
+        for ( int c = 1; c < 3; ++c )
+            chroma1x1 = chroma1x1 && m_components[c].HSampFactor == 1 && m_components[c].VSampFactor == 1;
+        
+        if ( chroma1x1 && H == 1 && V == 1 )
+            setMCUKernels<3, 1, 1>();
+        else if ( chroma1x1 && H == 2 && V == 1 )
+            setMCUKernels<3, 2, 1>();
+        else if ( chroma1x1 && H == 2 && V == 2 )
+            setMCUKernels<3, 2, 2>();
+        else
         {
-            LOG(Logger::Level::ERROR) << " [ FATAL ] Invalid image scan data" << std::endl;
+            setMCUKernels<3, 0, 0>();
+            LOG(Logger::Level::DEBUG) << "Using the generic MCU kernels" << std::endl;
             return;
         }
         
-        LOG(Logger::Level::DEBUG) << "Byte stuffing image scan data..." << std::endl;
+        LOG(Logger::Level::DEBUG) << "Using the " << H << "x" << V << " Y-Cb-Cr MCU kernels" << std::endl;
+    }
+    
+    template <int COMPONENTS, int H, int V>
+    void JPEGDecoder::setMCUKernels()
+    {
+        m_decodeMCURow = &JPEGDecoder::decodeMCURow<COMPONENTS, H, V>;
+        
+        // The luminance blocks come first in each row, the chroma ones are left out
+        if ( m_grayscaleOutput )
+            m_reconstructMCURow = &JPEGDecoder::reconstructMCURow<1, H, V>;
+        else
+            m_reconstructMCURow = &JPEGDecoder::reconstructMCURow<COMPONENTS, H, V>;
+    }
+    
+    template <int COMPONENTS, int H, int V>
+    bool JPEGDecoder::decodeMCURow( BitReader& reader, const int row, std::vector<int>& DCPred, int& restartCount, Int16* coefficients )
+    {
+        // The blocks of each component in the row
+        Int16* componentCoefficients[3] = { coefficients, nullptr, nullptr };
+        
+        for ( int c = 1; c < COMPONENTS; ++c )
+            componentCoefficients[c] = componentCoefficients[c - 1] + m_components[c - 1].blocksPerLine * m_components[c - 1].VSampFactor * 64;
         
-        for ( unsigned i = 0; i <= m_scanData.size() - 8; i += 8 )
+        // Cb & Cr have a block per MCU, unless the layout's generic
+        const int CHROMA_H = H == 0 ? 0 : 1;
+        const int CHROMA_V = V == 0 ? 0 : 1;
+        
+        for ( int col = 0; col < m_MCUCols; ++col )
         {
-            std::string byte = m_scanData.substr( i, 8 );
+            int i = row * m_MCUCols + col;
             
-            if ( byte == "11111111" )
+            // Each restart interval starts after a RSTn marker, with the DC predictions reset to 0
+            if ( m_restartInterval > 0 && i > 0 && i % m_restartInterval == 0 )
             {
-                if ( i + 8 < m_scanData.size() - 8 )
+                if ( !reader.readRestartMarker( restartCount % 8 ) )
                 {
-                    std::string nextByte = m_scanData.substr( i + 8, 8 );
-                    
-                    if ( nextByte == "00000000" )
-                    {
-                        m_scanData.erase( i + 8, 8 );
-                    }
-                    else continue;
+                    LOG(Logger::Level::ERROR) << "Missing restart marker RST" << restartCount % 8 << " before MCU-" << i + 1 << std::endl;
+                    return false;
                 }
-                else
-                    continue;
+                
+                restartCount++;
+                std::fill( DCPred.begin(), DCPred.end(), 0 );
+            }
+            
+            bool valid = decodeMCUBlocks<H, V>( reader, 0, col, DCPred[0], componentCoefficients[0] );
+            
+            if ( COMPONENTS == 3 )
+            {
+                valid = valid && decodeMCUBlocks<CHROMA_H, CHROMA_V>( reader, 1, col, DCPred[1], componentCoefficients[1] )
+                              && decodeMCUBlocks<CHROMA_H, CHROMA_V>( reader, 2, col, DCPred[2], componentCoefficients[2] );
+            }
+            
+            if ( !valid )
+            {
+                LOG(Logger::Level::ERROR) << "Invalid scan data in MCU-" << i + 1 << std::endl;
+                return false;
             }
         }
         
-        LOG(Logger::Level::DEBUG) << "Finished byte stuffing image scan data [OK]" << std::endl;
+        return true;
     }
     
-    void JPEGDecoder::decodeScanData()
+    template <int HS, int VS>
+    bool JPEGDecoder::decodeMCUBlocks( BitReader& reader, const int c, const int col, int& DCPred, Int16* coefficients )
     {
-        if ( m_scanData.empty() )
+        const DecoderComponent& component = m_components[c];
+        const int hs = HS > 0 ? HS : component.HSampFactor;
+        const int vs = VS > 0 ? VS : component.VSampFactor;
+        
+        for ( int v = 0; v < vs; ++v )
         {
-            LOG(Logger::Level::ERROR) << " [ FATAL ] Invalid image scan data" << std::endl;
-            return;
+            for ( int h = 0; h < hs; ++h )
+            {
+                if ( !decodeBlock( reader, component, DCPred, coefficients + ( v * component.blocksPerLine + col * hs + h ) * 64 ) )
+                    return false;
+            }
         }
         
-        byteStuffScanData();
+        return true;
+    }
+    
+    template <int COMPONENTS, int H, int V>
+    void JPEGDecoder::reconstructMCURow( const int row, const Int16* coefficients, std::vector<Int16>& samples )
+    {
+        const int maxVSampFactor = V > 0 ? V : m_maxVSampFactor;
+        
+        // The samples of each component are a plane of ( 8 * blocksPerLine ) x ( 8 * VSampFactor )
+        std::size_t planeOffsets[3] = {}, size = 0;
         
-        LOG(Logger::Level::DEBUG) << "Decoding image scan data..." << std::endl;
+        for ( int c = 0; c < COMPONENTS; ++c )
+        {
+            planeOffsets[c] = size;
+            size += m_components[c].blocksPerLine * m_components[c].VSampFactor * 64;
+        }
+        
+        samples.resize( size );
         
-        const char* component[] = { "Y (Luminance)", "Cb (Chrominance)", "Cr (Chrominance)" };
-        const char* type[] = { "DC", "AC" };        
+        const Int16* block = coefficients;
         
-        int MCUCount = ( m_image.getWidth() * m_image.getHeight() ) / 64;
+        for ( int c = 0; c < COMPONENTS; ++c )
+        {
+            const DecoderComponent& component = m_components[c];
+            const IDCTTable& table = m_IDCTTables[component.QTableNumber];
+            const int stride = component.blocksPerLine * 8;
+            
+            for ( int v = 0; v < component.VSampFactor; ++v )
+            {
+                for ( int b = 0; b < component.blocksPerLine; ++b, block += 64 )
+                    computeIDCT( block, table, &samples[planeOffsets[c] + v * 8 * stride + b * 8], stride );
+            }
+        }
         
-//         int maxBitLength = m_scanData.size();
+        // The partial MCUs at the bottom edge are cropped
+        const int MCUHeight = 8 * maxVSampFactor;
+        const int height = std::min<int>( MCUHeight, m_image.getHeight() - row * MCUHeight );
         
-        m_MCU.clear();
-        //m_MCU.resize( MCUCount );
-        LOG(Logger::Level::DEBUG) << "MCU count: " << MCUCount << std::endl;
+        const Int16* planes[3] = {};
         
-        int k = 0; // The index of the next bit to be scanned
+        for ( int y = 0; y < height; ++y )
+        {
+            // Subsampled components repeat each of their rows
+            for ( int c = 0; c < COMPONENTS; ++c )
+            {
+                const int sampleRow = V > 0 ? ( c == 0 ? y : y / V ) : y * m_components[c].VSampFactor / maxVSampFactor;
+                planes[c] = &samples[planeOffsets[c] + sampleRow * m_components[c].blocksPerLine * 8];
+            }
+            
+            convertYCbCrToRGB<COMPONENTS, H>( planes, row * MCUHeight + y );
+        }
+    }
+    
+    void JPEGDecoder::computeIDCT( const Int16* coefficients, const IDCTTable& table, Int16* samples, const int stride )
+    {
+        // First pass, down the columns. Only the nonzero coefficients are
+        // dequantized, & each adds its cosine to the 8 samples of its column.
+        float columns[64] = {};
         
-        // TODO: Fix redundancy in this part
-        for ( auto i = 0; i < MCUCount; ++i )
+        for ( int i = 0; i < 64; ++i )
         {
-            LOG(Logger::Level::DEBUG) << "Decoding MCU-" << i + 1 << "..." << std::endl;
+            if ( coefficients[i] == 0 )
+                continue;
             
-            // The run-length coding after decoding the Huffman data
-            std::array<std::vector<int>, 3> RLE;            
+            float value = coefficients[i] * table[i];
+            int u = i / 8, v = i % 8;
             
-            // For each component Y, Cb & Cr, decode 1 DC
-            // coefficient and then decode 63 AC coefficients.
-            //
-            // NOTE:
-            // Since a signnificant portion of a RLE for a
-            // component contains a trail of 0s, AC coefficients
-            // are decoded till, either an EOB (End of block) is
-            // encountered or 63 AC coefficients have been decoded.
+            for ( int y = 0; y < 8; ++y )
+                columns[y * 8 + v] += value * DCT_COSINES[y * 8 + u];
+        }
+        
+        // Second pass, along the rows
+        for ( int y = 0; y < 8; ++y )
+        {
+            const float* row = &columns[y * 8];
             
-            for ( auto compID = 0; compID < 3; ++compID )
+            for ( int x = 0; x < 8; ++x )
             {
-                std::string bitsScanned = ""; // Initially no bits are scanned
+                float sum = 0.0;
                 
-                // Firstly, decode the Y / DC coefficient
-                LOG(Logger::Level::DEBUG) << "Decoding MCU-" << i + 1 << ": " << component[compID] << "/" << type[HT_DC] << std::endl;
-                
-                int HuffTableID = compID == 0 ? 0 : 1;
-                
-                while ( 1 )
-                {       
-                    bitsScanned += m_scanData[k];
-                    auto value = m_huffmanTree[HT_DC][HuffTableID].contains( bitsScanned );
-                    
-                    if ( !isStringWhiteSpace( value ) )
-                    {
-                        if ( value != "EOB" )
-                        {   
-                            int zeroCount = UInt8( std::stoi( value ) ) >> 4 ;
-                            int category = UInt8( std::stoi( value ) ) & 0x0F;
-                            //auto e = m_scanData.substr( k + 1, category );
-                            int DCCoeff = bitStringtoValue( m_scanData.substr( k + 1, category ) );
-                            
-                            //LOG(Logger::Level::DEBUG) << "MCU-" << i + 1 << ": " << component[compID] << "/" << type[HT_DC] << ": ( " << zeroCount << ", " << DCCoeff << " )" << std::endl;
-                            
-                            k += category + 1;
-                            bitsScanned = "";
-                            
-                            RLE[compID].push_back( zeroCount );
-                            RLE[compID].push_back( DCCoeff );
-                            
-                            break;
-                        }
-                        
-                        else
-                        {
-                            //LOG(Logger::Level::DEBUG) << "MCU-" << i + 1 << ": " << component[compID] << "/" << type[HT_DC] << ": EOB encountered" << std::endl;
-                            bitsScanned = "";
-                            k++;
-                            
-                            //RLE.push_back( 0 );
-                            //RLE.push_back( 0 );
-                            
-                            RLE[compID].push_back( 0 );
-                            RLE[compID].push_back( 0 );
-                            
-                            break;
-                        }
-                    }
-                    else
-                        k++;
-                }
-                
-                // Then decode the AC coefficients
-                LOG(Logger::Level::DEBUG) << "Decoding MCU-" << i + 1 << ": " << component[compID] << "/" << type[HT_AC] << std::endl;
-                bitsScanned = "";
-                int ACCodesCount = 0;
-                                
-                while ( 1 )
-                {   
-                    // If 63 AC codes have been encountered, this block is done, move onto next block;
-                    
-                    if ( ACCodesCount  == 63 )
-                    {
-                        break;
-                    }
-                    
-                    // Append the k-th bit to the bits scanned so far
-                    bitsScanned += m_scanData[k];
-                    auto value = m_huffmanTree[HT_AC][HuffTableID].contains( bitsScanned );
-                    
-                    if ( !isStringWhiteSpace( value ) )
-                    {
-                        if ( value != "EOB" )
-                        {
-                            int zeroCount = UInt8( std::stoi( value ) ) >> 4 ;
-                            int category = UInt8( std::stoi( value ) ) & 0x0F;
-                            //auto e = m_scanData.substr( k + 1, category );
-                            int ACCoeff = bitStringtoValue( m_scanData.substr( k + 1, category ) );
-                            
-                            //LOG(Logger::Level::DEBUG) << "AC Code#: " << ACCodesCount + 1 << ", MCU-" << i + 1 << ": " << component[compID] << "/" << type[HT_AC] << ": ( " << zeroCount << ", " << ACCoeff << " )" << std::endl;
-                            
-                            k += category + 1;
-                            bitsScanned = "";
-                            
-                            RLE[compID].push_back( zeroCount );
-                            RLE[compID].push_back( ACCoeff );
-                            
-                            ACCodesCount += zeroCount + 1;
-                        }
-                        
-                        else
-                        {
-                            //LOG(Logger::Level::DEBUG) << "MCU-" << i + 1 << ": " << component[compID] << "/" << type[HT_AC] << ": EOB encountered" << std::endl;
-                            bitsScanned = "";
-                            k++;
-                            
-                            RLE[compID].push_back( 0 );
-                            RLE[compID].push_back( 0 );
-                            
-                            break;
-                        }
-                    }
-                    
-                    else
-                        k++;
-                }
+                for ( int v = 0; v < 8; ++v )
+                    sum += row[v] * DCT_COSINES[x * 8 + v];
                 
-                // If both the DC and AC coefficients are EOB, truncate to (0,0)
-                if ( RLE[compID].size() == 2 )
-                {
-                    bool allZeros = true;
-                    
-                    for ( auto&& rVal : RLE[compID] )
-                    {
-                        if ( rVal != 0 )
-                        {
-                            allZeros = false;
-                            break;
-                        }
-                    }
-                    
-                    // Remove the extra (0,0) pair
-                    if ( allZeros )
-                    {
-                        RLE[compID].pop_back();
-                        RLE[compID].pop_back();
-                    }
-                }
+                // Level shift back to unsigned samples
+                samples[y * stride + x] = clampSample( std::lround( sum ) + 128 );
             }
+        }
+    }
+    
+    template <int COMPONENTS, int H>
+    void JPEGDecoder::convertYCbCrToRGB( const Int16* const planes[3], const int y )
+    {
+        const int width = m_image.getWidth();
+        
+        // The samples are already clamped to 0..255
+        if ( COMPONENTS == 1 )
+        {
+            UInt8* gray = m_image.getGrayRow( y );
+            const int hs = m_components[0].HSampFactor;
             
-//             if ( i == 62 )
-//             {
-//                 for ( auto&& rle : RLE )
-//                 {
-//                     std::string r = "";
-//                     for ( auto a = 0; a <= rle.size() - 2; a += 2 )
-//                     {
-//                         std::stringstream ss;
-//                         ss << "( " << rle[a] << ", " << rle[a + 1] << ") ";
-//                         r += ss.str();
-//                     }
-//                     
-//                     LOG(Logger::Level::DEBUG) << "RLE 6,7: " << r << std::endl;
-//                 }
-//             }
-            
-            // Construct the MCU block from the RLE &
-            // quantization tables to a 8x8 matrix
-            m_MCU.push_back( MCU( RLE, m_QTables ) );
+            for ( int x = 0; x < width; ++x )
+                gray[x] = planes[0][ H > 0 ? x : x * hs / m_maxHSampFactor ];
             
-            LOG(Logger::Level::DEBUG) << "Finished decoding MCU-" << i + 1 << " [OK]" << std::endl;
+            return;
         }
         
-        // The remaining bits, if any, in the scan data are discarded as
-        // they're added byte align the scan data.
+        auto& pixels = (*m_image.getPixelPtr())[y];
+        const int hs[3] = { m_components[0].HSampFactor, m_components[1].HSampFactor, m_components[2].HSampFactor };
         
-        LOG(Logger::Level::DEBUG) << "Finished decoding image scan data [OK]" << std::endl;
+        for ( int x = 0; x < width; ++x )
+        {
+            // Subsampled components repeat each of their samples
+            int Y = planes[0][ H > 0 ? x : x * hs[0] / m_maxHSampFactor ];
+            int Cb = planes[1][ H > 0 ? x / H : x * hs[1] / m_maxHSampFactor ];
+            int Cr = planes[2][ H > 0 ? x / H : x * hs[2] / m_maxHSampFactor ];
+            
+            pixels[x].comp[0] = clampSample( Y + CR_TO_R[Cr] );
+            pixels[x].comp[1] = clampSample( Y + ( ( CB_TO_G[Cb] + CR_TO_G[Cr] ) >> COLOR_FRACTION_BITS ) );
+            pixels[x].comp[2] = clampSample( Y + CB_TO_B[Cb] );
+        }
     }
 }
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
 #include <vector>
 #include <iomanip>
 #include <arpa/inet.h> // htons
@@ -7,17 +9,42 @@
 #include "Encoder.hpp"
 #include "Logger.hpp"
 #include "Markers.hpp"
+#include "ThreadPool.hpp"
 
 namespace kpeg
 {
-    JPEGEncoder::JPEGEncoder()
+    //const std::string ENCODER_COMMENT = "Encoded with libKPEG (https://github.com/TheIllusionistMirage/libKPEG) - Easy to use baseline JPEG library";
+    const std::string ENCODER_COMMENT = "Created with GIMP lal alalala";
+    
+    JPEGEncoder::JPEGEncoder() :
+     m_width{0} ,
+     m_height{0} ,
+     m_rawInput{false} ,
+     m_pixelFormat{PIXEL_FORMAT_RGB} ,
+     m_planes{ nullptr, nullptr, nullptr } ,
+     m_strides{ 0, 0, 0 } ,
+     m_coefficientInput{false} ,
+     m_requantize{false} ,
+     m_componentCount{3} ,
+     m_grayscale{false} ,
+     m_subsampling{SUBSAMPLING_444} ,
+     m_MCUCols{0} ,
+     m_MCURows{0} ,
+     m_quality{50} ,
+     m_targetSize{0} ,
+     m_optimizeHuffmanTables{false} ,
+     m_restartInterval{0} ,
+     m_threadCount{0}
     {
+        setStandardHuffmanTables();
+        
         LOG(Logger::Level::INFO) << "Created \'JPEGEncoder object\'." << std::endl;
     }
-            
-    JPEGEncoder::JPEGEncoder( const std::string& filename )
+    
+    JPEGEncoder::JPEGEncoder( const std::string& filename ) :
+     JPEGEncoder()
     {
-        LOG(Logger::Level::INFO) << "Created \'JPEGEncoder object\'." << std::endl;
+        open( filename );
     }
     
     JPEGEncoder::~JPEGEncoder()
@@ -38,20 +65,314 @@ namespace kpeg
         
         LOG(Logger::Level::DEBUG) << "Read input PPM file [OK] \'" + filename + "\'" << std::endl;
         m_filename = filename;
+        m_width = m_image.getWidth();
+        m_height = m_image.getHeight();
+        m_rawInput = false;
+        m_coefficientInput = false;
+        
+        return true;
+    }
+    
+    bool JPEGEncoder::open( const UInt8* pixels,
+                            const int width,
+                            const int height,
+                            const std::size_t stride,
+                            const PixelFormat format )
+    {
+        std::size_t bytesPerPixel = 0;
+        
+        switch ( format )
+        {
+            case PIXEL_FORMAT_RGB  : bytesPerPixel = 3; break;
+            case PIXEL_FORMAT_RGBA : bytesPerPixel = 4; break;
+            case PIXEL_FORMAT_BGR  : bytesPerPixel = 3; break;
+            case PIXEL_FORMAT_GRAY : bytesPerPixel = 1; break;
+            
+            default:
+            {
+                LOG(Logger::Level::ERROR) << "Planar pixel formats need one buffer per component" << std::endl;
+                return false;
+            }
+        }
+        
+        if ( pixels == nullptr || width <= 0 || height <= 0 || width > 0xFFFF || height > 0xFFFF )
+        {
+            LOG(Logger::Level::ERROR) << "Invalid input pixel buffer or dimensions: " << width << "x" << height << std::endl;
+            return false;
+        }
+        
+        if ( stride < width * bytesPerPixel )
+        {
+            LOG(Logger::Level::ERROR) << "Input row stride (" << stride << " bytes) is smaller than a row of pixels" << std::endl;
+            return false;
+        }
+        
+        m_rawInput = true;
+        m_coefficientInput = false;
+        m_pixelFormat = format;
+        m_width = width;
+        m_height = height;
+        m_planes[0] = pixels;
+        m_strides[0] = stride;
+        m_planes[1] = m_planes[2] = nullptr;
+        m_strides[1] = m_strides[2] = 0;
+        
+        LOG(Logger::Level::DEBUG) << "Using input pixel buffer [OK] " << width << "x" << height << std::endl;
+        
+        return true;
+    }
+    
+    bool JPEGEncoder::open( const UInt8* const planes[3],
+                            const std::size_t strides[3],
+                            const int width,
+                            const int height,
+                            const PixelFormat format )
+    {
+        if ( format != PIXEL_FORMAT_YUV444P && format != PIXEL_FORMAT_YUV422P && format != PIXEL_FORMAT_YUV420P )
+        {
+            LOG(Logger::Level::ERROR) << "Interleaved pixel formats use a single pixel buffer" << std::endl;
+            return false;
+        }
+        
+        if ( width <= 0 || height <= 0 || width > 0xFFFF || height > 0xFFFF )
+        {
+            LOG(Logger::Level::ERROR) << "Invalid input dimensions: " << width << "x" << height << std::endl;
+            return false;
+        }
+        
+        int chromaWidth = format == PIXEL_FORMAT_YUV444P ? width : ( width + 1 ) / 2;
+        
+        for ( int c = 0; c < 3; ++c )
+        {
+            if ( planes[c] == nullptr || strides[c] < std::size_t( c == 0 ? width : chromaWidth ) )
+            {
+                LOG(Logger::Level::ERROR) << "Invalid input plane #" << c << " or row stride" << std::endl;
+                return false;
+            }
+            
+            m_planes[c] = planes[c];
+            m_strides[c] = strides[c];
+        }
+        
+        m_rawInput = true;
+        m_coefficientInput = false;
+        m_pixelFormat = format;
+        m_width = width;
+        m_height = height;
+        
+        LOG(Logger::Level::DEBUG) << "Using input Y-Cb-Cr planes [OK] " << width << "x" << height << std::endl;
+        
+        return true;
+    }
+    
+    bool JPEGEncoder::open( const JPEGCoefficients& coefficients )
+    {
+        const auto& components = coefficients.components;
+        
+        const int componentCount = components.size();
+        
+        if ( ( componentCount != 1 && componentCount != 3 ) || coefficients.width <= 0 || coefficients.height <= 0 ||
+             coefficients.width > 0xFFFF || coefficients.height > 0xFFFF )
+        {
+            LOG(Logger::Level::ERROR) << "Invalid coefficients, only 1 (grayscale) or 3 component (Y-Cb-Cr) images can be encoded" << std::endl;
+            return false;
+        }
+        
+        const CoefficientComponent& Y = components[YCbCrComponents::Y];
+        
+        // The chroma is never subsampled more than 2:1, in either direction,
+        // and a single component is coded one block at a time
+        if ( Y.HSampFactor < 1 || Y.HSampFactor > 2 || Y.VSampFactor < 1 || Y.VSampFactor > 2 ||
+             ( componentCount == 1 && ( Y.HSampFactor != 1 || Y.VSampFactor != 1 ) ) )
+        {
+            LOG(Logger::Level::ERROR) << "Unsupported luma sampling factors: " << Y.HSampFactor << "x" << Y.VSampFactor << std::endl;
+            return false;
+        }
+        
+        if ( componentCount == 3 && components[1].QTableNumber != components[2].QTableNumber )
+        {
+            LOG(Logger::Level::ERROR) << "The chroma components must share a quantization table" << std::endl;
+            return false;
+        }
+        
+        int MCUCols = ( coefficients.width + 8 * Y.HSampFactor - 1 ) / ( 8 * Y.HSampFactor );
+        int MCURows = ( coefficients.height + 8 * Y.VSampFactor - 1 ) / ( 8 * Y.VSampFactor );
+        
+        for ( int c = 0; c < componentCount; ++c )
+        {
+            const CoefficientComponent& component = components[c];
+            
+            if ( ( c != YCbCrComponents::Y && ( component.HSampFactor != 1 || component.VSampFactor != 1 ) ) ||
+                 component.blocksPerLine != MCUCols * component.HSampFactor ||
+                 component.blocksPerColumn != MCURows * component.VSampFactor ||
+                 component.coefficients.size() != std::size_t( component.blocksPerLine * component.blocksPerColumn * 64 ) ||
+                 component.QTableNumber < 0 || component.QTableNumber > 3 )
+            {
+                LOG(Logger::Level::ERROR) << "Invalid block layout for coefficient component #" << c << std::endl;
+                return false;
+            }
+        }
+        
+        // Baseline JPEG needs 8-bit quantization steps and coefficients that fit
+        // the Huffman coded categories (up to 10 bits for AC, 11 for DC differences)
+        m_QTables.clear();
+        
+        for ( int c = 0; c < std::min( componentCount, 2 ); ++c )
+        {
+            const int t = components[c].QTableNumber;
+            const QuantizationTable& QTable = coefficients.QTables[t];
+            
+            if ( *std::min_element( QTable.begin(), QTable.end() ) < 1 || *std::max_element( QTable.begin(), QTable.end() ) > 255 )
+            {
+                LOG(Logger::Level::ERROR) << "Quantization table #" << t << " isn't a valid 8-bit table" << std::endl;
+                return false;
+            }
+            
+            m_QTables.emplace_back( QTable.begin(), QTable.end() );
+        }
+        
+        for ( int c = 0; c < componentCount; ++c )
+        {
+            const CoefficientComponent& source = components[c];
+            EncoderComponent& component = m_components[c];
+            
+            component.HSampFactor = source.HSampFactor;
+            component.VSampFactor = source.VSampFactor;
+            component.width = source.blocksPerLine * 8;
+            component.height = source.blocksPerColumn * 8;
+            component.data.resize( component.width * component.height );
+            component.DCTCoefficients.clear();
+            
+            for ( int by = 0; by < source.blocksPerColumn; ++by )
+            {
+                for ( int bx = 0; bx < source.blocksPerLine; ++bx )
+                {
+                    const Int16* block = source.getBlock( by, bx );
+                    
+                    if ( block[0] < -1024 || block[0] > 1023 ||
+                         std::any_of( block + 1, block + 64, []( const Int16 value ) { return value < -1023 || value > 1023; } ) )
+                    {
+                        LOG(Logger::Level::ERROR) << "Coefficient out of range in component #" << c << std::endl;
+                        return false;
+                    }
+                    
+                    for ( int v = 0; v < 8; ++v )
+                        for ( int u = 0; u < 8; ++u )
+                            component.data[( by * 8 + v ) * component.width + bx * 8 + u] = block[v * 8 + u];
+                }
+            }
+        }
+        
+        m_width = coefficients.width;
+        m_height = coefficients.height;
+        m_MCUCols = MCUCols;
+        m_MCURows = MCURows;
+        m_componentCount = componentCount;
+        m_rawInput = false;
+        m_coefficientInput = true;
+        m_requantize = false;
+        
+        LOG(Logger::Level::DEBUG) << "Using input DCT coefficients [OK] " << m_width << "x" << m_height << std::endl;
+        
+        return true;
+    }
+    
+    bool JPEGEncoder::open( const JPEGCoefficients& coefficients, const int quality )
+    {
+        if ( !open( coefficients ) )
+            return false;
+        
+        // Same as the output of computeDCT(), for quantize() to work on
+        for ( int c = 0; c < m_componentCount; ++c )
+        {
+            EncoderComponent& component = m_components[c];
+            const std::vector<UInt16>& QTable = m_QTables[ c == YCbCrComponents::Y ? 0 : 1 ];
+            
+            component.DCTCoefficients.resize( component.data.size() );
+            
+            for ( int y = 0; y < component.height; ++y )
+            {
+                for ( int x = 0; x < component.width; ++x )
+                {
+                    int index = y * component.width + x;
+                    component.DCTCoefficients[index] = component.data[index] * QTable[( y % 8 ) * 8 + x % 8];
+                }
+            }
+        }
+        
+        m_sourceQTables = m_QTables;
+        m_requantize = true;
+        setQuality( quality );
+        
+        LOG(Logger::Level::DEBUG) << "Requantizing input DCT coefficients with quality " << m_quality << " [OK]" << std::endl;
         
         return true;
     }
     
-    bool JPEGEncoder::encodeImage()
+    void JPEGEncoder::setStandardHuffmanTables()
+    {
+        m_huffmanTables[HT_DC][HT_Y]    = makeHuffmanTable( DC_LUMA_HUFF_BITS.data(), DC_LUMA_HUFF_VALS.data() );
+        m_huffmanTables[HT_DC][HT_CbCr] = makeHuffmanTable( DC_CHROMA_HUFF_BITS.data(), DC_CHROMA_HUFF_VALS.data() );
+        m_huffmanTables[HT_AC][HT_Y]    = makeHuffmanTable( AC_LUMA_HUFF_BITS.data(), AC_LUMA_HUFF_VALS.data() );
+        m_huffmanTables[HT_AC][HT_CbCr] = makeHuffmanTable( AC_CHROMA_HUFF_BITS.data(), AC_CHROMA_HUFF_VALS.data() );
+        
+        for ( auto type : { HT_DC, HT_AC } )
+            for ( auto id : { HT_Y, HT_CbCr } )
+                m_huffmanCodes[type][id] = generateHuffmanCodes( m_huffmanTables[type][id] );
+    }
+    
+    bool JPEGEncoder::encodeImage( OutputSink& sink )
     {
-        LOG(Logger::Level::INFO) << "Encoding PPM image to JPEG..." << std::endl;
+        LOG(Logger::Level::INFO) << "Encoding image to JPEG..." << std::endl;
+        
+        if ( m_width <= 0 || m_height <= 0 )
+        {
+            LOG(Logger::Level::ERROR) << "No input image to encode" << std::endl;
+            return false;
+        }
+        
+        // The tables optimized for the previous image don't fit this one
+        setStandardHuffmanTables();
+        
+        if ( m_coefficientInput )
+        {
+            if ( m_requantize )
+            {
+                if ( m_targetSize > 0 )
+                    return encodeWithinTargetSize( sink, searchQuality() );
+                
+                generateQuantizationTables( m_quality );
+                quantize();
+            }
+            // Otherwise the components already hold the quantized coefficients
+            else if ( m_targetSize > 0 )
+            {
+                LOG(Logger::Level::INFO) << "Target size ignored, the coefficients are encoded as is" << std::endl;
+            }
+        }
+        else
+        {
+            setupComponents();
+            
+            if ( m_rawInput && m_planes[1] != nullptr )
+                copyPlanarComponents();
+            else
+                transformColorspace();
+            
+            levelShiftComponents();
+            computeDCT();
+            
+            if ( m_targetSize > 0 )
+                return encodeWithinTargetSize( sink, searchQuality() );
+            
+            generateQuantizationTables( m_quality );
+            quantize();
+        }
         
-        transformColorspace();
-        levelShiftComponents();
-        computeDCT();
-        quantize();
+        if ( m_optimizeHuffmanTables )
+            optimizeHuffmanTables();
         
-        if ( !saveToJFIFFile() )
+        if ( !writeJFIF( sink ) )
         {
             LOG(Logger::Level::ERROR) << "Encoding incomplete [NOT-OK]" << std::endl;
             return false;
@@ -61,28 +382,108 @@ namespace kpeg
         return true;
     }
     
-    bool JPEGEncoder::saveToJFIFFile()
+    bool JPEGEncoder::encodeImage( const std::string& filename )
     {
-        std::string destFile = "output.jpg";
+        // The file is only created once the image is encoded, so a failed
+        // encode doesn't leave an empty file (or truncate an existing one)
+        MemorySink encoded;
         
-        LOG(Logger::Level::INFO) << "Converting & writing JPEG image data to JFIF file: " + destFile + " ..." << std::endl;
+        if ( !encodeImage( encoded ) )
+            return false;
+        
+        FileSink sink( filename );
+        
+        if ( !sink.isOpen() )
+        {
+            LOG(Logger::Level::ERROR) << "Unable to create destination JFIF file: " << filename << std::endl;
+            return false;
+        }
         
-        m_outputJPEG.open( destFile, std::ios::out | std::ios::binary );
+        LOG(Logger::Level::DEBUG) << "Writing JFIF file: \'" + filename + "\'" << std::endl;
         
-        if ( !m_outputJPEG.good() || !m_outputJPEG.is_open() )
+        if ( !sink.write( encoded.getBuffer().data(), encoded.getBuffer().size() ) || !sink.flush() )
         {
-            LOG(Logger::Level::ERROR) << "Unable to create destination JFIF file: " << destFile << std::endl;
+            LOG(Logger::Level::ERROR) << "Unable to write the JFIF file: " << filename << std::endl;
+            std::remove( filename.c_str() );
             return false;
         }
         
+        return true;
+    }
+    
+    bool JPEGEncoder::encodeImage( std::vector<UInt8>& buffer )
+    {
+        MemorySink sink;
+        
+        if ( !encodeImage( sink ) )
+            return false;
+        
+        buffer = sink.releaseBuffer();
+        return true;
+    }
+    
+    bool JPEGEncoder::encodeImage( UInt8* buffer, const std::size_t capacity, std::size_t& size )
+    {
+        FixedBufferSink sink( buffer, capacity );
+        
+        bool success = encodeImage( sink );
+        size = sink.getSize();
+        
+        return success;
+    }
+    
+    void JPEGEncoder::setRestartInterval( const UInt16 interval )
+    {
+        m_restartInterval = interval;
+    }
+    
+    void JPEGEncoder::setThreadCount( const std::size_t count )
+    {
+        if ( count != m_threadCount )
+            m_threadPool.reset();
+        
+        m_threadCount = count;
+    }
+    
+    void JPEGEncoder::setOptimizeHuffmanTables( const bool optimize )
+    {
+        m_optimizeHuffmanTables = optimize;
+    }
+    
+    void JPEGEncoder::setQuality( const int quality )
+    {
+        m_quality = std::max( 1, std::min( quality, 100 ) );
+    }
+    
+    void JPEGEncoder::setTargetSize( const std::size_t bytes )
+    {
+        m_targetSize = bytes;
+    }
+    
+    void JPEGEncoder::setChromaSubsampling( const ChromaSubsampling subsampling )
+    {
+        m_subsampling = subsampling;
+    }
+    
+    void JPEGEncoder::setGrayscale( const bool grayscale )
+    {
+        m_grayscale = grayscale;
+    }
+    
+    bool JPEGEncoder::writeJFIF( OutputSink& sink )
+    {
+        LOG(Logger::Level::INFO) << "Converting & writing JPEG image data to JFIF..." << std::endl;
+        
         // NOTE: For a detailed description of the markers, see file `Markers.hpp`
         
-        m_outputJPEG.unsetf( std::ios::skipws );
+        // The headers are assembled in memory and handed to the sink in one write
+        std::vector<UInt8> header;
+        header.reserve( 1024 );
         
         ////////////////////////////////////
         // Write start marker
         ////////////////////////////////////
-        m_outputJPEG << JFIF_BYTE_FF << JFIF_SOI;
+        writeMarker( header, JFIF_SOI );
         
         
         ////////////////////////////////////
@@ -90,30 +491,31 @@ namespace kpeg
         ////////////////////////////////////
         
         // Write marker length identifier
-        m_outputJPEG << JFIF_BYTE_FF << JFIF_APP0;
+        writeMarker( header, JFIF_APP0 );
         
         // Write segment length
-        m_outputJPEG << (UInt8)0x00 << (UInt8)0x10; // 16 bytes
+        writeWord( header, 0x0010 ); // 16 bytes
         
         // Write file identifier mask
-        m_outputJPEG << (UInt8)0x4A << (UInt8)0x46 << (UInt8)0x49 << (UInt8)0x46 << (UInt8)0x00; // 'J', 'F', 'I', 'F', '\0'
+        header.insert( header.end(), { 0x4A, 0x46, 0x49, 0x46, 0x00 } ); // 'J', 'F', 'I', 'F', '\0'
         
         // Write major & minor version numbers
         // We set version to 1.01
-        m_outputJPEG << (UInt8)0x01;
-        m_outputJPEG << (UInt8)0x01;
+        header.push_back( 0x01 );
+        header.push_back( 0x01 );
         
         // Write desnity units
-        m_outputJPEG << (UInt8)0x01; // We use DPI for denoting pixel density
+        header.push_back( 0x01 ); // We use DPI for denoting pixel density
         
         // Write the X & Y densities
         // We set a DPI of 72 in both X & Y directions
-        m_outputJPEG << (UInt8)0x00 << (UInt8)0x48;
-        m_outputJPEG << (UInt8)0x00 << (UInt8)0x48;
+        writeWord( header, 0x0048 );
+        writeWord( header, 0x0048 );
         
         // Write the thumbnail width & height
         // We don't encode the thumbnail data
-        m_outputJPEG << (UInt8)0x00 << (UInt8)0x00;
+        header.push_back( 0x00 );
+        header.push_back( 0x00 );
         
         
         ////////////////////////////////////
@@ -121,67 +523,40 @@ namespace kpeg
         ////////////////////////////////////
         
         // Write the comment marker
-        m_outputJPEG << JFIF_BYTE_FF << JFIF_COM;
+        writeMarker( header, JFIF_COM );
         
-        //std::string comment = "Encoded with libKPEG (https://github.com/TheIllusionistMirage/libKPEG) - Easy to use baseline JPEG library";
-        std::string comment = "Created with GIMP lal alalala";
+        const std::string& comment = ENCODER_COMMENT;
         
         // Write the length of the comment segment
         // NOTE: The length includes the two bytes that denote the length
-        m_outputJPEG << (UInt8)( (UInt8)( ( comment.length()+2 ) >> 8 ) & (UInt8)0xFF00 ); // the first 8 MSBs
-        m_outputJPEG << (UInt8)( (UInt8)( comment.length()+2 ) & (UInt8)0x00FF ); // the next 8 LSBs
-                
+        writeWord( header, comment.length() + 2 );
+        
         // Write the comment (only ASCII characters allowed)
-        m_outputJPEG << comment;
+        header.insert( header.end(), comment.begin(), comment.end() );
         
         ////////////////////////////////////
         // Write Quantization Tables
         ////////////////////////////////////
         
-        /*
-         * Quantization table for luminance (Y) 
-         */
-        
-        // Write DQT marker
-        m_outputJPEG << JFIF_BYTE_FF << JFIF_DQT;
-        
-        // Write the length of the DQT segment
-        // NOTE: The length includes the two bytes that denote the length
-        m_outputJPEG << (UInt8)0x00 << (UInt8)0x43;
-        
-        // Write quantization table info
-        // NOTE: Bits 7-4 denote QT#, bits 3-0 denote QT precision
-        // libKPEG supports only 8-bit JPEG images, so bits 7-4 are 0
-        m_outputJPEG << (UInt8)0x00;
-        
-        // Write the 64 entries of the QT in zig-zag order
-        for ( int i = 0; i < 64; ++i )
-        {
-            auto index = zzOrderToMatIndices( i );
-            m_outputJPEG << (UInt8)M_QT_MAT_LUMA[index.first][index.second];
-        }
-        
-        /**
-         * Quantization table for chrominance (Cb & Cr)
-         */
-        
-        // Write DQT marker
-        m_outputJPEG << JFIF_BYTE_FF << JFIF_DQT;
+        // Luminance (Y) uses table #0, chrominance (Cb & Cr) table #1
+        const int tableCount = m_componentCount == 1 ? 1 : 2;
         
-        // Write the length of the DQT segment
-        // NOTE: The length includes the two bytes that denote the length
-        m_outputJPEG << (UInt8)0x00 << (UInt8)0x43;
-        
-        // Write quantization table info
-        // NOTE: Bits 7-4 denote QT#, bits 3-0 denote QT precision
-        // libKPEG supports only 8-bit JPEG images, so bits 7-4 are 0
-        m_outputJPEG << (UInt8)0x01;
-        
-        // Write the 64 entries of the QT in zig-zag order
-        for ( int i = 0; i < 64; ++i )
+        for ( int id = 0; id < tableCount; ++id )
         {
-            auto index = zzOrderToMatIndices( i );
-            m_outputJPEG << (UInt8)M_QT_MAT_CHROMA[index.first][index.second];
+            // Write DQT marker
+            writeMarker( header, JFIF_DQT );
+            
+            // Write the length of the DQT segment
+            // NOTE: The length includes the two bytes that denote the length
+            writeWord( header, 0x0043 );
+            
+            // Write quantization table info
+            // NOTE: Bits 7-4 denote QT precision (0 = 8-bit), bits 3-0 denote QT#
+            header.push_back( id );
+            
+            // Write the 64 entries of the QT in zig-zag order
+            for ( int i = 0; i < 64; ++i )
+                header.push_back( m_QTables[id][ NATURAL_ORDER[i] ] );
         }
         
         
@@ -190,580 +565,843 @@ namespace kpeg
         ////////////////////////////////////
         
         // Write SOF-0 marker identifier
-        m_outputJPEG << JFIF_BYTE_FF << JFIF_SOF0;
+        writeMarker( header, JFIF_SOF0 );
         
         // Write SOF-0 segment length
-        m_outputJPEG << (UInt8)0x00 << (UInt8)0x11; // 8 + 3 * 3
+        writeWord( header, 8 + 3 * m_componentCount );
         
         // Write data precision
-        m_outputJPEG << (UInt8)0x08;
+        header.push_back( 0x08 );
         
         // Write image dimensions
-        
-        // Height
-        m_outputJPEG << (UInt8)( (UInt8)( m_image.getHeight() >> 8 ) & (UInt8)0xFF00 ); // the first 8 MSBs
-        m_outputJPEG << (UInt8)( (UInt8)m_image.getHeight() & (UInt8)0x00FF ); // the next 8 LSBs
-        
-        // Width
-        m_outputJPEG << (UInt8)( (UInt8)( m_image.getWidth() >> 8 ) & (UInt8)0xFF00 ); // the first 8 MSBs
-        m_outputJPEG << (UInt8)( (UInt8)m_image.getWidth() & (UInt8)0x00FF ); // the next 8 LSBs
+        writeWord( header, m_height );
+        writeWord( header, m_width );
         
         // Write the number of components
-        // NOTE: For now, libKPEG doesn't actually remove the chroma components; they're just set to all 0s
-        m_outputJPEG << (UInt8)0x03;
+        header.push_back( m_componentCount );
         
         // Write component info for each of the components (each component takes 3 bytes)
+        for ( int c = 0; c < m_componentCount; ++c )
+        {
+            const EncoderComponent& component = m_components[c];
+            
+            header.push_back( c + 1 ); // Component ID (Y=1, Cb=2, Cr=3)
+            header.push_back( ( component.HSampFactor << 4 ) | component.VSampFactor ); // Sampling factors (Bits 7-4: Horizontal, Bits 3-0: Vertical)
+            header.push_back( c == YCbCrComponents::Y ? 0x00 : 0x01 ); // Quantization table #
+        }
         
-        // Luminance (Y)
-        m_outputJPEG << (UInt8)0x01; // Component ID (Y=1, Cb=2, Cr=3)
-        m_outputJPEG << (UInt8)0x11; // Sampling factors (Bits 7-4: Horizontal, Bits 3-0: Vertical)
-        m_outputJPEG << (UInt8)0x00; // Quantization table #
+        ////////////////////////////////////
+        // Write DHT segments
+        ////////////////////////////////////
         
-        // Chrominance (Cb)
-        m_outputJPEG << (UInt8)0x02; // Component ID (Y=1, Cb=2, Cr=3)
-        m_outputJPEG << (UInt8)0x11; // Sampling factors (Bits 7-4: Horizontal, Bits 3-0: Vertical)
-        m_outputJPEG << (UInt8)0x01; // Quantization table #
+        writeHuffmanTable( header, HT_DC, HT_Y );    // Luminance, DC HT
+        writeHuffmanTable( header, HT_AC, HT_Y );    // Luminance, AC HT
         
-        // Chrominance (Cr)
-        m_outputJPEG << (UInt8)0x03; // Component ID (Y=1, Cb=2, Cr=3)
-        m_outputJPEG << (UInt8)0x11; // Sampling factors (Bits 7-4: Horizontal, Bits 3-0: Vertical)
-        m_outputJPEG << (UInt8)0x01; // Quantization table #
+        if ( m_componentCount == 3 )
+        {
+            writeHuffmanTable( header, HT_DC, HT_CbCr ); // Chrominance, DC HT
+            writeHuffmanTable( header, HT_AC, HT_CbCr ); // Chrominance, AC HT
+        }
         
         ////////////////////////////////////
-        // Write DHT segments
+        // Write the restart interval segment
         ////////////////////////////////////
-        
-        // Luminance, DC HT
-        m_outputJPEG << JFIF_BYTE_FF << JFIF_DHT;
-        m_outputJPEG << (UInt8)0x00 << (UInt8)0x1F; // DHT segment length (including the length bytes)
-        // The symbol count for each symbol from 1-bit length to 16-bit length
-        m_outputJPEG << (UInt8)0x00 << (UInt8)0x00 << (UInt8)0x01 << (UInt8)0x05 << (UInt8)0x01
-                     << (UInt8)0x01 << (UInt8)0x01 << (UInt8)0x01 << (UInt8)0x01 << (UInt8)0x01
-                     << (UInt8)0x00 << (UInt8)0x00 << (UInt8)0x00 << (UInt8)0x00 << (UInt8)0x00
-                     << (UInt8)0x00 << (UInt8)0x00 << (UInt8)0x00 << (UInt8)0x01 << (UInt8)0x02
-                     << (UInt8)0x03 << (UInt8)0x04 << (UInt8)0x05 << (UInt8)0x06 << (UInt8)0x07
-                     << (UInt8)0x08 << (UInt8)0x09 << (UInt8)0x0A << (UInt8)0x0B;
-        
-        // Luminance, AC HT
-        m_outputJPEG << JFIF_BYTE_FF << JFIF_DHT;
-        m_outputJPEG << (UInt8)0x00 << (UInt8)0xB5; // DHT segment length (including the length bytes)
-        m_outputJPEG << (UInt8)0x10 << (UInt8)0x00 << (UInt8)0x02 << (UInt8)0x01 << (UInt8)0x03
-                     << (UInt8)0x03 << (UInt8)0x02 << (UInt8)0x04 << (UInt8)0x03 << (UInt8)0x05
-                     << (UInt8)0x05 << (UInt8)0x04 << (UInt8)0x04 << (UInt8)0x00 << (UInt8)0x00
-                     << (UInt8)0x01 << (UInt8)0x7D << (UInt8)0x01 << (UInt8)0x02 << (UInt8)0x03
-                     << (UInt8)0x00 << (UInt8)0x04 << (UInt8)0x11 << (UInt8)0x05 << (UInt8)0x12
-                     << (UInt8)0x21 << (UInt8)0x31 << (UInt8)0x41 << (UInt8)0x06 << (UInt8)0x13
-                     << (UInt8)0x51 << (UInt8)0x61 << (UInt8)0x07 << (UInt8)0x22 << (UInt8)0x71
-                     << (UInt8)0x14 << (UInt8)0x32 << (UInt8)0x81 << (UInt8)0x91 << (UInt8)0xA1
-                     << (UInt8)0x08 << (UInt8)0x23 << (UInt8)0x42 << (UInt8)0xB1 << (UInt8)0xC1
-                     << (UInt8)0x15 << (UInt8)0x52 << (UInt8)0xD1 << (UInt8)0xF0 << (UInt8)0x24
-                     << (UInt8)0x33 << (UInt8)0x62 << (UInt8)0x72 << (UInt8)0x82 << (UInt8)0x09
-                     << (UInt8)0x0A << (UInt8)0x16 << (UInt8)0x17 << (UInt8)0x18 << (UInt8)0x19
-                     << (UInt8)0x1A << (UInt8)0x25 << (UInt8)0x26 << (UInt8)0x27 << (UInt8)0x28
-                     << (UInt8)0x29 << (UInt8)0x2A << (UInt8)0x34 << (UInt8)0x35 << (UInt8)0x36
-                     << (UInt8)0x37 << (UInt8)0x38 << (UInt8)0x39 << (UInt8)0x3A << (UInt8)0x43
-                     << (UInt8)0x44 << (UInt8)0x45 << (UInt8)0x46 << (UInt8)0x47 << (UInt8)0x48
-                     << (UInt8)0x49 << (UInt8)0x4A << (UInt8)0x53 << (UInt8)0x54 << (UInt8)0x55
-                     << (UInt8)0x56 << (UInt8)0x57 << (UInt8)0x58 << (UInt8)0x59 << (UInt8)0x5A
-                     << (UInt8)0x63 << (UInt8)0x64 << (UInt8)0x65 << (UInt8)0x66 << (UInt8)0x67
-                     << (UInt8)0x68 << (UInt8)0x69 << (UInt8)0x6A << (UInt8)0x73 << (UInt8)0x74
-                     << (UInt8)0x75 << (UInt8)0x76 << (UInt8)0x77 << (UInt8)0x78 << (UInt8)0x79
-                     << (UInt8)0x7A << (UInt8)0x83 << (UInt8)0x84 << (UInt8)0x85 << (UInt8)0x86
-                     << (UInt8)0x87 << (UInt8)0x88 << (UInt8)0x89 << (UInt8)0x8A << (UInt8)0x92 << (UInt8)0x93
-                     << (UInt8)0x94 << (UInt8)0x95 << (UInt8)0x96 << (UInt8)0x97 << (UInt8)0x98
-                     << (UInt8)0x99 << (UInt8)0x9A << (UInt8)0xA2 << (UInt8)0xA3 << (UInt8)0xA4
-                     << (UInt8)0xA5 << (UInt8)0xA6 << (UInt8)0xA7 << (UInt8)0xA8 << (UInt8)0xA9
-                     << (UInt8)0xAA << (UInt8)0xB2 << (UInt8)0xB3 << (UInt8)0xB4 << (UInt8)0xB5
-                     << (UInt8)0xB6 << (UInt8)0xB7 << (UInt8)0xB8 << (UInt8)0xB9 << (UInt8)0xBA
-                     << (UInt8)0xC2 << (UInt8)0xC3 << (UInt8)0xC4 << (UInt8)0xC5 << (UInt8)0xC6
-                     << (UInt8)0xC7 << (UInt8)0xC8 << (UInt8)0xC9 << (UInt8)0xCA << (UInt8)0xD2
-                     << (UInt8)0xD3 << (UInt8)0xD4 << (UInt8)0xD5 << (UInt8)0xD6 << (UInt8)0xD7
-                     << (UInt8)0xD8 << (UInt8)0xD9 << (UInt8)0xDA << (UInt8)0xE1 << (UInt8)0xE2
-                     << (UInt8)0xE3 << (UInt8)0xE4 << (UInt8)0xE5 << (UInt8)0xE6 << (UInt8)0xE7
-                     << (UInt8)0xE8 << (UInt8)0xE9 << (UInt8)0xEA << (UInt8)0xF1 << (UInt8)0xF2
-                     << (UInt8)0xF3 << (UInt8)0xF4 << (UInt8)0xF5 << (UInt8)0xF6 << (UInt8)0xF7
-                     << (UInt8)0xF8 << (UInt8)0xF9 << (UInt8)0xFA;
-        
-        // Chrominance, DC HT
-        m_outputJPEG << JFIF_BYTE_FF << JFIF_DHT;
-        m_outputJPEG << (UInt8)0x00 << (UInt8)0x1F;
-        m_outputJPEG << (UInt8)0x01 << (UInt8)0x00 << (UInt8)0x03 << (UInt8)0x01 << (UInt8)0x01
-                     << (UInt8)0x01 << (UInt8)0x01 << (UInt8)0x01 << (UInt8)0x01 << (UInt8)0x01
-                     << (UInt8)0x01 << (UInt8)0x01 << (UInt8)0x00 << (UInt8)0x00 << (UInt8)0x00
-                     << (UInt8)0x00 << (UInt8)0x00 << (UInt8)0x00 << (UInt8)0x01 << (UInt8)0x02
-                     << (UInt8)0x03 << (UInt8)0x04 << (UInt8)0x05 << (UInt8)0x06 << (UInt8)0x07
-                     << (UInt8)0x08 << (UInt8)0x09 << (UInt8)0x0A << (UInt8)0x0B;
-        
-        // Chrominance, AC HT
-        m_outputJPEG << JFIF_BYTE_FF << JFIF_DHT;
-        m_outputJPEG << (UInt8)0x00 << (UInt8)0xB5; // DHT segment length (including the length bytes)
-        m_outputJPEG << (UInt8)0x11 << (UInt8)0x00 << (UInt8)0x02 << (UInt8)0x01 << (UInt8)0x02
-                     << (UInt8)0x04 << (UInt8)0x04 << (UInt8)0x03 << (UInt8)0x04 << (UInt8)0x07
-                     << (UInt8)0x05 << (UInt8)0x04 << (UInt8)0x04 << (UInt8)0x00 << (UInt8)0x01
-                     << (UInt8)0x02 << (UInt8)0x77 << (UInt8)0x00 << (UInt8)0x01 << (UInt8)0x02
-                     << (UInt8)0x03 << (UInt8)0x11 << (UInt8)0x04 << (UInt8)0x05 << (UInt8)0x21
-                     << (UInt8)0x31 << (UInt8)0x06 << (UInt8)0x12 << (UInt8)0x41 << (UInt8)0x51
-                     << (UInt8)0x07 << (UInt8)0x61 << (UInt8)0x71 << (UInt8)0x13 << (UInt8)0x22
-                     << (UInt8)0x32 << (UInt8)0x81 << (UInt8)0x08 << (UInt8)0x14 << (UInt8)0x42
-                     << (UInt8)0x91 << (UInt8)0xA1 << (UInt8)0xB1 << (UInt8)0xC1 << (UInt8)0x09
-                     << (UInt8)0x23 << (UInt8)0x33 << (UInt8)0x52 << (UInt8)0xF0 << (UInt8)0x15
-                     << (UInt8)0x62 << (UInt8)0x72 << (UInt8)0xD1 << (UInt8)0x0A << (UInt8)0x16
-                     << (UInt8)0x24 << (UInt8)0x34 << (UInt8)0xE1 << (UInt8)0x25 << (UInt8)0xF1
-                     << (UInt8)0x17 << (UInt8)0x18 << (UInt8)0x19 << (UInt8)0x1A << (UInt8)0x26
-                     << (UInt8)0x27 << (UInt8)0x28 << (UInt8)0x29 << (UInt8)0x2A << (UInt8)0x35
-                     << (UInt8)0x36 << (UInt8)0x37 << (UInt8)0x38 << (UInt8)0x39 << (UInt8)0x3A
-                     << (UInt8)0x43 << (UInt8)0x44 << (UInt8)0x45 << (UInt8)0x46 << (UInt8)0x47
-                     << (UInt8)0x48 << (UInt8)0x49 << (UInt8)0x4A << (UInt8)0x53 << (UInt8)0x54
-                     << (UInt8)0x55 << (UInt8)0x56 << (UInt8)0x57 << (UInt8)0x58 << (UInt8)0x59
-                     << (UInt8)0x5A << (UInt8)0x63 << (UInt8)0x64 << (UInt8)0x65 << (UInt8)0x66
-                     << (UInt8)0x67 << (UInt8)0x68 << (UInt8)0x69 << (UInt8)0x6A << (UInt8)0x73
-                     << (UInt8)0x74 << (UInt8)0x75 << (UInt8)0x76 << (UInt8)0x77 << (UInt8)0x78
-                     << (UInt8)0x79 << (UInt8)0x7A << (UInt8)0x82 << (UInt8)0x83 << (UInt8)0x84
-                     << (UInt8)0x85 << (UInt8)0x86 << (UInt8)0x87 << (UInt8)0x88 << (UInt8)0x89 << (UInt8)0x8A
-                     << (UInt8)0x92 << (UInt8)0x93 << (UInt8)0x94 << (UInt8)0x95 << (UInt8)0x96
-                     << (UInt8)0x97 << (UInt8)0x98 << (UInt8)0x99 << (UInt8)0x9A << (UInt8)0xA2
-                     << (UInt8)0xA3 << (UInt8)0xA4 << (UInt8)0xA5 << (UInt8)0xA6 << (UInt8)0xA7
-                     << (UInt8)0xA8 << (UInt8)0xA9 << (UInt8)0xAA << (UInt8)0xB2 << (UInt8)0xB3
-                     << (UInt8)0xB4 << (UInt8)0xB5 << (UInt8)0xB6 << (UInt8)0xB7 << (UInt8)0xB8
-                     << (UInt8)0xB9 << (UInt8)0xBA << (UInt8)0xC2 << (UInt8)0xC3 << (UInt8)0xC4
-                     << (UInt8)0xC5 << (UInt8)0xC6 << (UInt8)0xC7 << (UInt8)0xC8 << (UInt8)0xC9
-                     << (UInt8)0xCA << (UInt8)0xD2 << (UInt8)0xD3 << (UInt8)0xD4 << (UInt8)0xD5
-                     << (UInt8)0xD6 << (UInt8)0xD7 << (UInt8)0xD8 << (UInt8)0xD9 << (UInt8)0xDA
-                     << (UInt8)0xE2 << (UInt8)0xE3 << (UInt8)0xE4 << (UInt8)0xE5 << (UInt8)0xE6
-                     << (UInt8)0xE7 << (UInt8)0xE8 << (UInt8)0xE9 << (UInt8)0xEA << (UInt8)0xF2
-                     << (UInt8)0xF3 << (UInt8)0xF4 << (UInt8)0xF5 << (UInt8)0xF6 << (UInt8)0xF7
-                     << (UInt8)0xF8 << (UInt8)0xF9 << (UInt8)0xFA;
+        if ( m_restartInterval > 0 )
+        {
+            writeMarker( header, JFIF_DRI );
+            writeWord( header, 0x0004 ); // DRI segment length (including the length bytes)
+            writeWord( header, m_restartInterval ); // MCUs per restart interval
+        }
         
         ////////////////////////////////////
         // Write start of scan segment
         ////////////////////////////////////
-        m_outputJPEG << JFIF_BYTE_FF << JFIF_SOS;
-        m_outputJPEG << (UInt8)0x00 << (UInt8)0x0C; // Length of SOS header
-        m_outputJPEG << (UInt8)0x03; // # of components
-        m_outputJPEG << (UInt8)0x01 << (UInt8)0x00; // HT info for component #1
-        m_outputJPEG << (UInt8)0x02 << (UInt8)0x11; // HT info for component #2
-        m_outputJPEG << (UInt8)0x03 << (UInt8)0x11; // HT info for component #3
-        m_outputJPEG << (UInt8)0x00 << (UInt8)0x3F << (UInt8)0x00; // Skip bytes
-        
-//         m_outputJPEG << (UInt8)0xF3 << (UInt8)0xFA << (UInt8)0x00
-//                      << (UInt8)0xFA << (UInt8)0x02 << (UInt8)0x80 << (UInt8)0x3F;
-                     
-        auto scanData = generateScanData();
+        writeMarker( header, JFIF_SOS );
+        writeWord( header, 6 + 2 * m_componentCount ); // Length of SOS header
+        header.push_back( m_componentCount ); // # of components
         
-        for ( int i = 0; i <= scanData.size() - 8; i += 8 )
-        {
-            std::bitset<8> word( scanData.substr( i, 8 ) );
-            UInt8 w = (UInt8)word.to_ulong();
-            
-            m_outputJPEG << w;
-            if ( w == JFIF_BYTE_FF )
-                m_outputJPEG << 0x00;
-        }
+        // HT info for each component, Y uses the DC & AC tables #0, Cb & Cr #1
+        for ( int c = 0; c < m_componentCount; ++c )
+            header.insert( header.end(), { UInt8( c + 1 ), UInt8( c == YCbCrComponents::Y ? 0x00 : 0x11 ) } );
+        
+        header.insert( header.end(), { 0x00, 0x3F, 0x00 } ); // Skip bytes
+        
+        // The scan data is already byte stuffed and contains the RSTn markers, if any
+        auto scanData = generateScanData();
         
         ////////////////////////////////////
         // Write end marker
         ////////////////////////////////////
-        m_outputJPEG << JFIF_BYTE_FF << JFIF_EOI;
+        std::vector<UInt8> trailer;
+        writeMarker( trailer, JFIF_EOI );
+        
+        if ( !sink.write( header.data(), header.size() ) ||
+             !sink.write( scanData.data(), scanData.size() ) ||
+             !sink.write( trailer.data(), trailer.size() ) ||
+             !sink.flush() )
+        {
+            LOG(Logger::Level::ERROR) << "Unable to write the JFIF data to the output sink" << std::endl;
+            return false;
+        }
         
-        LOG(Logger::Level::INFO) << "Finished writing JPEG image data to JFIF file: " + destFile + " [OK]" << std::endl;
+        LOG(Logger::Level::INFO) << "Finished writing JPEG image data to JFIF, size: "
+                                 << header.size() + scanData.size() + trailer.size() << " bytes [OK]" << std::endl;
         return true;
     }
     
+    void JPEGEncoder::writeHuffmanTable( std::vector<UInt8>& out, const int type, const int id )
+    {
+        const HuffmanTable& htable = m_huffmanTables[type][id];
+        
+        int symbolCount = 0;
+        for ( auto&& codeLength : htable )
+            symbolCount += codeLength.first;
+        
+        writeMarker( out, JFIF_DHT );
+        
+        // DHT segment length (including the length bytes)
+        writeWord( out, 2 + 1 + 16 + symbolCount );
+        
+        // Bits 7-4 denote the table class (DC=0, AC=1), bits 3-0 the table #
+        out.push_back( ( type << 4 ) | id );
+        
+        // The symbol count for each symbol from 1-bit length to 16-bit length
+        for ( auto&& codeLength : htable )
+            out.push_back( codeLength.first );
+        
+        // The symbols, in order of increasing code length
+        for ( auto&& codeLength : htable )
+            out.insert( out.end(), codeLength.second.begin(), codeLength.second.end() );
+    }
+    
+    void JPEGEncoder::writeMarker( std::vector<UInt8>& out, const UInt8 marker )
+    {
+        out.push_back( JFIF_BYTE_FF );
+        out.push_back( marker );
+    }
+    
+    void JPEGEncoder::writeWord( std::vector<UInt8>& out, const UInt16 word )
+    {
+        out.push_back( word >> 8 );     // the first 8 MSBs
+        out.push_back( word & 0x00FF ); // the next 8 LSBs
+    }
+    
+    void JPEGEncoder::setupComponents()
+    {
+        ChromaSubsampling subsampling = m_subsampling;
+        
+        // Planar input keeps the subsampling of its chroma planes
+        if ( m_rawInput )
+        {
+            switch ( m_pixelFormat )
+            {
+                case PIXEL_FORMAT_YUV444P : subsampling = SUBSAMPLING_444; break;
+                case PIXEL_FORMAT_YUV422P : subsampling = SUBSAMPLING_422; break;
+                case PIXEL_FORMAT_YUV420P : subsampling = SUBSAMPLING_420; break;
+                default: break;
+            }
+        }
+        
+        // Gray input has no chroma to encode
+        bool grayInput = m_rawInput ? m_pixelFormat == PIXEL_FORMAT_GRAY : m_image.getPixelType() == PixelType::GRAY8;
+        
+        m_componentCount = m_grayscale || grayInput ? 1 : 3;
+        
+        // A single component is coded one block at a time
+        if ( m_componentCount == 1 )
+            subsampling = SUBSAMPLING_444;
+        
+        // The luma sampling factors give the number of luma blocks in each
+        // dimension of an MCU, the chroma components have one block per MCU
+        int HSampFactor = subsampling == SUBSAMPLING_444 ? 1 : 2;
+        int VSampFactor = subsampling == SUBSAMPLING_420 ? 2 : 1;
+        
+        int MCUWidth = 8 * HSampFactor;
+        int MCUHeight = 8 * VSampFactor;
+        
+        m_MCUCols = ( m_width + MCUWidth - 1 ) / MCUWidth;
+        m_MCURows = ( m_height + MCUHeight - 1 ) / MCUHeight;
+        
+        for ( int c = 0; c < m_componentCount; ++c )
+        {
+            EncoderComponent& component = m_components[c];
+            
+            component.HSampFactor = c == YCbCrComponents::Y ? HSampFactor : 1;
+            component.VSampFactor = c == YCbCrComponents::Y ? VSampFactor : 1;
+            component.width = m_MCUCols * 8 * component.HSampFactor;
+            component.height = m_MCURows * 8 * component.VSampFactor;
+            component.data.assign( component.width * component.height, 0.f );
+            component.DCTCoefficients.clear();
+        }
+        
+        LOG(Logger::Level::DEBUG) << "MCU layout: " << m_MCUCols << "x" << m_MCURows << " MCUs of "
+                                  << HSampFactor << "x" << VSampFactor << " luma blocks, " << m_componentCount << " component(s)" << std::endl;
+    }
+    
     void JPEGEncoder::transformColorspace()
     {
         LOG(Logger::Level::INFO) << "Performing colorspace transformation from R-G-B to Y-Cb-Cr..." << std::endl;
         
-        for ( int y = 0; y < m_image.getHeight(); ++y )
+        EncoderComponent& Y = m_components[YCbCrComponents::Y];
+        EncoderComponent& Cb = m_components[YCbCrComponents::Cb];
+        EncoderComponent& Cr = m_components[YCbCrComponents::Cr];
+        
+        const int hs = Y.HSampFactor;
+        const int vs = Y.VSampFactor;
+        
+        const int lastCol = m_width - 1;
+        
+        // Grayscale only needs the luminance, the luma samples are 1:1 with the padded pixels
+        if ( m_componentCount == 1 )
         {
-            for ( int x = 0; x < m_image.getWidth(); ++x )
+            std::vector<float> row( m_width * 3 );
+            
+            for ( int y = 0; y < Y.height; ++y )
             {
-                int R = int( (*m_image.getFlPixelPtr())[y][x].comp[RGBComponents::RED] );
-                int G = int( (*m_image.getFlPixelPtr())[y][x].comp[RGBComponents::GREEN] );
-                int B = int( (*m_image.getFlPixelPtr())[y][x].comp[RGBComponents::BLUE] );
+                readPixelRow( std::min( y, m_height - 1 ), row );
                 
-                UInt8 Y = std::floor( 0.299f * R + 0.587f * G + 0.114f * B );
-                UInt8 Cb = std::floor( - 0.1687f * R - 0.3313f * G + 0.5f * B + 128.f );
-                UInt8 Cr = std::floor( 0.5f * R - 0.4187f * G - 0.0813f * B + 128.f );
-                
-                (*m_image.getFlPixelPtr())[y][x].comp[YCbCrComponents::Y] = Y;
-                (*m_image.getFlPixelPtr())[y][x].comp[YCbCrComponents::Cb] = Cb;
-                (*m_image.getFlPixelPtr())[y][x].comp[YCbCrComponents::Cr] = Cr;
+                for ( int x = 0; x < Y.width; ++x )
+                {
+                    const float* pixel = &row[ std::min( x, lastCol ) * 3 ];
+                    
+                    Y.data[y * Y.width + x] = 0.299f * pixel[RGBComponents::RED] + 0.587f * pixel[RGBComponents::GREEN] + 0.114f * pixel[RGBComponents::BLUE];
+                }
             }
+            
+            LOG(Logger::Level::INFO) << "Colorspace transformation complete, luminance only [OK]" << std::endl;
+            return;
         }
         
-//         for ( auto&& row : *m_image.getFlPixelPtr() )
-//         {
-//             for ( auto&& val : row )
-//             {
-//                 std::cout << val.comp[0] << "," << val.comp[1] << "," << val.comp[2] << "\t";
-//             }
-//             std::cout << std::endl;
-//         }
-//         std::cout << std::endl;
+        // The input rows covered by the current row of chroma samples
+        std::vector<std::vector<float>> rows( vs, std::vector<float>( m_width * 3 ) );
+        
+        // Each chroma sample covers hs x vs luma samples. The luma samples are
+        // written as they're converted, and the chroma of the covered pixels
+        // is averaged (box filter). Samples outside the image repeat the edge.
+        for ( int cy = 0; cy < Cb.height; ++cy )
+        {
+            for ( int dy = 0; dy < vs; ++dy )
+                readPixelRow( std::min( cy * vs + dy, m_height - 1 ), rows[dy] );
+            
+            for ( int cx = 0; cx < Cb.width; ++cx )
+            {
+                float CbSum = 0.f, CrSum = 0.f;
+                
+                for ( int dy = 0; dy < vs; ++dy )
+                {
+                    for ( int dx = 0; dx < hs; ++dx )
+                    {
+                        int y = cy * vs + dy;
+                        int x = cx * hs + dx;
+                        
+                        const float* pixel = &rows[dy][ std::min( x, lastCol ) * 3 ];
+                        
+                        float R = pixel[RGBComponents::RED];
+                        float G = pixel[RGBComponents::GREEN];
+                        float B = pixel[RGBComponents::BLUE];
+                        
+                        Y.data[y * Y.width + x] = 0.299f * R + 0.587f * G + 0.114f * B;
+                        CbSum += - 0.1687f * R - 0.3313f * G + 0.5f * B + 128.f;
+                        CrSum += 0.5f * R - 0.4187f * G - 0.0813f * B + 128.f;
+                    }
+                }
+                
+                Cb.data[cy * Cb.width + cx] = CbSum / ( hs * vs );
+                Cr.data[cy * Cr.width + cx] = CrSum / ( hs * vs );
+            }
+        }
         
         LOG(Logger::Level::INFO) << "Colorspace transformation complete [OK]" << std::endl;
     }
     
-    void JPEGEncoder::levelShiftComponents()
+    void JPEGEncoder::readPixelRow( const int y, std::vector<float>& RGB )
     {
-        LOG(Logger::Level::INFO) << "Performing level shift on components..." << std::endl;
+        if ( !m_rawInput )
+        {
+            const auto& row = (*m_image.getFlPixelPtr())[y];
+            
+            for ( int x = 0; x < m_width; ++x )
+                for ( int c = 0; c < 3; ++c )
+                    RGB[x * 3 + c] = row[x].comp[c];
+            
+            return;
+        }
+        
+        const UInt8* row = m_planes[0] + y * m_strides[0];
+        
+        switch ( m_pixelFormat )
+        {
+            case PIXEL_FORMAT_RGB:
+            {
+                for ( int i = 0; i < m_width * 3; ++i )
+                    RGB[i] = row[i];
+                break;
+            }
+            
+            case PIXEL_FORMAT_RGBA:
+            {
+                for ( int x = 0; x < m_width; ++x )
+                    for ( int c = 0; c < 3; ++c )
+                        RGB[x * 3 + c] = row[x * 4 + c];
+                break;
+            }
+            
+            case PIXEL_FORMAT_BGR:
+            {
+                for ( int x = 0; x < m_width; ++x )
+                    for ( int c = 0; c < 3; ++c )
+                        RGB[x * 3 + c] = row[x * 3 + 2 - c];
+                break;
+            }
+            
+            case PIXEL_FORMAT_GRAY:
+            {
+                for ( int x = 0; x < m_width; ++x )
+                    RGB[x * 3] = RGB[x * 3 + 1] = RGB[x * 3 + 2] = row[x];
+                break;
+            }
+            
+            default:
+                break;
+        }
+    }
+    
+    void JPEGEncoder::copyPlanarComponents()
+    {
+        LOG(Logger::Level::INFO) << "Copying Y-Cb-Cr planes to components..." << std::endl;
+        
+        const EncoderComponent& Y = m_components[YCbCrComponents::Y];
         
-        for ( int y = 0; y < m_image.getHeight(); ++y )
+        for ( int c = 0; c < m_componentCount; ++c )
         {
-            for ( int x = 0; x < m_image.getWidth(); ++x )
+            EncoderComponent& component = m_components[c];
+            
+            // Size of the plane, in samples
+            int planeWidth = ( m_width * component.HSampFactor + Y.HSampFactor - 1 ) / Y.HSampFactor;
+            int planeHeight = ( m_height * component.VSampFactor + Y.VSampFactor - 1 ) / Y.VSampFactor;
+            
+            for ( int y = 0; y < component.height; ++y )
             {
-                (*m_image.getFlPixelPtr())[y][x].comp[YCbCrComponents::Y] -= 128;
-                (*m_image.getFlPixelPtr())[y][x].comp[YCbCrComponents::Cb] -= 128;
-                (*m_image.getFlPixelPtr())[y][x].comp[YCbCrComponents::Cr] -= 128;
+                const UInt8* row = m_planes[c] + std::min( y, planeHeight - 1 ) * m_strides[c];
+                float* samples = &component.data[y * component.width];
+                
+                for ( int x = 0; x < component.width; ++x )
+                    samples[x] = row[ std::min( x, planeWidth - 1 ) ];
             }
         }
         
-        LOG(Logger::Level::INFO) << "Level shift complete [OK]" << std::endl;
+        LOG(Logger::Level::INFO) << "Y-Cb-Cr planes copied [OK]" << std::endl;
+    }
+    
+    void JPEGEncoder::levelShiftComponents()
+    {
+        LOG(Logger::Level::INFO) << "Performing level shift on components..." << std::endl;
+        
+        for ( int c = 0; c < m_componentCount; ++c )
+        {
+            for ( auto&& sample : m_components[c].data )
+                sample -= 128;
+        }
         
-//         for ( auto&& row : *m_image.getFlPixelPtr() )
-//         {
-//             for ( auto&& val : row )
-//             {
-//                 std::cout << val.comp[0] << "," << val.comp[1] << "," << val.comp[2] << "\t";
-//             }
-//             std::cout << std::endl;
-//         }
-//         std::cout << std::endl;
+        LOG(Logger::Level::INFO) << "Level shift complete [OK]" << std::endl;
     }
     
     void kpeg::JPEGEncoder::computeDCT()
     {
         LOG(Logger::Level::INFO) << "Applying Forward DCT on components..." << std::endl;
         
-        // Traverse the pixel pointer, 8x8 blocks at a time
-        for ( int iy = 0; iy + 8 - 1 < m_image.getHeight(); iy += 8 )
+        for ( int c = 0; c < m_componentCount; ++c )
         {
-            for ( int ix = 0; ix + 8 - 1 < m_image.getWidth(); ix += 8 )
+            EncoderComponent& component = m_components[c];
+            component.DCTCoefficients.resize( component.data.size() );
+            
+            // Traverse the component, 8x8 blocks at a time
+            for ( int iy = 0; iy < component.height; iy += 8 )
             {
-                std::array<std::array<FPixel, 8>, 8> coefficients;
-                
-                for ( int v = 0; v < 8; ++v )
+                for ( int ix = 0; ix < component.width; ix += 8 )
                 {
-                    for ( int u = 0; u < 8; ++u )
+                    // Separable: transform the rows, then the columns of the result
+                    float rows[64] = {};
+                    
+                    for ( int y = 0; y < 8; ++y )
                     {
-                        float Cu = u == 0 ? 1.0 / std::sqrt(2.f) : 1.f;
-                        float Cv = v == 0 ? 1.0 / std::sqrt(2.f) : 1.f;
-                        float coeff[3] = { 0.f, 0.f, 0.f };
-                        
-                        for ( int y = iy; y < iy + 8; ++y )
+                        for ( int x = 0; x < 8; ++x )
                         {
-                            for ( int x = ix; x < ix + 8; ++x )
-                            {
-                                for ( int c = 0; c < 3; ++c )
-                                {
-                                    coeff[c] += (*m_image.getFlPixelPtr())[y][x].comp[c] *
-                                                 std::cos( ( 2 * x + 1 ) * u * M_PI / 16 ) *
-                                                  std::cos( ( 2 * y + 1 ) * v * M_PI / 16 );
-                                }
-                            }
+                            float sample = component.data[( iy + y ) * component.width + ix + x];
+                            
+                            for ( int u = 0; u < 8; ++u )
+                                rows[y * 8 + u] += sample * DCT_COSINES[x * 8 + u];
                         }
-                        
-                        coeff[YCbCrComponents::Y] = 0.25f * Cu * Cv * coeff[0];
-                        coeff[YCbCrComponents::Cb] = 0.25f * Cu * Cv * coeff[1];
-                        coeff[YCbCrComponents::Cr] = 0.25f * Cu * Cv * coeff[2];
-                        
-                        coefficients[v][u].comp[YCbCrComponents::Y] = std::roundf( coeff[YCbCrComponents::Y] * 100 ) / 100;
-                        coefficients[v][u].comp[YCbCrComponents::Cb] = std::roundf( coeff[YCbCrComponents::Cb] * 100 ) / 100;
-                        coefficients[v][u].comp[YCbCrComponents::Cr] = std::roundf( coeff[YCbCrComponents::Cr] * 100 ) / 100;
                     }
-                }
-                
-                for ( int y = iy; y < iy + 8; ++y )
-                {
-                    for ( int x = ix; x < ix + 8; ++x )
+                    
+                    for ( int v = 0; v < 8; ++v )
                     {
-                        (*m_image.getFlPixelPtr())[y][x].comp[YCbCrComponents::Y] = coefficients[y - iy][x - ix].comp[YCbCrComponents::Y];
-                        (*m_image.getFlPixelPtr())[y][x].comp[YCbCrComponents::Cb] = coefficients[y - iy][x - ix].comp[YCbCrComponents::Cb];
-                        (*m_image.getFlPixelPtr())[y][x].comp[YCbCrComponents::Cr] = coefficients[y - iy][x - ix].comp[YCbCrComponents::Cr];
+                        for ( int u = 0; u < 8; ++u )
+                        {
+                            float coeff = 0.f;
+                            
+                            for ( int y = 0; y < 8; ++y )
+                                coeff += rows[y * 8 + u] * DCT_COSINES[y * 8 + v];
+                            
+                            coeff *= DCT_SCALES[v * 8 + u];
+                            
+                            component.DCTCoefficients[( iy + v ) * component.width + ix + u] = std::roundf( coeff * 100 ) / 100;
+                        }
                     }
                 }
             }
         }
         
-//         for ( auto&& row : *m_image.getFlPixelPtr() )
-//         {
-//             for ( auto&& val : row )
-//             {
-//                 std::cout << val.comp[0] << "," << val.comp[1] << "," << val.comp[2] << "\t";
-//             }
-//             std::cout << std::endl;
-//         }
-//         std::cout << std::endl;
-        
         LOG(Logger::Level::INFO) << "Forward DCT applied [OK]" << std::endl;
     }
     
+    void JPEGEncoder::generateQuantizationTables( const int quality )
+    {
+        // Same scaling as the IJG libjpeg: qualities below 50 scale up
+        // the quantization steps, higher qualities scale them down
+        int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+        
+        m_QTables.assign( 2, std::vector<UInt16>( 64, 1 ) );
+        
+        for ( int v = 0; v < 8; ++v )
+        {
+            for ( int u = 0; u < 8; ++u )
+            {
+                // Baseline JPEG allows only 8-bit quantization table entries
+                int luma = ( M_QT_MAT_LUMA[v][u] * scale + 50 ) / 100;
+                int chroma = ( M_QT_MAT_CHROMA[v][u] * scale + 50 ) / 100;
+                
+                m_QTables[0][v * 8 + u] = std::max( 1, std::min( luma, 255 ) );
+                m_QTables[1][v * 8 + u] = std::max( 1, std::min( chroma, 255 ) );
+            }
+        }
+        
+        // Requantized coefficients can't regain the precision the source tables dropped
+        if ( m_coefficientInput && m_requantize )
+        {
+            for ( std::size_t t = 0; t < m_sourceQTables.size(); ++t )
+                for ( int i = 0; i < 64; ++i )
+                    m_QTables[t][i] = std::max( m_QTables[t][i], m_sourceQTables[t][i] );
+        }
+    }
+    
     void JPEGEncoder::quantize()
     {
         LOG(Logger::Level::INFO) << "Quantizing components..." << std::endl;
         
-        for ( int iy = 0; iy + 8 - 1 < m_image.getHeight(); iy += 8 )
+        for ( int c = 0; c < m_componentCount; ++c )
         {
-            for ( int ix = 0; ix + 8 - 1 < m_image.getWidth(); ix += 8 )
+            EncoderComponent& component = m_components[c];
+            const std::vector<UInt16>& QTable = m_QTables[ c == YCbCrComponents::Y ? 0 : 1 ];
+            
+            for ( int y = 0; y < component.height; ++y )
             {
-                for ( int v = 0; v < 8; ++v )
+                for ( int x = 0; x < component.width; ++x )
                 {
-                    for ( int u = 0; u < 8; ++u )
-                    {
-                        (*m_image.getFlPixelPtr())[iy + v][ix + u].comp[YCbCrComponents::Y] /= M_QT_MAT_LUMA[v][u];
-                        (*m_image.getFlPixelPtr())[iy + v][ix + u].comp[YCbCrComponents::Cb] /= M_QT_MAT_CHROMA[v][u];
-                        (*m_image.getFlPixelPtr())[iy + v][ix + u].comp[YCbCrComponents::Cr] /= M_QT_MAT_CHROMA[v][u];
-                        
-                        (*m_image.getFlPixelPtr())[iy + v][ix + u].comp[YCbCrComponents::Y] = std::round( (*m_image.getFlPixelPtr())[iy + v][ix + u].comp[YCbCrComponents::Y] );
-                        (*m_image.getFlPixelPtr())[iy + v][ix + u].comp[YCbCrComponents::Cb] = std::round( (*m_image.getFlPixelPtr())[iy + v][ix + u].comp[YCbCrComponents::Cb] );
-                        (*m_image.getFlPixelPtr())[iy + v][ix + u].comp[YCbCrComponents::Cr] = std::round( (*m_image.getFlPixelPtr())[iy + v][ix + u].comp[YCbCrComponents::Cr] );
-                    }
+                    int index = y * component.width + x;
+                    component.data[index] = std::round( component.DCTCoefficients[index] / QTable[( y % 8 ) * 8 + x % 8] );
                 }
             }
         }
         
-//         for ( auto&& row : *m_image.getFlPixelPtr() )
-//         {
-//             for ( auto&& val : row )
-//             {
-//                 std::cout << val.comp[0] << "," << val.comp[1] << "," << val.comp[2] << "\t";
-//             }
-//             std::cout << std::endl;
-//         }
-//         std::cout << std::endl;
-        
         LOG(Logger::Level::INFO) << "Quantization complete [OK]" << std::endl;
     }
     
-    std::array<std::vector<int>, 3> JPEGEncoder::generateRLE( const int y, const int x )
+    template <typename Emit>
+    void JPEGEncoder::forEachBlockSymbol( const int c, const int by, const int bx, int& DCPred, Emit&& emit )
     {
-        LOG(Logger::Level::DEBUG) << "Generating Zero Run-Length Coding for MCU: " << y / 8 << "," << x / 8 << "..." << std::endl;
+        // NOTE: This is called from the worker threads, so it must not log
         
-        std::array< std::array<int, 64>, 3 > ZZ;
+        const EncoderComponent& component = m_components[c];
+        const float* block = &component.data[by * 8 * component.width + bx * 8];
         
-        for ( int c = 0; c < 3; ++c )
+        auto coefficient = [block, &component]( const int k ) -> int
         {
-            for ( int i = 0; i < 64; ++i )
+            int index = NATURAL_ORDER[k];
+            return block[( index >> 3 ) * component.width + ( index & 7 )];
+        };
+        
+        // The DC coefficient is coded as the difference from the previous block's
+        int DCDiff = coefficient( 0 ) - DCPred;
+        DCPred += DCDiff;
+        
+        emit( HT_DC, getValueCategory( DCDiff ), DCDiff );
+        
+        // The AC coefficients, in zig-zag order, as ( zero run, category )
+        // symbols. Runs of more than 15 zeros are split using ( 15, 0 ) (ZRL)
+        // symbols, each of which stands for 16 zeros, and the block ends
+        // with ( 0, 0 ) (EOB) if it has trailing zeros.
+        int zeroCount = 0;
+        
+        for ( int k = 1; k < 64; ++k )
+        {
+            int value = coefficient( k );
+            
+            if ( value == 0 )
             {
-                auto index = zzOrderToMatIndices( i );
-                ZZ[c][i] = (*m_image.getFlPixelPtr())[index.first + y][index.second + x].comp[c];
+                zeroCount++;
+                continue;
             }
+            
+            for ( ; zeroCount >= 16; zeroCount -= 16 )
+                emit( HT_AC, 0xF0, 0 );
+            
+            emit( HT_AC, ( zeroCount << 4 ) | getValueCategory( value ), value );
+            zeroCount = 0;
         }
         
-//         for ( auto&& comp : ZZ )
-//         {
-//             for ( auto&& val : comp )
-//                 std::cout << val << " ";
-//             std::cout << std::endl;
-//         }
-//         std::cout << std::endl;
+        if ( zeroCount > 0 )
+            emit( HT_AC, 0x00, 0 );
+    }
+    
+    std::vector<UInt8> JPEGEncoder::encodeMCURange( const int firstMCU, const int lastMCU )
+    {
+        // NOTE: This is called from the worker threads, so it must not log
+        
+        BitWriter writer;
         
-        std::array<std::vector<int>, 3> ZRLE;
+        // The DC coefficient of the previous block of each component.
+        // The prediction is reset to 0 at the start of every restart interval.
+        int DCPred[3] = { 0, 0, 0 };
         
-        for ( int c = 0; c < 3; ++c )
+        for ( int mcu = firstMCU; mcu < lastMCU; ++mcu )
         {
-            int zeroCount = 0;
-            int i = 0;
+            int MCURow = mcu / m_MCUCols;
+            int MCUCol = mcu % m_MCUCols;
             
-            while ( i < 64 )
+            // Each MCU holds HSampFactor x VSampFactor blocks of each
+            // component (in row major order), one component after the other
+            for ( int k = 0; k < m_componentCount; ++k )
             {
-                zeroCount = 0;
-                int j = i;
-                
-                while ( j < 64 && ZZ[c][j] == 0 )
-                {
-                    zeroCount++;
-                    j++;
-                }
+                const EncoderComponent& component = m_components[k];
                 
-                if ( j == 64 && zeroCount < 64)
-                {
-                    //j--;
-                    ZRLE[c].push_back( 0 );
-                    ZRLE[c].push_back( 0 );
-
-                    break;
-                }
-                else if ( j == 64 && zeroCount == 64)
-                {
-                    //j--;
-                    ZRLE[c].push_back( 0 );
-                    ZRLE[c].push_back( 0 );
-                    ZRLE[c].push_back( 0 );
-                    ZRLE[c].push_back( 0 );
-
-                    break;
-                }
+                int HuffTableID = k == YCbCrComponents::Y ? HT_Y : HT_CbCr;
+                const HuffmanCodeTable& DCCodes = m_huffmanCodes[HT_DC][HuffTableID];
+                const HuffmanCodeTable& ACCodes = m_huffmanCodes[HT_AC][HuffTableID];
                 
-                if ( zeroCount < 16 )
+                for ( int v = 0; v < component.VSampFactor; ++v )
                 {
-                    ZRLE[c].push_back( zeroCount );
-                    ZRLE[c].push_back( ZZ[c][j] );
+                    for ( int h = 0; h < component.HSampFactor; ++h )
+                    {
+                        // Each symbol's Huffman code is followed by the category
+                        // (the low 4 bits of the symbol) bits of its value
+                        forEachBlockSymbol( k, MCURow * component.VSampFactor + v, MCUCol * component.HSampFactor + h, DCPred[k],
+                            [&writer, &DCCodes, &ACCodes]( const int type, const int symbol, const int value )
+                            {
+                                const HuffmanCode& code = ( type == HT_DC ? DCCodes : ACCodes )[symbol];
+                                int cat = symbol & 0x0F;
+                                
+                                writer.writeBits( code.code, code.length );
+                                writer.writeBits( getValueBits( value, cat ), cat );
+                            } );
+                    }
                 }
+            }
+        }
+        
+        writer.flush();
+        return writer.getBytes();
+    }
+    
+    const std::vector<UInt8> JPEGEncoder::generateScanData()
+    {
+        int MCUCount = m_MCUCols * m_MCURows;
+        
+        // Without restart markers the whole scan is a single interval
+        int interval = m_restartInterval > 0 ? m_restartInterval : MCUCount;
+        int intervalCount = interval > 0 ? ( MCUCount + interval - 1 ) / interval : 0;
+        
+        std::vector<std::future<std::vector<UInt8>>> segments;
+        
+        ThreadPool& pool = getThreadPool();
+        
+        LOG(Logger::Level::INFO) << "Entropy coding " << MCUCount << " MCUs in " << intervalCount
+                                 << " restart interval(s) on " << std::min<std::size_t>( intervalCount, pool.getThreadCount() ) << " thread(s)..." << std::endl;
+        
+        for ( int i = 0; i < intervalCount; ++i )
+        {
+            int first = i * interval;
+            int last = std::min( first + interval, MCUCount );
+            
+            segments.push_back( pool.submit( [this, first, last]() { return encodeMCURange( first, last ); } ) );
+        }
+        
+        // Concatenate the intervals in order, separated by RST0 - RST7 (modulo 8)
+        std::vector<UInt8> scanData;
+        
+        for ( int i = 0; i < intervalCount; ++i )
+        {
+            if ( i > 0 )
+            {
+                scanData.push_back( JFIF_BYTE_FF );
+                scanData.push_back( JFIF_RST0 + ( ( i - 1 ) % 8 ) );
+            }
+            
+            auto segment = segments[i].get();
+            scanData.insert( scanData.end(), segment.begin(), segment.end() );
+        }
+        
+        LOG(Logger::Level::INFO) << "Entropy coding complete, scan data size: " << scanData.size() << " bytes [OK]" << std::endl;
+        
+        return scanData;
+    }
+    
+    ScanStatistics JPEGEncoder::countMCURangeSymbols( const int firstMCU, const int lastMCU )
+    {
+        // NOTE: This is called from the worker threads, so it must not log
+        
+        ScanStatistics stats;
+        
+        for ( auto&& tables : stats )
+            for ( auto&& freq : tables )
+                freq.fill( 0 );
+        
+        // Same as in encodeMCURange(), the DC predictions start from 0
+        int DCPred[3] = { 0, 0, 0 };
+        
+        for ( int mcu = firstMCU; mcu < lastMCU; ++mcu )
+        {
+            int MCURow = mcu / m_MCUCols;
+            int MCUCol = mcu % m_MCUCols;
+            
+            for ( int k = 0; k < m_componentCount; ++k )
+            {
+                const EncoderComponent& component = m_components[k];
+                int HuffTableID = k == YCbCrComponents::Y ? HT_Y : HT_CbCr;
                 
-                else
+                for ( int v = 0; v < component.VSampFactor; ++v )
                 {
-                    while ( zeroCount >= 16 )
+                    for ( int h = 0; h < component.HSampFactor; ++h )
                     {
-                        ZRLE[c].push_back( 15 );
-                        ZRLE[c].push_back( 0 );
-                        
-                        zeroCount -= 16;
+                        forEachBlockSymbol( k, MCURow * component.VSampFactor + v, MCUCol * component.HSampFactor + h, DCPred[k],
+                            [&stats, HuffTableID]( const int type, const int symbol, const int )
+                            {
+                                stats[type][HuffTableID][symbol]++;
+                            } );
                     }
-                    
-                    ZRLE[c].push_back( zeroCount );
-                    ZRLE[c].push_back( ZZ[c][j] );
                 }
-                
-                i = j + 1;
             }
+        }
+        
+        return stats;
+    }
+    
+    void JPEGEncoder::optimizeHuffmanTables()
+    {
+        LOG(Logger::Level::INFO) << "Gathering symbol statistics for optimized Huffman tables..." << std::endl;
+        
+        int MCUCount = m_MCUCols * m_MCURows;
+        int interval = m_restartInterval > 0 ? m_restartInterval : MCUCount;
+        int intervalCount = interval > 0 ? ( MCUCount + interval - 1 ) / interval : 0;
+        
+        std::vector<std::future<ScanStatistics>> partialStats;
+        
+        for ( int i = 0; i < intervalCount; ++i )
+        {
+            int first = i * interval;
+            int last = std::min( first + interval, MCUCount );
+            
+            partialStats.push_back( getThreadPool().submit( [this, first, last]() { return countMCURangeSymbols( first, last ); } ) );
+        }
+        
+        ScanStatistics stats;
+        
+        for ( auto&& tables : stats )
+            for ( auto&& freq : tables )
+                freq.fill( 0 );
+        
+        for ( auto&& partial : partialStats )
+        {
+            auto counts = partial.get();
             
-//             ZRLE[c].push_back( 0 );
-//             ZRLE[c].push_back( 0 );
+            for ( auto type : { HT_DC, HT_AC } )
+                for ( auto id : { HT_Y, HT_CbCr } )
+                    for ( auto symbol = 0; symbol < 256; ++symbol )
+                        stats[type][id][symbol] += counts[type][id][symbol];
         }
         
-        LOG(Logger::Level::DEBUG) << "Finished generating Zero Run-Length Coding for MCU: " << y / 8 << "," << x / 8 << " [OK]" << std::endl;
+        // Grayscale has no chroma symbols to build the chroma tables from
+        const int tableCount = m_componentCount == 1 ? 1 : 2;
         
-//         for ( auto&& comp : ZRLE )
-//         {
-//             for ( auto&& val : comp )
-//                 std::cout << val << " ";
-//             std::cout << std::endl;
-//         }
+        for ( auto type : { HT_DC, HT_AC } )
+        {
+            for ( auto id = 0; id < tableCount; ++id )
+            {
+                m_huffmanTables[type][id] = generateOptimalHuffmanTable( stats[type][id] );
+                m_huffmanCodes[type][id] = generateHuffmanCodes( m_huffmanTables[type][id] );
+            }
+        }
         
-        return ZRLE;
+        LOG(Logger::Level::INFO) << "Optimized Huffman tables generated [OK]" << std::endl;
     }
     
-    const std::string JPEGEncoder::generateScanData()
+    std::size_t JPEGEncoder::estimateFileSize()
     {
-        std::vector<std::array<std::vector<int>, 3>> MCURle;
-        std::string bits;
+        int MCUCount = m_MCUCols * m_MCURows;
+        int interval = m_restartInterval > 0 ? m_restartInterval : MCUCount;
+        int intervalCount = interval > 0 ? ( MCUCount + interval - 1 ) / interval : 0;
         
-        for ( int iy = 0; iy + 8 - 1 < m_image.getHeight(); iy += 8 )
+        // The symbol statistics are enough to size the scan data: each
+        // symbol costs its code length plus the number of value bits,
+        // which is the category in the low nibble of the symbol.
+        std::vector<std::future<ScanStatistics>> partialStats;
+        
+        for ( int i = 0; i < intervalCount; ++i )
         {
-            for ( int ix = 0; ix + 8 - 1 < m_image.getWidth(); ix += 8 )
-            {
-                auto rle = generateRLE( iy, ix );
-                MCURle.push_back( std::move( rle ) );
-            }
+            int first = i * interval;
+            int last = std::min( first + interval, MCUCount );
+            
+            partialStats.push_back( getThreadPool().submit( [this, first, last]() { return countMCURangeSymbols( first, last ); } ) );
         }
         
-        // Difference of the current DC coefficient from the previous one.
-        // Initially DC difference for first MCU is 0 for each component.
-        Int16 DCDiff[3] = { 0,  0, 0 };
+        std::size_t scanBytes = 0;
+        std::size_t tableBytes = 0;
+        
+        ScanStatistics stats;
+        
+        for ( auto&& tables : stats )
+            for ( auto&& freq : tables )
+                freq.fill( 0 );
         
-        // For each MCU, encode it
-        for ( int mcu = 0; mcu < MCURle.size(); ++mcu )
+        for ( auto&& partial : partialStats )
         {
-            // For each MCU, encode the components separately
-            for ( int k = 0; k < 3; ++k )
+            auto counts = partial.get();
+            std::size_t bits = 0;
+            
+            for ( auto type : { HT_DC, HT_AC } )
             {
-//                 std::cout << "RLE: ";
-//                 for ( auto&& v : MCURle[mcu][k] )
-//                     std::cout << v << " ";
-//                 std::cout << std::endl;
-                
-                // Encode DC coefficient for k-th component
-                
-                if ( MCURle[mcu][k][0] == 0 && MCURle[mcu][k][1] == 0 )
+                for ( auto id : { HT_Y, HT_CbCr } )
                 {
-                    std::string bitRep;
-                        
-                    if ( k == YCbCrComponents::Y )
+                    for ( auto symbol = 0; symbol < 256; ++symbol )
                     {
-                        bitRep = DC_LUMA_HUFF_CODES[0];
-                    }
-                    else
-                    {
-                        bitRep = DC_CHROMA_HUFF_CODES[0];
+                        stats[type][id][symbol] += counts[type][id][symbol];
+                        
+                        if ( !m_optimizeHuffmanTables )
+                            bits += std::size_t( counts[type][id][symbol] ) * ( m_huffmanCodes[type][id][symbol].length + ( symbol & 0x0F ) );
                     }
-                    
-                    bits += bitRep;
-                }                
-                else
-                {
-                    DCDiff[k] = MCURle[mcu][k][1] - DCDiff[k];
-                    
-                    //std::cout << "DC Diff: " << DCDiff[k] << ", Bit rep: " << valueToBitString( DCDiff[k] )  << std::endl;
-                    
-                    Int16 value = DCDiff[k];
-                    int cat = getValueCategory( value );
-                    std::string bitRep = valueToBitString( value );
-                    
-                    std::string category;
-                    
-                    if ( k == YCbCrComponents::Y )
-                        category = DC_LUMA_HUFF_CODES[cat];
-                    else
-                        category = DC_CHROMA_HUFF_CODES[cat];
-                    
-                    // Add the bits for ( category, bit representation )
-                    // of the DC coefficient to the scan data bitstream.
-                    bits += category + bitRep;
-                    //std::cout << "DC Bits: " << bits << std::endl;
                 }
+            }
+            
+            // Each interval is padded to a byte boundary and followed by a RSTn marker
+            scanBytes += ( bits + 7 ) / 8 + 2;
+        }
+        
+        const int tableCount = m_componentCount == 1 ? 1 : 2;
+        
+        for ( auto type : { HT_DC, HT_AC } )
+        {
+            for ( auto id = 0; id < tableCount; ++id )
+            {
+                HuffmanTable htable = m_huffmanTables[type][id];
                 
-                // Encode AC coefficients for k-th component
-                
-                for ( int j = 2; j <= MCURle[mcu][k].size() - 2; j += 2 )
+                // The optimized tables can't be sized per interval, but the padding
+                // and markers are only a few bytes, so they're added as a whole
+                if ( m_optimizeHuffmanTables )
                 {
-                    // Check EOB
-                    if ( MCURle[mcu][k][j] == 0 && MCURle[mcu][k][j + 1] == 0 )
-                    {
-                        std::string bitRep;
-                        
-                        if ( k == YCbCrComponents::Y )
-                        {
-                            bitRep = AC_LUMA_HUFF_CODES[0][0];
-                        }
-                        else
-                        {
-                            bitRep = AC_CHROMA_HUFF_CODES[0][0];
-                        }
-                        
-                        bits += bitRep;
-                        //std::cout << "AC Bits: " << bits << std::endl;
-                        
-                        break;
-                    }
-                    
-                    // Else, determine the zero count and value category
-                    // and then add to the scan data bitstream, the huffman
-                    // code for the ( zero count, category ) pair followed
-                    // by the bitstring for the value.
+                    htable = generateOptimalHuffmanTable( stats[type][id] );
+                    auto codes = generateHuffmanCodes( htable );
                     
-                    Int16 zeroCount = MCURle[mcu][k][j];
-                    Int16 value = MCURle[mcu][k][j + 1];
-                    int cat = getValueCategory( value );
-                    std::string bitRep = valueToBitString( value );
+                    std::size_t bits = 0;
+                    for ( auto symbol = 0; symbol < 256; ++symbol )
+                        bits += std::size_t( stats[type][id][symbol] ) * ( codes[symbol].length + ( symbol & 0x0F ) );
                     
-                    std::string category;
-                    
-                    if ( k == YCbCrComponents::Y )
-                        category = AC_LUMA_HUFF_CODES[zeroCount][cat];
-                    else
-                        category = AC_CHROMA_HUFF_CODES[zeroCount][cat];
-                    
-                    bits += category + bitRep;
-                    //std::cout << "AC Bits: " << bits << std::endl;
+                    scanBytes += bits / 8;
                 }
+                
+                // FFC4, length, table class & #, 16 code length counts & the symbols
+                tableBytes += 2 + 2 + 1 + 16;
+                for ( auto&& codeLength : htable )
+                    tableBytes += codeLength.first;
             }
-            
-            //std::cout << "Bitstream: " << bits << std::endl;
         }
         
-        //std::cout << "Final bitstream: " << bits.size() << std::endl;
+        // There's no RSTn after the last interval. Stuffed 0x00 bytes are not
+        // known without entropy coding, so assume the average of 1 in 256 bytes.
+        if ( intervalCount > 0 )
+            scanBytes -= 2;
+        scanBytes += scanBytes / 256;
         
-        if ( bits.size() % 8 != 0 )
+        // SOI, APP0, COM, the DQTs, SOF0, DRI, SOS & EOI
+        std::size_t headerBytes = 2 + 18 + ( 4 + ENCODER_COMMENT.length() ) + tableCount * 69 + ( 10 + 3 * m_componentCount )
+                                + ( m_restartInterval > 0 ? 6 : 0 ) + ( 8 + 2 * m_componentCount ) + 2;
+        
+        return headerBytes + tableBytes + scanBytes;
+    }
+    
+    int JPEGEncoder::searchQuality()
+    {
+        LOG(Logger::Level::INFO) << "Searching the highest quality within " << m_targetSize << " bytes..." << std::endl;
+        
+        int low = 1, high = 100, best = 1;
+        
+        while ( low <= high )
         {
-            bits.resize( bits.size() + 8 - bits.size() % 8, '1' );
+            int quality = ( low + high ) / 2;
+            
+            generateQuantizationTables( quality );
+            quantize();
+            
+            std::size_t size = estimateFileSize();
+            
+            LOG(Logger::Level::DEBUG) << "Quality: " << quality << ", estimated size: " << size << " bytes" << std::endl;
+            
+            if ( size <= m_targetSize )
+            {
+                best = quality;
+                low = quality + 1;
+            }
+            else
+                high = quality - 1;
         }
         
-        //std::cout << "Final bitstream: " << bits.size() << ", " << bits << std::endl;
-        std::cout << "Final bitstream: " << bits << std::endl;
+        LOG(Logger::Level::INFO) << "Selected quality: " << best << " [OK]" << std::endl;
+        
+        return best;
+    }
+    
+    bool JPEGEncoder::encodeWithinTargetSize( OutputSink& sink, int quality )
+    {
+        // The estimate guesses the stuffed bytes & padding, so the
+        // real file can still be a few bytes over the target
+        for ( ; quality >= 1; --quality )
+        {
+            generateQuantizationTables( quality );
+            quantize();
+            
+            if ( m_optimizeHuffmanTables )
+                optimizeHuffmanTables();
+            
+            MemorySink probe;
+            
+            if ( !writeJFIF( probe ) )
+                return false;
+            
+            std::size_t size = probe.getBuffer().size();
+            
+            if ( size <= m_targetSize )
+            {
+                if ( !sink.write( probe.getBuffer().data(), size ) || !sink.flush() )
+                {
+                    LOG(Logger::Level::ERROR) << "Unable to write the JFIF data to the output sink" << std::endl;
+                    return false;
+                }
+                
+                LOG(Logger::Level::INFO) << "Encoding complete at quality " << quality << ", size: " << size << " bytes [OK]" << std::endl;
+                return true;
+            }
+            
+            LOG(Logger::Level::DEBUG) << "Quality: " << quality << ", encoded size: " << size << " bytes, over the target" << std::endl;
+        }
         
-        //return std::move( bits );
+        LOG(Logger::Level::ERROR) << "The image doesn't fit in " << m_targetSize << " bytes even at quality 1 [NOT-OK]" << std::endl;
+        return false;
+    }
+    
+    ThreadPool& JPEGEncoder::getThreadPool()
+    {
+        if ( !m_threadPool )
+            m_threadPool.reset( new ThreadPool( m_threadCount ) );
         
-        return bits;
+        return *m_threadPool;
     }
 }
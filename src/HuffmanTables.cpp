@@ -1 +1,220 @@
+#include <algorithm>
 
+#include "HuffmanTables.hpp"
+
+namespace kpeg
+{
+    HuffmanTable makeHuffmanTable( const UInt8* bits, const UInt8* vals )
+    {
+        HuffmanTable htable;
+        int k = 0;
+
+        for ( auto i = 0; i < 16; ++i )
+        {
+            htable[i].first = bits[i];
+            htable[i].second.assign( vals + k, vals + k + bits[i] );
+            k += bits[i];
+        }
+
+        return htable;
+    }
+
+    HuffmanCodeTable generateHuffmanCodes( const HuffmanTable& htable )
+    {
+        HuffmanCodeTable codes;
+        codes.fill( HuffmanCode{ 0, 0 } );
+
+        // Codes of a given length are consecutive integers, and the first
+        // code of the next length is obtained by appending a 0 bit to the
+        // code following the last one of the current length.
+        UInt16 code = 0;
+
+        for ( auto i = 0; i < 16; ++i )
+        {
+            for ( auto&& symbol : htable[i].second )
+            {
+                codes[symbol].code = code++;
+                codes[symbol].length = i + 1;
+            }
+
+            code <<= 1;
+        }
+
+        return codes;
+    }
+    
+    HuffmanDecodeTable generateHuffmanDecodeTable( const HuffmanTable& htable )
+    {
+        HuffmanDecodeTable table;
+        table.lookup.fill( 0 );
+        table.maxCode.fill( -1 );
+        table.valOffset.fill( 0 );
+        table.symbols.fill( 0 );
+        
+        // Same canonical code assignment as generateHuffmanCodes()
+        Int32 code = 0;
+        int k = 0;
+        
+        for ( auto length = 1; length <= 16; ++length )
+        {
+            const auto& symbols = htable[length - 1].second;
+            
+            if ( !symbols.empty() )
+            {
+                table.valOffset[length] = k - code;
+                
+                for ( auto&& symbol : symbols )
+                {
+                    // Malformed tables can hold more codes than fit in `length` bits
+                    if ( k == 256 || code >= ( 1 << length ) )
+                        break;
+                    
+                    // Every HUFFMAN_LOOKUP_BITS bit value starting with a short code maps to it
+                    if ( length <= HUFFMAN_LOOKUP_BITS )
+                    {
+                        int shift = HUFFMAN_LOOKUP_BITS - length;
+                        
+                        for ( auto i = 0; i < ( 1 << shift ); ++i )
+                            table.lookup[ ( code << shift ) | i ] = UInt16( ( length << 8 ) | symbol );
+                    }
+                    
+                    table.symbols[k++] = symbol;
+                    code++;
+                }
+                
+                table.maxCode[length] = code - 1;
+            }
+            
+            code <<= 1;
+        }
+        
+        return table;
+    }
+    
+    HuffmanTable generateOptimalHuffmanTable( const SymbolFrequencies& frequencies )
+    {
+        // Code sizes can grow up to 32 bits before being limited to 16
+        const int MAX_CODE_SIZE = 32;
+        
+        // Symbol 256 is reserved so that no symbol gets the all 1-bits code
+        std::array<long, 257> freq;
+        std::array<int, 257> codeSize;
+        std::array<int, 257> others;
+        
+        std::copy( frequencies.begin(), frequencies.end(), freq.begin() );
+        freq[256] = 1;
+        codeSize.fill( 0 );
+        others.fill( -1 );
+        
+        // Repeatedly merge the two least frequent symbols (Figure K.1)
+        while ( true )
+        {
+            int c1 = -1, c2 = -1;
+            long v1 = 1000000000L, v2 = 1000000000L;
+            
+            // Ties go to the larger symbol value, so the reserved symbol gets the longest code
+            for ( auto i = 0; i <= 256; ++i )
+            {
+                if ( freq[i] > 0 && freq[i] <= v1 )
+                {
+                    v1 = freq[i];
+                    c1 = i;
+                }
+            }
+            
+            for ( auto i = 0; i <= 256; ++i )
+            {
+                if ( freq[i] > 0 && freq[i] <= v2 && i != c1 )
+                {
+                    v2 = freq[i];
+                    c2 = i;
+                }
+            }
+            
+            // Only one tree is left
+            if ( c2 < 0 )
+                break;
+            
+            freq[c1] += freq[c2];
+            freq[c2] = 0;
+            
+            // Increment the code sizes of everything in c1's and c2's branches
+            codeSize[c1]++;
+            while ( others[c1] >= 0 )
+            {
+                c1 = others[c1];
+                codeSize[c1]++;
+            }
+            
+            // Chain c2 onto c1's branch
+            others[c1] = c2;
+            
+            codeSize[c2]++;
+            while ( others[c2] >= 0 )
+            {
+                c2 = others[c2];
+                codeSize[c2]++;
+            }
+        }
+        
+        // Count the number of symbols of each code size (Figure K.2)
+        std::array<int, MAX_CODE_SIZE + 1> bits;
+        bits.fill( 0 );
+        
+        for ( auto i = 0; i <= 256; ++i )
+        {
+            if ( codeSize[i] > 0 )
+                bits[ std::min( codeSize[i], MAX_CODE_SIZE ) ]++;
+        }
+        
+        // Limit the code sizes to 16 bits (Figure K.3). Two symbols of the
+        // longest size are replaced by one of size - 1, and a code of the
+        // next shorter size in use is split to make room for the second.
+        for ( auto i = MAX_CODE_SIZE; i > 16; --i )
+        {
+            while ( bits[i] > 0 )
+            {
+                int j = i - 2;
+                while ( bits[j] == 0 )
+                    j--;
+                
+                bits[i] -= 2;
+                bits[i - 1]++;
+                bits[j + 1] += 2;
+                bits[j]--;
+            }
+        }
+        
+        // Remove the reserved symbol, which has the longest code
+        int i = 16;
+        while ( bits[i] == 0 )
+            i--;
+        bits[i]--;
+        
+        // Sort the symbols by code size, and by value within the same size (Figure K.4).
+        // The code sizes were adjusted by count only, so the symbols are assigned
+        // to the sizes in order of their original code sizes.
+        std::vector<UInt8> symbols;
+        
+        for ( auto size = 1; size <= MAX_CODE_SIZE; ++size )
+        {
+            for ( auto symbol = 0; symbol < 256; ++symbol )
+            {
+                if ( codeSize[symbol] == size )
+                    symbols.push_back( symbol );
+            }
+        }
+        
+        HuffmanTable htable;
+        int k = 0;
+        
+        for ( auto len = 1; len <= 16; ++len )
+        {
+            htable[len - 1].first = bits[len];
+            htable[len - 1].second.assign( symbols.begin() + k, symbols.begin() + k + bits[len] );
+            k += bits[len];
+        }
+        
+        return htable;
+    }
+}
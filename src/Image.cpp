@@ -1,6 +1,7 @@
-#include <arpa/inet.h> // htons
 #include <string>
 #include <cmath>
+#include <cctype>
+#include <algorithm>
 
 #include "Image.hpp"
 #include "Logger.hpp"
@@ -9,6 +10,7 @@ namespace kpeg
 {
     Image::Image() :
      m_filename{""} ,
+     m_pixelType{PixelType::RGB8} ,
      m_pixelPtr{nullptr} ,
      m_flPixelPtr{nullptr} ,
      m_JPEGversion{""} ,
@@ -17,72 +19,19 @@ namespace kpeg
         LOG(Logger::Level::INFO) << "Created new Image object" << std::endl;
     }
     
-    void Image::createImageFromMCUs( const std::vector<MCU>& MCUVector )
+    void Image::createPixels()
     {
-        LOG(Logger::Level::INFO) << "Creating Image from MCU vector..." << std::endl;
-        
-        int mcuNum = 0;
-        
-        int jpegWidth = m_width % 8 == 0 ? m_width : m_width + 8 - ( m_width % 8 );
-        int jpegHeight = m_height % 8 == 0 ? m_height : m_height + 8 - ( m_height % 8 );
-        
-//         std::cout << "MCU VEc: " << MCUVector.size() << std::endl;
-//         
-//         for ( int i = 0; i < MCUVector.size(); ++i )
-//         {
-//             auto pb = MCUVector[i].getAllMatrices();
-//             std::cout << "i: " << i + 1 << std::endl;
-//             
-//             for ( auto&& m : pb )
-//             {
-//                 for ( auto&& row : m )
-//                 {
-//                     for ( auto&& v : row )
-//                         std::cout << v << " "; 
-//                     std::cout << std::endl;
-//                 }
-//                 std::cout << std::endl;
-//             }
-//         }
-        
-        // Create a pixel pointer of size (Image width) x (Image height)
-        m_pixelPtr = std::make_shared<std::vector<std::vector<Pixel>>>( jpegHeight, std::vector<Pixel>( jpegWidth, Pixel() ) );
-        
-        for ( int y = 0; y <= jpegHeight - 8; y += 8 )
+        // Gray pixels are a single plane of bytes, the pixels of the other type are released
+        if ( m_pixelType == PixelType::GRAY8 )
         {
-            for ( int x = 0; x <= jpegWidth - 8; x += 8 )
-            {
-                auto pixelBlock = MCUVector[mcuNum].getAllMatrices();
-                //std::cout << "MCU#: " << mcuNum << std::endl;
-                
-                for ( int v = 0; v < 8; ++v )
-                {
-                    for ( int u = 0; u < 8; ++u )
-                    {
-                        (*m_pixelPtr)[y + v][x + u].comp[0] = pixelBlock[0][v][u]; // R
-                        (*m_pixelPtr)[y + v][x + u].comp[1] = pixelBlock[1][v][u]; // G
-                        (*m_pixelPtr)[y + v][x + u].comp[2] = pixelBlock[2][v][u]; // B
-                    }
-                }
-            
-                mcuNum++;
-            }
-        }
-        
-        if ( m_width != jpegWidth )
-        {
-            for ( auto&& row : *m_pixelPtr )
-                for ( int c = 0; c < 8 - m_width % 8; ++c )
-                    row.pop_back();
+            m_grayPixels.assign( m_width * m_height, 0 );
+            m_pixelPtr = nullptr;
+            return;
         }
         
-        if ( m_height != jpegHeight )
-        {
-            for ( int c = 0; c < 8 - m_height % 8; ++c )
-                m_pixelPtr->pop_back();
-        }        
-
-        LOG(Logger::Level::INFO) << "Finished created Image from MCU [OK]" << std::endl;
+        // Create a pixel pointer of size (Image width) x (Image height)
+        m_pixelPtr = std::make_shared<std::vector<std::vector<Pixel>>>( m_height, std::vector<Pixel>( m_width, Pixel() ) );
+        std::vector<UInt8>().swap( m_grayPixels );
     }
     
     PixelPtr Image::getPixelPtr()
@@ -90,30 +39,60 @@ namespace kpeg
         return m_pixelPtr;
     }
     
+    UInt8* Image::getGrayRow( const std::size_t y )
+    {
+        return &m_grayPixels[y * m_width];
+    }
+    
+    void Image::setPixelType( const PixelType type )
+    {
+        m_pixelType = type;
+    }
+    
+    PixelType Image::getPixelType() const
+    {
+        return m_pixelType;
+    }
+    
     FPixelPtr Image::getFlPixelPtr()
     {
         return m_flPixelPtr;
     }
-
+    
     const unsigned int Image::getWidth() const
     {
         return m_width;
     }
-
+    
     const unsigned int Image::getHeight() const
     {
         return m_height;
     }
-
+    
     const bool Image::dumpRawData( const std::string& filename )
     {
-        if ( m_pixelPtr == nullptr )
+        // Pick the format from the file extension, PPM by default
+        std::size_t extPos = filename.rfind( '.' );
+        std::string extension = extPos == std::string::npos ? "" : filename.substr( extPos );
+        
+        if ( extension == ".pgm" )
+            return dumpRawData( filename, RawImageFormat::PGM );
+        
+        if ( extension == ".pam" )
+            return dumpRawData( filename, RawImageFormat::PAM );
+        
+        return dumpRawData( filename, RawImageFormat::PPM );
+    }
+    
+    const bool Image::dumpRawData( const std::string& filename, const RawImageFormat format )
+    {
+        if ( m_pixelType == PixelType::GRAY8 ? m_grayPixels.empty() : m_pixelPtr == nullptr )
         {
             LOG(Logger::Level::ERROR) << "Unable to create dump file \'" + filename + "\', Invalid pixel pointer" << std::endl;
             return false;
         }
         
-        std::ofstream dumpFile( filename, std::ios::out );
+        std::ofstream dumpFile( filename, std::ios::out | std::ios::binary );
         
         if ( !dumpFile.is_open() || !dumpFile.good() )
         {
@@ -121,17 +100,101 @@ namespace kpeg
             return false;
         }
         
-        dumpFile << "P6" << std::endl;
-        dumpFile << "# PPM dump created using libKPEG: https://github.com/TheIllusionistMirage/libKPEG" << std::endl;
-        dumpFile << m_width << " " << m_height << std::endl;
-        dumpFile << 255 << std::endl;
+        // PGM holds the luminance only, PAM adds an opaque alpha channel
+        int channels = 3;
+        std::string header;
+        
+        switch ( format )
+        {
+            case RawImageFormat::PPM:
+            {
+                header = "P6\n# PPM dump created using libKPEG: https://github.com/TheIllusionistMirage/libKPEG\n"
+                       + std::to_string( m_width ) + " " + std::to_string( m_height ) + "\n255\n";
+                break;
+            }
+            
+            case RawImageFormat::PGM:
+            {
+                channels = 1;
+                header = "P5\n# PGM dump created using libKPEG: https://github.com/TheIllusionistMirage/libKPEG\n"
+                       + std::to_string( m_width ) + " " + std::to_string( m_height ) + "\n255\n";
+                break;
+            }
+            
+            case RawImageFormat::PAM:
+            {
+                channels = 4;
+                header = "P7\nWIDTH " + std::to_string( m_width ) + "\nHEIGHT " + std::to_string( m_height )
+                       + "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+                break;
+            }
+        }
+        
+        dumpFile.write( header.data(), header.size() );
+        
+        // Rows are packed into a buffer of about 1 MB, which is written out in one go when full
+        const std::size_t rowBytes = m_width * channels;
+        const std::size_t rowsPerWrite = std::max<std::size_t>( 1, ( 1 << 20 ) / std::max<std::size_t>( 1, rowBytes ) );
+        
+        std::vector<UInt8> buffer( rowBytes * rowsPerWrite );
+        std::size_t bufferedRows = 0;
+        
+        auto clamp = []( const int value ) -> UInt8 { return value < 0 ? 0 : value > 255 ? 255 : value; };
+        
+        for ( std::size_t y = 0; y < m_height; ++y )
+        {
+            UInt8* dst = buffer.data() + bufferedRows * rowBytes;
+            
+            // Gray pixels are copied as is to a PGM, & to each of R, G & B otherwise
+            if ( m_pixelType == PixelType::GRAY8 )
+            {
+                const UInt8* gray = getGrayRow( y );
+                
+                for ( std::size_t x = 0; x < m_width; ++x )
+                {
+                    for ( int c = 0; c < std::min( channels, 3 ); ++c )
+                        *dst++ = gray[x];
+                    
+                    if ( channels == 4 )
+                        *dst++ = 255;
+                }
+            }
+            else
+            {
+                for ( auto&& pixel : (*m_pixelPtr)[y] )
+                {
+                    int R = pixel.comp[RGBComponents::RED];
+                    int G = pixel.comp[RGBComponents::GREEN];
+                    int B = pixel.comp[RGBComponents::BLUE];
+                    
+                    if ( channels == 1 )
+                    {
+                        *dst++ = clamp( std::lround( 0.299f * R + 0.587f * G + 0.114f * B ) );
+                        continue;
+                    }
+                    
+                    *dst++ = clamp( R );
+                    *dst++ = clamp( G );
+                    *dst++ = clamp( B );
+                    
+                    if ( channels == 4 )
+                        *dst++ = 255;
+                }
+            }
+            
+            if ( ++bufferedRows == rowsPerWrite )
+            {
+                dumpFile.write( reinterpret_cast<const char *>( buffer.data() ), bufferedRows * rowBytes );
+                bufferedRows = 0;
+            }
+        }
+        
+        dumpFile.write( reinterpret_cast<const char *>( buffer.data() ), bufferedRows * rowBytes );
         
-        for ( auto&& row : *m_pixelPtr )
+        if ( !dumpFile.good() )
         {
-            for ( auto&& pixel : row )
-                dumpFile << (UInt8)pixel.comp[RGBComponents::RED]
-                         << (UInt8)pixel.comp[RGBComponents::GREEN]
-                         << (UInt8)pixel.comp[RGBComponents::BLUE];
+            LOG(Logger::Level::ERROR) << "An error occurred while writing dump file \'" + filename + "\'." << std::endl;
+            return false;
         }
         
         LOG(Logger::Level::INFO) << "Raw image data dumped to file: \'" + filename + "\'." << std::endl;
@@ -139,6 +202,47 @@ namespace kpeg
         return true;
     }
     
+    /**
+     * @brief Read the next unsigned integer of a PNM header, skipping
+     * whitespace and comments (from a '#' till the end of the line).
+     */
+    static bool readPNMHeaderValue( std::istream& file, unsigned int& value )
+    {
+        int ch = file.get();
+        
+        while ( ch != EOF )
+        {
+            if ( ch == '#' )
+            {
+                while ( ch != EOF && ch != '\n' && ch != '\r' )
+                    ch = file.get();
+            }
+            else if ( !std::isspace( ch ) )
+                break;
+            else
+                ch = file.get();
+        }
+        
+        if ( !std::isdigit( ch ) )
+            return false;
+        
+        value = 0;
+        
+        while ( std::isdigit( ch ) )
+        {
+            value = value * 10 + ( ch - '0' );
+            
+            if ( value > 0xFFFFFF )
+                return false;
+            
+            ch = file.get();
+        }
+        
+        // A single whitespace character ends the value. After the
+        // maximum value, it's the last byte before the raster.
+        return ch != EOF && std::isspace( ch );
+    }
+    
     const bool Image::readRawData( const std::string& filename )
     {
         std::ifstream rawImgFile( filename, std::ios::in | std::ios::binary );
@@ -149,86 +253,76 @@ namespace kpeg
             return false;
         }
         
-        UInt16 magicBytes;
-        UInt8 byte;
-        
-        rawImgFile.read( reinterpret_cast<char *>( &magicBytes ), 2 );
-        magicBytes = htons( magicBytes );
+        // P6 is a binary RGB pixmap (PPM), P5 a binary graymap (PGM)
+        char magic[2] = { 0, 0 };
+        rawImgFile.read( magic, 2 );
         
-        if ( magicBytes != 0x5036 )
+        if ( !rawImgFile.good() || magic[0] != 'P' || ( magic[1] != '6' && magic[1] != '5' ) )
         {
             LOG(Logger::Level::ERROR) << "Invalid PPM file: \'" + filename + "\'" << std::endl;
             return false;
         }
         
-        // Check for comments if any
-        rawImgFile >> byte;
+        const int channels = magic[1] == '6' ? 3 : 1;
         
-        // If '#' encountered, rest of the values till a LF are ignored
-        if ( byte == 0x23 )
+        // Extract the image dimensions (width x height) & the maximum intensity level
+        unsigned int width, height, maxIntensity;
+        
+        if ( !readPNMHeaderValue( rawImgFile, width ) ||
+             !readPNMHeaderValue( rawImgFile, height ) ||
+             !readPNMHeaderValue( rawImgFile, maxIntensity ) ||
+             width == 0 || height == 0 || maxIntensity == 0 || maxIntensity > 0xFFFF )
         {
-            do 
-            {
-                rawImgFile >> std::noskipws >> byte;
-            }
-            while ( byte != 0x0A ); // CR encountered
+            LOG(Logger::Level::ERROR) << "Invalid PPM header: \'" + filename + "\'" << std::endl;
+            return false;
         }
         
-        // Extract the image dimensions (width x height)
-        unsigned int width;
-        unsigned int height;
+        LOG(Logger::Level::INFO) << "Width: " << width << std::endl;
+        LOG(Logger::Level::INFO) << "Height: " << height << std::endl;
+        LOG(Logger::Level::INFO) << "Maximum intensity: " << maxIntensity << std::endl;
         
-        rawImgFile >> std::skipws >> width;
-        rawImgFile >> std::skipws >> height;
+        // Samples are 1 byte, or 2 bytes (MSB first) if the maximum is above 255
+        const int sampleBytes = maxIntensity > 255 ? 2 : 1;
+        const std::size_t rowBytes = std::size_t( width ) * channels * sampleBytes;
         
-        m_width = width;
-        m_height = height;
+        // Read the whole raster at once
+        std::vector<UInt8> raster( rowBytes * height );
+        rawImgFile.read( reinterpret_cast<char *>( raster.data() ), raster.size() );
         
-        LOG(Logger::Level::INFO) << "Width: " << width << std::endl;
-        LOG(Logger::Level::INFO) << "Height: " << height << std::endl;
+        if ( std::size_t( rawImgFile.gcount() ) != raster.size() )
+        {
+            LOG(Logger::Level::ERROR) << "PPM file is truncated: \'" + filename + "\'" << std::endl;
+            return false;
+        }
         
+        m_width = width;
+        m_height = height;
+        m_pixelType = channels == 1 ? PixelType::GRAY8 : PixelType::RGB8;
         m_flPixelPtr = std::make_shared<std::vector<std::vector<FPixel>>>( height, std::vector<FPixel>( width, FPixel() ) );
-        //m_flPixelPtr->resize( height, std::vector<FPixel>( width, FPixel() ) );
-        int row = 0, col = 0;
-        
-        // Extract the maximum intensity level
-        unsigned int maxIntensity;
-        rawImgFile >> std::skipws >> maxIntensity;
-        LOG(Logger::Level::INFO) << "Maximum intensity: " << maxIntensity << std::endl;
         
-        int curPos = rawImgFile.tellg();
+        // Samples are scaled from [0, maxIntensity] to [0, 255]
+        const float scale = 255.f / maxIntensity;
         
-        while ( (int)rawImgFile.tellg() - curPos < width * height * 3 * 3 )
+        for ( unsigned int y = 0; y < height; ++y )
         {
-            UInt8 R, G, B;
-            
-            rawImgFile >> std::skipws >> R;
-            rawImgFile >> std::skipws >> G;
-            rawImgFile >> std::skipws >> B;
+            const UInt8* src = raster.data() + y * rowBytes;
+            auto& row = (*m_flPixelPtr)[y];
             
-            (*m_flPixelPtr)[row][col++] = FPixel( R, G, B );
-            
-            if ( col == width )
+            for ( unsigned int x = 0; x < width; ++x )
             {
-                row++;
-                col = 0;
-            }
-            
-            if ( row == height )
-            {
-                break;
+                for ( int c = 0; c < 3; ++c )
+                {
+                    // Gray samples are replicated to all the three components
+                    std::size_t index = ( std::size_t( x ) * channels + ( channels == 3 ? c : 0 ) ) * sampleBytes;
+                    unsigned int sample = sampleBytes == 2 ? ( src[index] << 8 ) | src[index + 1] : src[index];
+                    
+                    row[x].comp[c] = maxIntensity == 255 ? sample : std::round( sample * scale );
+                }
             }
         }
         
-//         for ( auto&& row : *m_flPixelPtr )
-//         {
-//             for ( auto&& pix : row )
-//                 std::cout << pix.comp[0] << "," << pix.comp[1] << "," << pix.comp[2] << "\t";
-//             std::cout << std::endl;
-//         }
-        
         LOG(Logger::Level::INFO) << "Reading raw image data complete" << std::endl;
-        rawImgFile.close();        
+        rawImgFile.close();
         m_filename = filename;
         
         return true;
@@ -238,12 +332,12 @@ namespace kpeg
     {
         m_filename = filename;
     }
-
+    
     void Image::setJPEGVersion(const std::string& version)
     {
         m_JPEGversion = version;
     }
-
+    
     void Image::setComment(const std::string& comment)
     {
         m_comment = comment;
@@ -291,7 +385,7 @@ namespace kpeg
         
         char sign = bitStr[0];
         int factor = sign == '0' ? -1 : 1;
-            
+        
         for ( auto i = 0; i < bitStr.size(); ++i )
         {
             if ( bitStr[i] == sign )
@@ -307,4 +401,12 @@ namespace kpeg
             return 0;
         return std::log2( std::abs( value ) ) + 1;
     }
+    
+    const UInt16 getValueBits( const Int16 value, const Int16 category )
+    {
+        if ( value >= 0 )
+            return value;
+        
+        return UInt16( value + ( 1 << category ) - 1 );
+    }
 }
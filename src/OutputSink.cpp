@@ -0,0 +1,123 @@
+#include <cstring>
+#include <utility>
+
+#include "OutputSink.hpp"
+
+namespace kpeg
+{
+    OutputSink::~OutputSink()
+    {
+    }
+    
+    bool OutputSink::flush()
+    {
+        return true;
+    }
+    
+    ///// MemorySink /////
+    
+    bool MemorySink::write( const UInt8* data, const std::size_t size )
+    {
+        m_buffer.insert( m_buffer.end(), data, data + size );
+        return true;
+    }
+    
+    const std::vector<UInt8>& MemorySink::getBuffer() const
+    {
+        return m_buffer;
+    }
+    
+    std::vector<UInt8> MemorySink::releaseBuffer()
+    {
+        std::vector<UInt8> buffer;
+        buffer.swap( m_buffer );
+        return buffer;
+    }
+    
+    ///// FixedBufferSink /////
+    
+    FixedBufferSink::FixedBufferSink( UInt8* buffer, const std::size_t capacity ) :
+     m_buffer{buffer} ,
+     m_capacity{capacity} ,
+     m_size{0}
+    {
+    }
+    
+    bool FixedBufferSink::write( const UInt8* data, const std::size_t size )
+    {
+        if ( size > m_capacity - m_size )
+            return false;
+        
+        std::memcpy( m_buffer + m_size, data, size );
+        m_size += size;
+        
+        return true;
+    }
+    
+    std::size_t FixedBufferSink::getSize() const
+    {
+        return m_size;
+    }
+    
+    ///// FileSink /////
+    
+    FileSink::FileSink( const std::string& filename, const std::size_t bufferSize ) :
+     m_file{ filename, std::ios::out | std::ios::binary } ,
+     m_bufferSize{bufferSize}
+    {
+        m_buffer.reserve( m_bufferSize );
+    }
+    
+    FileSink::~FileSink()
+    {
+        flush();
+    }
+    
+    bool FileSink::isOpen() const
+    {
+        return m_file.is_open() && m_file.good();
+    }
+    
+    bool FileSink::write( const UInt8* data, const std::size_t size )
+    {
+        if ( m_buffer.size() + size > m_bufferSize )
+        {
+            if ( !flush() )
+                return false;
+            
+            // Chunks larger than the buffer (usually the scan data) are written directly
+            if ( size > m_bufferSize )
+            {
+                m_file.write( reinterpret_cast<const char *>( data ), size );
+                return m_file.good();
+            }
+        }
+        
+        m_buffer.insert( m_buffer.end(), data, data + size );
+        return true;
+    }
+    
+    bool FileSink::flush()
+    {
+        if ( !m_buffer.empty() )
+        {
+            m_file.write( reinterpret_cast<const char *>( m_buffer.data() ), m_buffer.size() );
+            m_buffer.clear();
+        }
+        
+        m_file.flush();
+        return m_file.good();
+    }
+    
+    ///// CallbackSink /////
+    
+    CallbackSink::CallbackSink( WriteCallback callback ) :
+     m_callback{ std::move( callback ) }
+    {
+    }
+    
+    bool CallbackSink::write( const UInt8* data, const std::size_t size )
+    {
+        return m_callback( data, size );
+    }
+}
@@ -0,0 +1,220 @@
+#include <algorithm>
+
+#include "TaskScheduler.hpp"
+
+namespace kpeg
+{
+    // The scheduler & deque of the worker running on this thread, if any
+    static thread_local TaskScheduler* t_scheduler = nullptr;
+    static thread_local std::size_t t_queueIndex = 0;
+    
+    TaskGroup::TaskGroup() :
+     m_pending{0} ,
+     m_queued{0} ,
+     m_finished{0}
+    {
+    }
+    
+    bool TaskGroup::isDone() const
+    {
+        return m_pending.load( std::memory_order_acquire ) == 0;
+    }
+    
+    TaskScheduler::TaskScheduler( const std::size_t threadCount ) :
+     m_nextQueue{0} ,
+     m_queuedCount{0} ,
+     m_stop{false}
+    {
+        std::size_t count = threadCount;
+        
+        if ( count == 0 )
+            count = std::max( 1u, std::thread::hardware_concurrency() );
+        
+        for ( std::size_t i = 0; i < count; ++i )
+            m_queues.emplace_back( new WorkerQueue );
+        
+        for ( std::size_t i = 0; i < count; ++i )
+            m_workers.emplace_back( &TaskScheduler::workerLoop, this, i );
+    }
+    
+    TaskScheduler::~TaskScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_sleepMutex );
+            m_stop = true;
+        }
+        
+        m_sleepCondition.notify_all();
+        
+        for ( auto&& worker : m_workers )
+            worker.join();
+    }
+    
+    void TaskScheduler::submit( TaskGroup& group, std::function<void()> task )
+    {
+        group.m_pending.fetch_add( 1, std::memory_order_relaxed );
+        group.m_queued.fetch_add( 1, std::memory_order_relaxed );
+        
+        std::size_t index = t_scheduler == this ? t_queueIndex : m_nextQueue.fetch_add( 1, std::memory_order_relaxed ) % m_queues.size();
+        
+        // Counted first, so the count never drops below the tasks queued. Taking
+        // the lock orders the count with a worker about to sleep on it
+        {
+            std::lock_guard<std::mutex> lock( m_sleepMutex );
+            m_queuedCount.fetch_add( 1, std::memory_order_release );
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock( m_queues[index]->mutex );
+            m_queues[index]->tasks.push_back( { std::move( task ), &group } );
+        }
+        
+        m_sleepCondition.notify_one();
+        
+        // Wake a thread waiting on the group, to run the task itself
+        {
+            std::lock_guard<std::mutex> lock( group.m_mutex );
+        }
+        
+        group.m_condition.notify_all();
+    }
+    
+    void TaskScheduler::wait( TaskGroup& group )
+    {
+        while ( true )
+        {
+            Task task;
+            
+            if ( takeTask( t_scheduler == this ? t_queueIndex : 0, task, &group ) )
+            {
+                runTask( task );
+                continue;
+            }
+            
+            // The last check is made under the lock, the group may be
+            // destroyed as soon as this returns
+            std::unique_lock<std::mutex> lock( group.m_mutex );
+            group.m_condition.wait( lock, [&group]()
+            {
+                return group.m_pending.load( std::memory_order_acquire ) == 0 ||
+                       group.m_queued.load( std::memory_order_acquire ) > 0;
+            } );
+            
+            if ( group.m_pending.load( std::memory_order_acquire ) == 0 )
+                return;
+        }
+    }
+    
+    void TaskScheduler::waitForTask( TaskGroup& group )
+    {
+        Task task;
+        
+        if ( takeTask( t_scheduler == this ? t_queueIndex : 0, task, &group ) )
+        {
+            runTask( task );
+            return;
+        }
+        
+        std::unique_lock<std::mutex> lock( group.m_mutex );
+        const std::size_t finished = group.m_finished;
+        
+        group.m_condition.wait( lock, [&group, finished]()
+        {
+            return group.m_finished != finished ||
+                   group.m_pending.load( std::memory_order_acquire ) == 0 ||
+                   group.m_queued.load( std::memory_order_acquire ) > 0;
+        } );
+    }
+    
+    std::size_t TaskScheduler::getThreadCount() const
+    {
+        return m_workers.size();
+    }
+    
+    void TaskScheduler::workerLoop( const std::size_t index )
+    {
+        t_scheduler = this;
+        t_queueIndex = index;
+        
+        while ( true )
+        {
+            Task task;
+            
+            if ( takeTask( index, task, nullptr ) )
+            {
+                runTask( task );
+                continue;
+            }
+            
+            std::unique_lock<std::mutex> lock( m_sleepMutex );
+            m_sleepCondition.wait( lock, [this]() { return m_stop || m_queuedCount.load( std::memory_order_acquire ) > 0; } );
+            
+            // Drain the deques before stopping
+            if ( m_stop && m_queuedCount.load( std::memory_order_acquire ) == 0 )
+                return;
+        }
+    }
+    
+    bool TaskScheduler::takeTask( const std::size_t index, Task& task, const TaskGroup* group )
+    {
+        if ( m_queuedCount.load( std::memory_order_acquire ) == 0 )
+            return false;
+        
+        if ( group != nullptr && group->m_queued.load( std::memory_order_acquire ) == 0 )
+            return false;
+        
+        for ( std::size_t i = 0; i < m_queues.size(); ++i )
+        {
+            WorkerQueue& queue = *m_queues[ ( index + i ) % m_queues.size() ];
+            std::lock_guard<std::mutex> lock( queue.mutex );
+            
+            if ( queue.tasks.empty() )
+                continue;
+            
+            // Own tasks newest first, stolen ones oldest first
+            bool own = i == 0 && t_scheduler == this;
+            auto isWanted = [group]( const Task& queued ) { return group == nullptr || queued.group == group; };
+            
+            if ( own )
+            {
+                auto found = std::find_if( queue.tasks.rbegin(), queue.tasks.rend(), isWanted );
+                
+                if ( found == queue.tasks.rend() )
+                    continue;
+                
+                task = std::move( *found );
+                queue.tasks.erase( std::next( found ).base() );
+            }
+            else
+            {
+                auto found = std::find_if( queue.tasks.begin(), queue.tasks.end(), isWanted );
+                
+                if ( found == queue.tasks.end() )
+                    continue;
+                
+                task = std::move( *found );
+                queue.tasks.erase( found );
+            }
+            
+            task.group->m_queued.fetch_sub( 1, std::memory_order_relaxed );
+            m_queuedCount.fetch_sub( 1, std::memory_order_relaxed );
+            return true;
+        }
+        
+        return false;
+    }
+    
+    void TaskScheduler::runTask( Task& task )
+    {
+        task.function();
+        
+        // Counted down under the lock, a thread waiting on the group
+        // can't return & destroy it before it's been notified
+        TaskGroup& group = *task.group;
+        std::lock_guard<std::mutex> lock( group.m_mutex );
+        
+        group.m_finished++;
+        group.m_pending.fetch_sub( 1, std::memory_order_release );
+        group.m_condition.notify_all();
+    }
+}
@@ -0,0 +1,56 @@
+#include "ThreadPool.hpp"
+
+namespace kpeg
+{
+    ThreadPool::ThreadPool( const std::size_t threadCount ) :
+     m_stop{false}
+    {
+        std::size_t count = threadCount;
+        
+        if ( count == 0 )
+            count = std::max( 1u, std::thread::hardware_concurrency() );
+        
+        for ( std::size_t i = 0; i < count; ++i )
+            m_workers.emplace_back( &ThreadPool::workerLoop, this );
+    }
+    
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stop = true;
+        }
+        
+        m_condition.notify_all();
+        
+        for ( auto&& worker : m_workers )
+            worker.join();
+    }
+    
+    std::size_t ThreadPool::getThreadCount() const
+    {
+        return m_workers.size();
+    }
+    
+    void ThreadPool::workerLoop()
+    {
+        while ( true )
+        {
+            std::function<void()> task;
+            
+            {
+                std::unique_lock<std::mutex> lock( m_mutex );
+                m_condition.wait( lock, [this]() { return m_stop || !m_tasks.empty(); } );
+                
+                // Drain the queue before stopping
+                if ( m_stop && m_tasks.empty() )
+                    return;
+                
+                task = std::move( m_tasks.front() );
+                m_tasks.pop();
+            }
+            
+            task();
+        }
+    }
+}
@@ -0,0 +1,365 @@
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "Transcoder.hpp"
+#include "Logger.hpp"
+
+namespace kpeg
+{
+    bool getLosslessTransform( const std::string& name, LosslessTransform& transform )
+    {
+        static const std::pair<const char*, LosslessTransform> names[] =
+        {
+            { "flip-h"     , TRANSFORM_FLIP_HORIZONTAL } ,
+            { "flip-v"     , TRANSFORM_FLIP_VERTICAL } ,
+            { "transpose"  , TRANSFORM_TRANSPOSE } ,
+            { "transverse" , TRANSFORM_TRANSVERSE } ,
+            { "rot90"      , TRANSFORM_ROTATE_90 } ,
+            { "rot180"     , TRANSFORM_ROTATE_180 } ,
+            { "rot270"     , TRANSFORM_ROTATE_270 }
+        };
+        
+        for ( auto&& entry : names )
+        {
+            if ( name == entry.first )
+            {
+                transform = entry.second;
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+    bool transformCoefficients( const JPEGCoefficients& source,
+                                const LosslessTransform transform,
+                                JPEGCoefficients& result )
+    {
+        // Every transformation is a transposition (optional), followed
+        // by a horizontal and/or vertical flip of the transposed image
+        const bool transpose = transform == TRANSFORM_TRANSPOSE || transform == TRANSFORM_TRANSVERSE ||
+                               transform == TRANSFORM_ROTATE_90 || transform == TRANSFORM_ROTATE_270;
+        const bool flipH = transform == TRANSFORM_FLIP_HORIZONTAL || transform == TRANSFORM_TRANSVERSE ||
+                           transform == TRANSFORM_ROTATE_90 || transform == TRANSFORM_ROTATE_180;
+        const bool flipV = transform == TRANSFORM_FLIP_VERTICAL || transform == TRANSFORM_TRANSVERSE ||
+                           transform == TRANSFORM_ROTATE_180 || transform == TRANSFORM_ROTATE_270;
+        
+        if ( source.components.empty() || source.width <= 0 || source.height <= 0 )
+        {
+            LOG(Logger::Level::ERROR) << "No coefficients to transform" << std::endl;
+            return false;
+        }
+        
+        int maxHSampFactor = 1, maxVSampFactor = 1;
+        
+        for ( auto&& component : source.components )
+        {
+            maxHSampFactor = std::max( maxHSampFactor, transpose ? component.VSampFactor : component.HSampFactor );
+            maxVSampFactor = std::max( maxVSampFactor, transpose ? component.HSampFactor : component.VSampFactor );
+        }
+        
+        const int MCUWidth = 8 * maxHSampFactor;
+        const int MCUHeight = 8 * maxVSampFactor;
+        
+        int width = transpose ? source.height : source.width;
+        int height = transpose ? source.width : source.height;
+        
+        // The partial MCU at a mirrored edge would end up at the opposite
+        // edge, where the decoder can't crop it away, so it is dropped
+        if ( flipH )
+            width -= width % MCUWidth;
+        if ( flipV )
+            height -= height % MCUHeight;
+        
+        if ( width == 0 || height == 0 )
+        {
+            LOG(Logger::Level::ERROR) << "Image is smaller than an MCU, nothing left after trimming the partial MCUs" << std::endl;
+            return false;
+        }
+        
+        if ( width != ( transpose ? source.height : source.width ) || height != ( transpose ? source.width : source.height ) )
+        {
+            LOG(Logger::Level::INFO) << "Partial MCUs trimmed, output image is " << width << "x" << height << std::endl;
+        }
+        
+        const int MCUCols = ( width + MCUWidth - 1 ) / MCUWidth;
+        const int MCURows = ( height + MCUHeight - 1 ) / MCUHeight;
+        
+        // Sign of each coefficient ( v, u ) of a transformed block, mirroring
+        // a block negates its odd horizontal (or vertical) frequencies
+        Int16 sign[64];
+        
+        for ( int v = 0; v < 8; ++v )
+            for ( int u = 0; u < 8; ++u )
+                sign[v * 8 + u] = ( flipH && u % 2 ) != ( flipV && v % 2 ) ? -1 : 1;
+        
+        result.width = width;
+        result.height = height;
+        result.QTables = source.QTables;
+        result.components.clear();
+        
+        if ( transpose )
+        {
+            for ( auto&& QTable : result.QTables )
+                for ( int v = 0; v < 8; ++v )
+                    for ( int u = v + 1; u < 8; ++u )
+                        std::swap( QTable[v * 8 + u], QTable[u * 8 + v] );
+        }
+        
+        for ( auto&& input : source.components )
+        {
+            CoefficientComponent component;
+            component.ID = input.ID;
+            component.HSampFactor = transpose ? input.VSampFactor : input.HSampFactor;
+            component.VSampFactor = transpose ? input.HSampFactor : input.VSampFactor;
+            component.QTableNumber = input.QTableNumber;
+            component.blocksPerLine = MCUCols * component.HSampFactor;
+            component.blocksPerColumn = MCURows * component.VSampFactor;
+            component.coefficients.resize( component.blocksPerLine * component.blocksPerColumn * 64 );
+            
+            for ( int row = 0; row < component.blocksPerColumn; ++row )
+            {
+                for ( int col = 0; col < component.blocksPerLine; ++col )
+                {
+                    // Position of the block in the transposed (but not yet flipped) grid
+                    int r = flipV ? component.blocksPerColumn - 1 - row : row;
+                    int c = flipH ? component.blocksPerLine - 1 - col : col;
+                    
+                    const Int16* in = transpose ? input.getBlock( c, r ) : input.getBlock( r, c );
+                    Int16* out = component.getBlock( row, col );
+                    
+                    for ( int v = 0; v < 8; ++v )
+                        for ( int u = 0; u < 8; ++u )
+                            out[v * 8 + u] = sign[v * 8 + u] * ( transpose ? in[u * 8 + v] : in[v * 8 + u] );
+                }
+            }
+            
+            result.components.push_back( std::move( component ) );
+        }
+        
+        LOG(Logger::Level::DEBUG) << "Transformed DCT coefficients [OK] " << width << "x" << height << std::endl;
+        
+        return true;
+    }
+    
+    bool cropCoefficients( const JPEGCoefficients& source,
+                           const int x,
+                           const int y,
+                           const int width,
+                           const int height,
+                           JPEGCoefficients& result )
+    {
+        if ( source.components.empty() || source.width <= 0 || source.height <= 0 )
+        {
+            LOG(Logger::Level::ERROR) << "No coefficients to crop" << std::endl;
+            return false;
+        }
+        
+        int maxHSampFactor = 1, maxVSampFactor = 1;
+        
+        for ( auto&& component : source.components )
+        {
+            maxHSampFactor = std::max( maxHSampFactor, component.HSampFactor );
+            maxVSampFactor = std::max( maxVSampFactor, component.VSampFactor );
+        }
+        
+        const int MCUWidth = 8 * maxHSampFactor;
+        const int MCUHeight = 8 * maxVSampFactor;
+        
+        if ( x < 0 || y < 0 || x % MCUWidth != 0 || y % MCUHeight != 0 )
+        {
+            LOG(Logger::Level::ERROR) << "Crop offset " << x << "," << y << " isn't aligned to the "
+                                      << MCUWidth << "x" << MCUHeight << " MCUs" << std::endl;
+            return false;
+        }
+        
+        if ( width <= 0 || height <= 0 || x >= source.width || y >= source.height )
+        {
+            LOG(Logger::Level::ERROR) << "Crop rectangle is empty or outside the image" << std::endl;
+            return false;
+        }
+        
+        // The right & bottom edges needn't be aligned, the
+        // partial MCUs there are cropped away by the decoder
+        const int croppedWidth = std::min( width, source.width - x );
+        const int croppedHeight = std::min( height, source.height - y );
+        
+        const int MCUCols = ( croppedWidth + MCUWidth - 1 ) / MCUWidth;
+        const int MCURows = ( croppedHeight + MCUHeight - 1 ) / MCUHeight;
+        
+        result.width = croppedWidth;
+        result.height = croppedHeight;
+        result.QTables = source.QTables;
+        result.components.clear();
+        
+        for ( auto&& input : source.components )
+        {
+            CoefficientComponent component;
+            component.ID = input.ID;
+            component.HSampFactor = input.HSampFactor;
+            component.VSampFactor = input.VSampFactor;
+            component.QTableNumber = input.QTableNumber;
+            component.blocksPerLine = MCUCols * component.HSampFactor;
+            component.blocksPerColumn = MCURows * component.VSampFactor;
+            component.coefficients.resize( component.blocksPerLine * component.blocksPerColumn * 64 );
+            
+            const int firstRow = y / MCUHeight * component.VSampFactor;
+            const int firstCol = x / MCUWidth * component.HSampFactor;
+            
+            // The rows of blocks are contiguous, so each is a single copy
+            for ( int row = 0; row < component.blocksPerColumn; ++row )
+            {
+                const Int16* in = input.getBlock( firstRow + row, firstCol );
+                std::copy( in, in + component.blocksPerLine * 64, component.getBlock( row, 0 ) );
+            }
+            
+            result.components.push_back( std::move( component ) );
+        }
+        
+        LOG(Logger::Level::DEBUG) << "Cropped DCT coefficients [OK] " << croppedWidth << "x" << croppedHeight
+                                  << "+" << x << "+" << y << std::endl;
+        
+        return true;
+    }
+    
+    /**
+     * @brief The 1-D operators merging the 4 low frequencies of two adjacent
+     * 8-point DCTs, [0] for the left (top) & [1] for the right (bottom) one,
+     * into the 8-point DCT of the half resolution signal.
+     * 
+     * The 4 low frequencies of an 8-point DCT are sqrt(2) times the 4-point
+     * DCT of the signal averaged pairwise, so the operator is the 8-point DCT
+     * of the two 4-point IDCTs, scaled by 1/sqrt(2).
+     */
+    static const std::array<std::array<std::array<float, 4>, 8>, 2>& getDownscaleOperators()
+    {
+        static const auto operators = []()
+        {
+            std::array<std::array<std::array<float, 4>, 8>, 2> M{};
+            
+            for ( int half = 0; half < 2; ++half )
+            {
+                for ( int k = 0; k < 8; ++k )
+                {
+                    for ( int n = 0; n < 4; ++n )
+                    {
+                        double sum = 0.0;
+                        
+                        for ( int x = 0; x < 4; ++x )
+                        {
+                            double DCT8 = ( k == 0 ? std::sqrt( 1.0 / 8 ) : 0.5 ) * std::cos( ( 2 * ( 4 * half + x ) + 1 ) * k * M_PI / 16 );
+                            double IDCT4 = ( n == 0 ? 0.5 : std::sqrt( 0.5 ) ) * std::cos( ( 2 * x + 1 ) * n * M_PI / 8 );
+                            sum += DCT8 * IDCT4;
+                        }
+                        
+                        M[half][k][n] = sum / std::sqrt( 2.0 );
+                    }
+                }
+            }
+            
+            return M;
+        }();
+        
+        return operators;
+    }
+    
+    bool downscaleCoefficients( const JPEGCoefficients& source, JPEGCoefficients& result )
+    {
+        if ( source.components.empty() || source.width <= 0 || source.height <= 0 )
+        {
+            LOG(Logger::Level::ERROR) << "No coefficients to downscale" << std::endl;
+            return false;
+        }
+        
+        int maxHSampFactor = 1, maxVSampFactor = 1;
+        
+        for ( auto&& component : source.components )
+        {
+            maxHSampFactor = std::max( maxHSampFactor, component.HSampFactor );
+            maxVSampFactor = std::max( maxVSampFactor, component.VSampFactor );
+        }
+        
+        const int width = ( source.width + 1 ) / 2;
+        const int height = ( source.height + 1 ) / 2;
+        
+        const int MCUCols = ( width + 8 * maxHSampFactor - 1 ) / ( 8 * maxHSampFactor );
+        const int MCURows = ( height + 8 * maxVSampFactor - 1 ) / ( 8 * maxVSampFactor );
+        
+        const auto& M = getDownscaleOperators();
+        
+        result.width = width;
+        result.height = height;
+        result.QTables = source.QTables;
+        result.components.clear();
+        
+        for ( auto&& input : source.components )
+        {
+            CoefficientComponent component;
+            component.ID = input.ID;
+            component.HSampFactor = input.HSampFactor;
+            component.VSampFactor = input.VSampFactor;
+            component.QTableNumber = input.QTableNumber;
+            component.blocksPerLine = MCUCols * component.HSampFactor;
+            component.blocksPerColumn = MCURows * component.VSampFactor;
+            component.coefficients.resize( component.blocksPerLine * component.blocksPerColumn * 64 );
+            
+            const QuantizationTable& QTable = source.QTables[input.QTableNumber];
+            
+            for ( int row = 0; row < component.blocksPerColumn; ++row )
+            {
+                for ( int col = 0; col < component.blocksPerLine; ++col )
+                {
+                    float merged[64] = {};
+                    
+                    for ( int i = 0; i < 2; ++i )
+                    {
+                        for ( int j = 0; j < 2; ++j )
+                        {
+                            // The padding blocks of the output may lie past the
+                            // source's, the edge blocks are repeated for those
+                            const Int16* in = input.getBlock( std::min( 2 * row + i, input.blocksPerColumn - 1 ),
+                                                              std::min( 2 * col + j, input.blocksPerLine - 1 ) );
+                            
+                            // Vertical pass over the dequantized 4x4 low frequencies
+                            float temp[8][4];
+                            
+                            for ( int k = 0; k < 8; ++k )
+                            {
+                                for ( int u = 0; u < 4; ++u )
+                                {
+                                    float sum = 0.0f;
+                                    
+                                    for ( int v = 0; v < 4; ++v )
+                                        sum += M[i][k][v] * in[v * 8 + u] * QTable[v * 8 + u];
+                                    
+                                    temp[k][u] = sum;
+                                }
+                            }
+                            
+                            // Horizontal pass
+                            for ( int k = 0; k < 8; ++k )
+                                for ( int l = 0; l < 8; ++l )
+                                    for ( int u = 0; u < 4; ++u )
+                                        merged[k * 8 + l] += temp[k][u] * M[j][l][u];
+                        }
+                    }
+                    
+                    Int16* out = component.getBlock( row, col );
+                    
+                    for ( int k = 0; k < 64; ++k )
+                    {
+                        int value = std::lround( merged[k] / QTable[k] );
+                        out[k] = std::max( k == 0 ? -1024 : -1023, std::min( value, 1023 ) );
+                    }
+                }
+            }
+            
+            result.components.push_back( std::move( component ) );
+        }
+        
+        LOG(Logger::Level::DEBUG) << "Downscaled DCT coefficients [OK] " << width << "x" << height << std::endl;
+        
+        return true;
+    }
+}